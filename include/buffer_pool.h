@@ -0,0 +1,50 @@
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "packet_handler.h"
+
+#define SMALL_BUFFER_SIZE 256 //headers, packets and packets without data
+#define MEDIUM_BUFFER_SIZE MAX_LENGTH //whole packet of VERSION
+#define LARGE_BUFFER_SIZE MAX_LENGTH_EXTENDED //whole packet of
+                                              //VERSION_EXTENDED
+#define NUM_BUFFER_CLASSES 3
+#define UNPOOLED_BUFFER NUM_BUFFER_CLASSES //class of a bigger buffer
+
+#define MAX_FREE_SMALL_BUFFERS 256 //buffers kept by each thread for later
+#define MAX_FREE_MEDIUM_BUFFERS 16
+#define MAX_FREE_LARGE_BUFFERS 4
+
+//Data structure written before each buffer, its class and the next
+//free buffer of the same class while it is in a free list
+typedef union _buffer_header{
+	struct{
+		unsigned int sizeClass;
+		union _buffer_header *next;
+	} info;
+	max_align_t alignment; //the buffer after it is aligned as malloc's
+} BufferHeader;
+
+/*
+ * Taking a buffer of at least the given size, from the free list of
+ * the thread for its class, or allocated if the list is empty
+ */
+void * buffer_alloc(size_t size);
+
+/*
+ * Same as buffer_alloc, the given size being filled with zeros
+ */
+void * buffer_calloc(size_t size);
+
+/*
+ * Giving back a buffer to the free list of the thread, or free-ing it
+ * if the list is full
+ */
+void buffer_free(void *buffer);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __CHUNK_STORE_H__
+#define __CHUNK_STORE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+#include "sha256.h"
+
+#define CHUNK_STORE_NAME "server.chunks" //directory of the chunk store in the
+                                         //storage directory, one file per
+                                         //chunk named by its digest
+#define CHUNK_DIR_SIZE 4096 //maximum length of the path of the chunk store
+
+/*
+ * Putting the chunk store in the given storage directory, once at startup
+ * (the working directory otherwise)
+ */
+void set_chunk_store_directory(const char *storageDirectory);
+
+/*
+ * Telling whether the chunk of the given digest is in the store
+ */
+int chunk_store_has(const unsigned char *digest);
+
+/*
+ * Adding a chunk to the store once its bytes are checked against its digest,
+ * the chunk appears in the store only once it is whole
+ */
+int chunk_store_put(const unsigned char *digest, const unsigned char *data,
+		    unsigned int length);
+
+/*
+ * Opening the file of the chunk of the given digest, to be read
+ *
+ * Returns the file descriptor, or ERR if the chunk is not in the store
+ */
+int chunk_store_open(const unsigned char *digest);
+
+#endif
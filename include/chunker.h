@@ -0,0 +1,41 @@
+#ifndef __CHUNKER_H__
+#define __CHUNKER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+#include "sha256.h"
+
+#define CHUNK_MIN_SIZE 16384 //smallest chunk, except the last one (16KiB)
+#define CHUNK_BOUNDARY_MASK 0xFFFF000000000000ULL //bits of the rolling hash
+                                                  //all 0 at a boundary, one
+                                                  //chance in 64KiB
+//the biggest chunk is MAX_CHUNK_SIZE
+
+//Data structure of one chunk of a file, found where its content tells
+//and known by its digest
+typedef struct _chunk{
+	size_t offset;
+	ChunkEntry entry;
+	int needed; //missing on the server
+} Chunk;
+
+/*
+ * Length of the chunk starting at the given bytes, found by a rolling hash
+ * over their content so that the same content gives the same chunks
+ * wherever it is in the file
+ */
+unsigned int next_chunk_length(const unsigned char *data, size_t size);
+
+/*
+ * Cutting the whole contents of a file into chunks with their digest
+ *
+ * Returns the list of chunks, to be free-ed by the caller
+ */
+Chunk * chunk_contents(const unsigned char *contents, size_t size,
+		       unsigned int *numChunks);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __COMPRESSOR_H__
+#define __COMPRESSOR_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "packet_handler.h"
+#include "lz4.h"
+
+#define MIN_COMPRESSOR_SLOTS 4 //fragments compressed ahead, at least
+#define MAX_COMPRESSOR_WORKERS 64 //maximum number of compressing threads
+
+//Data structure of one fragment of the file to be sent
+typedef struct _fragment{
+	size_t offset;
+	unsigned int length;
+} Fragment;
+
+//Data structure of a fragment once compressed, held until it is sent
+typedef struct _compressed_fragment{
+	size_t index; //fragment held
+	int ready;
+	unsigned char *bytes;
+	unsigned int length; //0 if the fragment doesn't get smaller
+
+	//CRC32C of the fragment and of its compressed bytes, if asked
+	uint32_t rawChecksum;
+	uint32_t checksum;
+} CompressedFragment;
+
+//Data structure of the threads compressing the fragments of a file ahead
+//of the one sending them, in order, each fragment compressed takes a slot
+//until it is sent
+typedef struct _compressor_pool{
+	const unsigned char *contents;
+	const Fragment *fragments;
+	size_t numFragments;
+	int checksums; //the CRC32C are computed by the workers as well
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed; //a slot is filled or released
+	size_t nextCompressed; //next fragment taken by a worker
+	size_t nextSent; //fragments before it don't hold a slot anymore
+	int stopping;
+
+	CompressedFragment *slots;
+	unsigned int numSlots;
+
+	pthread_t *workers;
+	unsigned int numWorkers;
+
+	//Bytes of the fragments, and of what is sent instead
+	size_t numRawBytes;
+	size_t numSentBytes;
+} CompressorPool;
+
+/*
+ * Initialization of a pool of workers compressing the given fragments of
+ * the file contents, and computing their checksums if asked, they start
+ * at once
+ */
+CompressorPool * init_compressor_pool(const unsigned char *contents,
+				      const Fragment *fragments,
+				      size_t numFragments, 
+				      unsigned int numWorkers, int checksums);
+
+/*
+ * Stopping the workers and free-ing the pool, the fragments not sent
+ * yet are dropped
+ */
+void free_compressor_pool(CompressorPool *pool);
+
+/*
+ * Waiting for a fragment to be compressed, the fragments have to be
+ * asked in order
+ */
+const CompressedFragment * compressor_wait(CompressorPool *pool, 
+					   size_t index);
+
+/*
+ * Giving back the slot of a fragment sent, for the next fragment
+ * to be compressed
+ */
+void compressor_release(CompressorPool *pool, size_t index);
+
+#endif
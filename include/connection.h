@@ -0,0 +1,202 @@
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+#include "socket_helper.h"
+#include "frame_decoder.h"
+#include "storage.h"
+#include "transfer.h"
+#include "dedup.h"
+#include "lz4.h"
+
+#define STATE_INIT 1 //initial state before connection setup or
+                     //end of the current connection
+#define STATE_HELLO 2 //state after receiving a Hello command
+#define STATE_DELIVERY 3 //state after receiving a Data Delivery command
+#define STATE_STORE 4 //state after receiving a Data Store command
+#define STATE_CHUNKS 5 //state after receiving a Chunk List command
+#define NUM_STATES 6 //states numbered from 1
+
+#define SPLICE_MIN_SIZE 16384 //smallest rest of data part worth a splice
+#define SPLICE_PIPE_SIZE 1048576 //bytes moved at once by a splice
+
+//Data structure of the context kept for each connected client
+typedef struct _connection{
+	int fd;
+	int current_state;
+	int quickAck; //asked again after each read from the socket
+
+	//Requests of the io_uring backend not completed yet, the context
+	//is free-ed only once the last one is, after it has been closed
+	unsigned int numRingRequests;
+	int receiving; //multishot reception still armed
+	int pollingSend; //waiting for the socket to be writable
+	int closing; //nothing read anymore, the last replies are sent
+
+	//Not read until the windows of its upload are written, linked with
+	//the other stalled connections of its event loop
+	int stalled;
+	struct _connection *nextStalled;
+
+	//Stored file waiting to be synced with others (group commit), the
+	//context is kept until then to acknowledge the store
+	int commitPending;
+	unsigned int storeSequence;
+	uint64_t storeStart; //time of the data store, for its latency
+	unsigned char version; //version of header agreed with the client
+	uint64_t transferId; //agreed in hello (0 if none), names the upload
+
+	//Sequence numbers of the last packet received and of the last
+	//data delivery handled, the latter waiting to be acknowledged
+	unsigned int lastSequence;
+	unsigned int storedSequence;
+	int ackPending;
+
+	//Information regarding file to store, or the transfer shared with
+	//other connections and whether our ranges of it are all written
+	Upload *upload;
+	Transfer *transfer;
+	int transferStored;
+
+	//File sent as a list of chunks, only the missing ones are received
+	DedupUpload *dedup;
+
+	//Bytes read from the socket but not interpreted yet
+	FrameDecoder *decoder;
+
+	//Algorithm agreed for the compressed data parts, which are
+	//decompressed into the buffer (allocated at the first one)
+	unsigned char compression;
+	unsigned char *rawBuffer;
+
+	//Algorithm agreed for the checksums of the data parts and of the
+	//file, every data delivery and the store then carry one
+	unsigned char checksum;
+
+	//Bytes of the current data part to be moved straight from the
+	//socket to the upload, through the pipe, or copied to it as they
+	//are read when too big to be buffered
+	unsigned int spliceRemaining;
+	off_t spliceOffset; //position in the file of a transfer
+	int pipe_fds[2];
+
+	//Bytes waiting for the socket to be writable
+	unsigned char *sendBuffer;
+	unsigned int sendLength;
+	unsigned int sendCapacity;
+} Connection;
+
+/*
+ * Setting the size of the biggest data delivery kept whole in the receive
+ * buffer (at least a frame of VERSION), the rest of a bigger one goes to
+ * the upload as it is read
+ */
+void set_frame_limit(unsigned int numBytes);
+
+/*
+ * Initialization of a new connection context for a non-blocking socket
+ */
+Connection * init_connection(int fd, int init_state);
+
+/*
+ * Free-ing connection context including its buffers, the socket is closed
+ */
+void free_connection(Connection *connToFree);
+
+/*
+ * Reading once from the socket into the free space of receive buffer
+ *
+ * Returns the number of bytes read, 0 if the socket has nothing more for now
+ * or ERR if the client is gone
+ */
+int connection_receive(Connection *conn);
+
+/*
+ * Copying bytes already received from the socket (io_uring backend) into
+ * the free space of receive buffer
+ *
+ * Returns the number of bytes taken, which may be less than given if
+ * the packets already buffered have to be handled first
+ */
+unsigned int connection_receive_bytes(Connection *conn,
+				      const unsigned char *bytes,
+				      unsigned int numBytes);
+
+/*
+ * Interpretating in place the next whole packet found in the receive buffer,
+ * the view is valid until the next reception, a data part is checked
+ * against its checksum then given decompressed
+ *
+ * Returns OK with a packet, NEED_MORE_BYTES if the packet is not
+ * complete yet or ERR if the bytes are not a valid packet
+ */
+int connection_next_packet(Connection *conn, PacketView *readPacket);
+
+/*
+ * Interpretating in place the next whole packet found at the beginning of
+ * bytes received outside the receive buffer (io_uring backend), as long
+ * as the receive buffer is empty, the view is valid as long as the bytes
+ *
+ * Returns OK with a packet and the number of bytes it takes,
+ * NEED_MORE_BYTES if the bytes don't hold a whole packet or some are
+ * buffered before them, or ERR if the bytes are not a valid packet
+ */
+int connection_packet_in(Connection *conn, const unsigned char *bytes,
+			 unsigned int numBytes, PacketView *readPacket,
+			 unsigned int *packetLength);
+
+/*
+ * Taking in place the beginning of an incomplete DATA DELIVERY packet whose
+ * rest of data part is big enough to be moved straight from the socket
+ * to the upload (splice, if asked), or too big to be buffered whole
+ *
+ * Returns OK with the buffered part of the packet, NEED_MORE_BYTES if
+ * the packet is not worth it or ERR if the bytes are not a valid packet
+ */
+int connection_take_partial_packet(Connection *conn, PacketView *readPacket,
+				   int splicing);
+
+/*
+ * Moving the rest of the current data part straight from the socket 
+ * to the upload
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone
+ */
+int connection_splice(Connection *conn);
+
+/*
+ * Reading the rest of the current data part from the socket and copying
+ * it to the upload, through the receive buffer
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone or the file can't be written
+ */
+int connection_stream(Connection *conn);
+
+/*
+ * Copying to the upload the bytes of the rest of the current data part
+ * found at the beginning of the given ones (io_uring backend)
+ *
+ * Returns the number of bytes taken, or ERR if the file can't be written
+ */
+int connection_stream_bytes(Connection *conn, const unsigned char *bytes,
+			    unsigned int numBytes);
+
+/*
+ * Queuing bytes to be sent to the client, then trying to send them
+ */
+int connection_send(Connection *conn, const unsigned char *bytes,
+		    unsigned int numBytes);
+
+/*
+ * Sending as many queued bytes as the socket accepts
+ */
+int connection_flush(Connection *conn);
+
+#endif
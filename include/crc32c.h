@@ -0,0 +1,32 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 //Castagnoli, reversed
+#define CRC32C_LONG_BLOCK 8192 //bytes of each of the 3 streams computed
+#define CRC32C_SHORT_BLOCK 256 //at once by the instruction (powers of 2)
+
+/*
+ * Adding some bytes to a CRC32C, starting from 0 for the first bytes,
+ * computed by the SSE4.2 instruction when the processor has it or by
+ * tables 8 bytes at a time otherwise (chosen at the first call)
+ */
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t length);
+
+/*
+ * CRC32C of two blocks put one after the other, from the CRC32C of each
+ * block and the length of the second one, without reading them again
+ */
+uint32_t crc32c_combine(uint32_t firstCrc, uint32_t secondCrc, 
+			uint64_t secondLength);
+
+/*
+ * Name of the implementation chosen for this processor
+ */
+const char * crc32c_implementation(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+#include "storage.h"
+#include "chunk_store.h"
+
+//Data structure of an upload sent as a list of chunks, only the chunks
+//missing in the store are received, the file is built from the store
+//once stored
+typedef struct _dedup_upload{
+	//Chunks of the file, in order
+	ChunkEntry *entries;
+	unsigned int numEntries;
+	unsigned int capacity;
+
+	//Chunks asked to the client, in the order they are received,
+	//and the next one expected
+	unsigned int *missing;
+	unsigned int numMissing;
+	unsigned int nextMissing;
+
+	//Set of the chunks asked to the client (index + 1, 0 if empty), so
+	//that a chunk found several times in the file is asked only once
+	unsigned int *requested;
+	unsigned int requestedSize;
+} DedupUpload;
+
+/*
+ * Initialization of a new upload sent as a list of chunks
+ */
+DedupUpload * init_dedup_upload(void);
+
+/*
+ * Free-ing upload data structure including its lists
+ */
+void free_dedup_upload(DedupUpload *dedupToFree);
+
+/*
+ * Adding the next chunks of the file given in a chunk list, one bit per
+ * chunk is set in the bitmap given by the caller if the chunk is missing
+ *
+ * Returns ERR if the list is invalid, OK otherwise
+ */
+int dedup_add_list(DedupUpload *dedup, const unsigned char *listBytes,
+		   unsigned int listLength, unsigned char *needBitmap);
+
+/*
+ * Storing the next missing chunk received from the client
+ *
+ * Returns ERR if it is not the chunk expected, OK otherwise
+ */
+int dedup_put_chunk(DedupUpload *dedup, const unsigned char *data,
+		    unsigned int dataLength);
+
+/*
+ * Building the file from the chunks in the store, once all the missing
+ * ones are received, next to the given final name and checked against its
+ * CRC32C if given
+ *
+ * Returns NULL if the file can't be built or is not the one sent
+ */
+Upload * dedup_assemble(DedupUpload *dedup, const char *targetName,
+			unsigned int windowSize, const uint32_t *fileChecksum);
+
+#endif
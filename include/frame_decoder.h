@@ -0,0 +1,100 @@
+#ifndef __FRAME_DECODER_H__
+#define __FRAME_DECODER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+
+#define MAX_FRAME_SIZE 65535 //length field of the header is 2bytes, the buffer
+                             //grows for bigger frames of VERSION_EXTENDED
+#define READ_CHUNK_SIZE 65536 //bytes asked to the socket at each read
+#define NEED_MORE_BYTES 1 //the buffered bytes don't hold a whole frame yet
+#define DECODER_BUFFER_SIZE (MAX_FRAME_SIZE + READ_CHUNK_SIZE) //first size of
+                             //the buffer, back to it after a bigger frame
+
+//Data structure of one whole frame (header followed by data part)
+//pointing into the buffer of the decoder
+typedef struct _frame{
+	const unsigned char *bytes;
+	unsigned int length;
+} Frame;
+
+//Data structure of a resumable decoder cutting a stream of bytes
+//into frames
+typedef struct _frame_decoder{
+	unsigned char *buffer;
+	unsigned int capacity;
+	unsigned int start; //first byte not handed out as a frame yet
+	unsigned int end;   //end of the buffered bytes
+
+	//Length of the incomplete frame at the start, once its header is
+	//whole (0 otherwise), the buffer grows as its bytes come
+	unsigned int pendingLength;
+} FrameDecoder;
+
+/*
+ * Initialization of a new decoder with an empty buffer big enough for
+ * one incomplete frame (VERSION) followed by a whole read chunk
+ */
+FrameDecoder * init_frame_decoder(void);
+
+/*
+ * Free-ing decoder data structure including its buffer
+ */
+void free_frame_decoder(FrameDecoder *decoderToFree);
+
+/*
+ * Giving the free space where the next bytes of the stream can be read to,
+ * the frames handed out before are no longer valid after this call, the
+ * buffer grows only once filled by the bytes of a big frame, and shrinks
+ * back once that frame is handed out
+ */
+unsigned char * decoder_space(FrameDecoder *decoder, unsigned int *freeBytes);
+
+/*
+ * Adding to the buffered bytes the ones just read into the free space
+ */
+void decoder_commit(FrameDecoder *decoder, unsigned int numBytes);
+
+/*
+ * Copying a chunk of bytes of any size into the decoder
+ *
+ * Returns the number of bytes taken, which may be less than given if
+ * the frames already buffered have to be handed out first
+ */
+unsigned int decoder_consume(FrameDecoder *decoder,
+			     const unsigned char *chunk, unsigned int numBytes);
+
+/*
+ * Cutting the next whole frame out of bytes kept outside any decoder
+ *
+ * Returns OK with a frame, NEED_MORE_BYTES if the frame is not complete
+ * yet (with its length once its header is whole, 0 before) or ERR if the
+ * header is invalid
+ */
+int next_frame_in(const unsigned char *bytes, unsigned int numBytes,
+		  Frame *frame);
+
+/*
+ * Handing out the next whole frame found in the buffered bytes, valid
+ * until the next call to the decoder
+ *
+ * Returns OK with a frame, NEED_MORE_BYTES if the frame is not
+ * complete yet or ERR if the header is invalid
+ */
+int decoder_next_frame(FrameDecoder *decoder, Frame *frame);
+
+/*
+ * Handing out the beginning of an incomplete frame whose header is whole,
+ * the rest of its data part is then left to the caller to be taken from 
+ * the stream
+ *
+ * Returns OK with the buffered part of the frame, NEED_MORE_BYTES if 
+ * the header is not complete yet or ERR if the header is invalid
+ */
+int decoder_take_partial(FrameDecoder *decoder, Frame *frame);
+
+#endif
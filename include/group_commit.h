@@ -0,0 +1,67 @@
+#ifndef __GROUP_COMMIT_H__
+#define __GROUP_COMMIT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csapp.h"
+#include "packet_handler.h"
+#include "storage.h"
+
+#define SYNCFS_MIN_BATCH 8 //files of a batch from which the whole file
+                           //system is synced at once (syncfs)
+
+//Data structure of a finished upload waiting to be synced then to take
+//its name, handed back to the event loop of its connection once done
+typedef struct _commit_request{
+	Upload *upload;
+	char targetName[MAX_NAME_SIZE];
+	void *context; //connection waiting for the commit
+	int status;
+
+	struct _commit_waiter *waiter;
+	struct _commit_request *next;
+} CommitRequest;
+
+//Data structure of an event loop waiting for its commits, its event file
+//is readable once some of them are done
+typedef struct _commit_waiter{
+	int eventFd;
+	CommitRequest *done; //pushed by the committing thread without lock
+} CommitWaiter;
+
+/*
+ * Starting the thread which syncs the finished uploads by batches, it runs
+ * until the process ends
+ */
+void start_group_commit(void);
+
+/*
+ * Initialization of the waiter of an event loop, with its event file
+ *
+ * Returns NULL if the event file can't be created
+ */
+CommitWaiter * init_commit_waiter(void);
+
+/*
+ * Free-ing the waiter of an event loop, once no commit of it is left
+ */
+void free_commit_waiter(CommitWaiter *waiter);
+
+/*
+ * Handing a finished upload to the committing thread, the upload is its
+ * own from now on
+ */
+void queue_commit(CommitWaiter *waiter, Upload *upload,
+		  const char *targetName, void *context);
+
+/*
+ * Taking all the commits done for an event loop, to be free-ed by it
+ *
+ * Returns NULL if there is none
+ */
+CommitRequest * take_done_commits(CommitWaiter *waiter);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTOGRAM_SUB_BUCKETS 128 //values told apart within a power of two
+                                  //once doubled (relative error < 1%)
+#define HISTOGRAM_HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS/2)
+#define HISTOGRAM_SUB_BITS 7 //log2(HISTOGRAM_SUB_BUCKETS)
+#define HISTOGRAM_COUNTS ((64 - HISTOGRAM_SUB_BITS + 2) * \
+			  HISTOGRAM_HALF_BUCKETS) //counts covering 64bits values
+
+//Data structure of a histogram of values (latencies in nanoseconds), the
+//values are counted in buckets of the same relative width (HdrHistogram)
+typedef struct _histogram{
+	uint64_t counts[HISTOGRAM_COUNTS];
+	uint64_t totalCount;
+	uint64_t min;
+	uint64_t max;
+	long double sum;
+} Histogram;
+
+/*
+ * Emptying a histogram
+ */
+void init_histogram(Histogram *histogram);
+
+/*
+ * Counting one value in its bucket
+ */
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/*
+ * Adding the values counted by a histogram to another one
+ */
+void histogram_add(Histogram *histogram, const Histogram *other);
+
+/*
+ * Value below which the given percentage of the values are, given as
+ * the highest value of its bucket (0 for an empty histogram)
+ */
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+
+/*
+ * Mean of the counted values (0 for an empty histogram)
+ */
+double histogram_mean(const Histogram *histogram);
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef __IO_RING_H__
+#define __IO_RING_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+
+#include "packet_handler.h"
+
+#define IO_RING_ENTRIES 256 //requests submitted at once (completions: twice)
+#define IO_RING_BUFFER_GROUP 0 //group of the buffers given to the receptions
+#define IO_RING_INLINE 0x1 //tag (lowest bit of the user data) of the requests
+                           //completed by their own function as soon as seen
+
+//Data structure of one completion of a request, as seen by the caller
+typedef struct _io_ring_completion{
+	uint64_t userData;
+	int result;
+	unsigned int flags;
+} IoRingCompletion;
+
+//Data structure of a request completed by its own function wherever its
+//completion is seen, its address (tagged IO_RING_INLINE) is the user data
+typedef struct _io_ring_request{
+	void (*complete)(struct _io_ring_request *request, int result);
+} IoRingRequest;
+
+//Data structure of an io_uring instance driven with the raw system calls:
+//one submission queue and one completion queue shared with the kernel,
+//and a ring of buffers the kernel picks from for the receptions
+typedef struct _io_ring{
+	int fd;
+
+	//Submission queue, the requests are counted by the local tail
+	//until they are handed to the kernel
+	void *sqRing;
+	size_t sqRingSize;
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int sqMask;
+	unsigned int *sqArray;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned int sqLocalTail;
+
+	//Completion queue (in the same mapping as the submission queue
+	//with IORING_FEAT_SINGLE_MMAP)
+	void *cqRing;
+	size_t cqRingSize;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	struct io_uring_cqe *cqes;
+
+	//Completions seen while waiting for inline requests, handed out
+	//to the caller afterwards in the same order
+	IoRingCompletion *deferred;
+	unsigned int numDeferred;
+	unsigned int firstDeferred;
+	unsigned int deferredCapacity;
+
+	//Buffers given to the kernel for the receptions (provided buffers)
+	struct io_uring_buf_ring *bufferRing;
+	unsigned char *buffers;
+	unsigned int numBuffers;
+	unsigned int bufferSize;
+} IoRing;
+
+/*
+ * Initialization of a new io_uring instance with its queues mapped
+ *
+ * Returns NULL if the kernel doesn't have io_uring (or forbids it)
+ */
+IoRing * init_io_ring(unsigned int numEntries);
+
+/*
+ * Free-ing an io_uring instance, its queues and its buffers
+ */
+void free_io_ring(IoRing *ring);
+
+/*
+ * Giving the kernel a ring of buffers to pick from for the receptions
+ * (IOSQE_BUFFER_SELECT), their number must be a power of two
+ *
+ * Returns ERR if the kernel doesn't know rings of provided buffers
+ */
+int io_ring_provide_buffers(IoRing *ring, unsigned int numBuffers,
+			    unsigned int bufferSize);
+
+/*
+ * Checking that the kernel receives with multishot requests into the
+ * provided buffers (Linux 6.0, io_uring and rings of buffers are older),
+ * by receiving one byte from a pair of sockets, the buffers are given
+ * first
+ *
+ * Returns ERR if the receptions would fail
+ */
+int io_ring_probe_receive(IoRing *ring);
+
+/*
+ * Bytes of the provided buffer given in a completion
+ */
+unsigned char * io_ring_buffer(IoRing *ring, unsigned int flags);
+
+/*
+ * Giving back to the kernel the provided buffer of a completion, once
+ * its bytes are used
+ */
+void io_ring_recycle_buffer(IoRing *ring, unsigned int flags);
+
+/*
+ * Accepting all the connection requests of a listening socket with one
+ * request (multishot), the new sockets are non-blocking
+ */
+void io_ring_accept(IoRing *ring, int server_fd, uint64_t userData);
+
+/*
+ * Receiving from a socket into the provided buffers with one request
+ * (multishot), for as long as the socket is open and buffers are left
+ */
+void io_ring_receive(IoRing *ring, int socket_fd, uint64_t userData);
+
+/*
+ * Waiting once for a socket to be ready for the given events (poll)
+ */
+void io_ring_poll(IoRing *ring, int socket_fd, unsigned int events,
+		  uint64_t userData);
+
+/*
+ * Writing bytes at a position of a file
+ */
+void io_ring_write(IoRing *ring, int fd, const unsigned char *bytes,
+		   unsigned int numBytes, off_t offset, uint64_t userData);
+
+/*
+ * Cancelling the requests submitted with the given user data
+ */
+void io_ring_cancel(IoRing *ring, uint64_t targetUserData,
+		    uint64_t userData);
+
+/*
+ * Handing the submitted requests to the kernel, then waiting for at least
+ * minComplete completions (none if some completions are already waiting)
+ *
+ * Returns ERR if the kernel refused them
+ */
+int io_ring_submit(IoRing *ring, unsigned int minComplete);
+
+/*
+ * Taking the next completion, the ones of inline requests are completed
+ * by their own function on the way
+ *
+ * Returns 1 with a completion, 0 if there is none for now
+ */
+int io_ring_next_completion(IoRing *ring, IoRingCompletion *completion);
+
+/*
+ * Waiting until a counter of inline requests drops to 0, the other
+ * completions seen meanwhile are kept for io_ring_next_completion
+ *
+ * Returns ERR if the kernel can't be waited for
+ */
+int io_ring_wait_inline(IoRing *ring, const unsigned int *numPending);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_handler.h"
+
+#define LZ4_HASH_LOG 16 //the compressor remembers 2^16 positions
+#define LZ4_TABLE_SIZE (1 << LZ4_HASH_LOG) //entries of the table of positions
+#define LZ4_MIN_MATCH 4 //shortest match of a sequence
+#define LZ4_LAST_LITERALS 5 //the last bytes of a block are always literals
+#define LZ4_MF_LIMIT 12 //no match starts in the last bytes of a block
+#define LZ4_MAX_OFFSET 65535 //farthest match of a sequence
+
+//Biggest size of a compressed block of the given size (incompressible)
+#define LZ4_COMPRESS_BOUND(size) ((size) + (size)/255 + 16)
+
+/*
+ * Compressing some bytes into one block of the LZ4 block format, written to
+ * a buffer given by the caller, with a table of LZ4_TABLE_SIZE positions
+ * kept by the caller from one block to the next (never cleared, what is
+ * left of a previous block is checked before being used)
+ *
+ * Returns the size of the block, or 0 if it doesn't fit in the buffer
+ */
+unsigned int lz4_compress(const unsigned char *source, unsigned int sourceSize,
+			  unsigned char *block, unsigned int blockCapacity,
+			  uint32_t *table);
+
+/*
+ * Decompressing one block of the LZ4 block format, written to a buffer
+ * given by the caller
+ *
+ * Returns the number of bytes decompressed, or ERR if the block is invalid
+ * or doesn't fit in the buffer
+ */
+int lz4_decompress(const unsigned char *block, unsigned int blockSize,
+		   unsigned char *output, unsigned int outputCapacity);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csapp.h"
+#include "packet_handler.h"
+#include "socket_helper.h"
+#include "write_queue.h"
+#include "connection.h"
+
+#define NUM_STORE_BUCKETS 12 //bounds of the store latency histogram
+#define MAX_METRICS_REQUEST_SIZE 1024 //bytes of an HTTP request read at most
+
+//Reasons of the error packets sent by the server
+#define ERROR_REASON_INVALID 0 //bytes not making a valid packet
+#define ERROR_REASON_VERSION 1 //version of header other than the agreed one
+#define ERROR_REASON_SEQUENCE 2 //packet of extended version missing
+#define ERROR_REASON_COMMAND 3 //command not expected in the current state
+#define ERROR_REASON_NO_DEDUP 4 //chunk list without deduplication agreed
+#define ERROR_REASON_STORE 5 //file couldn't be stored
+#define NUM_ERROR_REASONS 6
+
+//Data structure of the counters of one thread, written by it only and
+//read by the metrics listener without lock: no two threads share a
+//cache line of them
+typedef struct _thread_metrics{
+	uint64_t numAccepted;
+	uint64_t numClosed;
+
+	//Frames and bytes (headers included) per command
+	uint64_t numFramesIn[MAX_COMMAND + 1];
+	uint64_t numBytesIn[MAX_COMMAND + 1];
+	uint64_t numFramesOut[MAX_COMMAND + 1];
+	uint64_t numBytesOut[MAX_COMMAND + 1];
+
+	uint64_t numErrors[NUM_ERROR_REASONS];
+	uint64_t numTransitions[NUM_STATES][NUM_STATES]; //from, to
+
+	//Stores counted in the bucket of their latency (the last one for
+	//the slowest ones), and their total latency in nanoseconds
+	uint64_t storeCounts[NUM_STORE_BUCKETS + 1];
+	uint64_t storeNanoseconds;
+
+	struct _thread_metrics *next;
+} __attribute__((aligned(CACHE_LINE_SIZE))) ThreadMetrics;
+
+/*
+ * Starting the thread answering the scrapes of the metrics on the address
+ * and port of the given options, the counters are kept from now on
+ *
+ * Returns ERR if the listening socket can't be created
+ */
+int start_metrics_listener(const SocketOptions *options);
+
+/*
+ * Current time of the monotonic clock in nanoseconds
+ */
+uint64_t metrics_now(void);
+
+/*
+ * Counting a connection accepted from a client
+ */
+void metrics_connection_opened(void);
+
+/*
+ * Counting a connection closed
+ */
+void metrics_connection_closed(void);
+
+/*
+ * Counting a frame received with its command and its size
+ */
+void metrics_received(unsigned int command, unsigned int numBytes);
+
+/*
+ * Counting a frame sent with its command and its size
+ */
+void metrics_sent(unsigned int command, unsigned int numBytes);
+
+/*
+ * Counting an error met with a client for the given reason, an error
+ * packet tells it when its version allows
+ */
+void metrics_error_sent(int reason);
+
+/*
+ * Counting a move of the state machine of a connection, to the same
+ * state included
+ */
+void metrics_transition(int fromState, int toState);
+
+/*
+ * Counting a store acknowledged (or given up) with its latency, from its
+ * data store packet on
+ */
+void metrics_store_done(uint64_t numNanoseconds);
+
+#endif
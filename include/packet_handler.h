@@ -6,46 +6,198 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "sha256.h"
+
 #define ERR -1
 #define OK 0
 
 #define VERSION 0x04
+#define VERSION_EXTENDED 0x05 //32bits sequence and length, negotiated in hello
 #define USER_ID 0x08
 
+#define HEADER_SIZE 8 //size of header of VERSION
+#define HEADER_SIZE_EXTENDED 16 //size of header of VERSION_EXTENDED
+#define MAX_LENGTH 65535 //maximum packet length of VERSION (2bytes)
+#define MAX_LENGTH_EXTENDED 4194368 //maximum packet length of 
+                                    //VERSION_EXTENDED (4MiB of data + 64)
+#define MAX_DATA_SIZE_EXTENDED 4194304 //largest data part sent with
+                                       //VERSION_EXTENDED (4MiB)
+
+#define FLAG_OFFSET 0x0001 //VERSION_EXTENDED flag: the data part starts with
+                          //its position in the file (8bytes)
+#define FLAG_COMPRESSED 0x0002 //VERSION_EXTENDED flag: the data part is
+                              //compressed, preceded by its size once
+                              //decompressed (4bytes)
+#define FLAG_CHECKSUM 0x0004 //VERSION_EXTENDED flag: the packet ends with
+                            //a CRC32C (4bytes) of its data part as sent,
+                            //or of the whole file for a data store
+#define KNOWN_FLAGS (FLAG_OFFSET | FLAG_COMPRESSED | FLAG_CHECKSUM)
+#define OFFSET_SIZE 8 //size of the position in file of a data part
+#define RAW_LENGTH_SIZE 4 //size of the decompressed size of a data part
+#define CHECKSUM_SIZE 4 //size of the CRC32C after the data part
+#define MAX_PREFIX_SIZE (HEADER_SIZE_EXTENDED + OFFSET_SIZE + \
+			 RAW_LENGTH_SIZE) //header, position and raw size
+
+#define MAX_HELLO_SIZE 256 //maximum size of the hello parameters
+#define HELLO_TAG_VERSION 0x01 //hello parameter: highest version known (1byte)
+#define HELLO_TAG_TRANSFER 0x02 //hello parameter: transfer shared by several
+                                //connections, its ID (8bytes)
+#define HELLO_TAG_STREAMS 0x03 //hello parameter: number of connections of
+                               //the transfer (2bytes)
+#define HELLO_TAG_RESUME 0x04 //hello parameter: transfer resumed, position
+                              //from which the data is still needed (8bytes)
+#define HELLO_TAG_DEDUP 0x05 //hello parameter: file sent as a list of chunks,
+                             //only the ones missing on the server (0byte)
+#define HELLO_TAG_COMPRESSION 0x06 //hello parameter: algorithm of the
+                                   //compressed data parts (1byte)
+
+#define HELLO_TAG_CHECKSUM 0x07 //hello parameter: algorithm of the checksums
+                                //of the data parts and of the file (1byte)
+
+#define COMPRESSION_NONE 0x00
+#define COMPRESSION_LZ4 0x01 //LZ4 block format
+
+#define CHECKSUM_NONE 0x00
+#define CHECKSUM_CRC32C 0x01
+
+#define CHUNK_ENTRY_SIZE (DIGEST_SIZE + 4) //digest and length of a chunk
+#define MAX_CHUNK_SIZE 262144 //largest chunk of a chunk list (256KiB)
+
 #define CLIENT_HELLO 0x0001
 #define SERVER_HELLO 0x0002
 #define DATA_DELIVERY 0x0003
 #define DATA_STORE 0x0004
 #define ERROR 0x0005
+#define ACK 0x0006 //VERSION_EXTENDED only, sequence num of the header is the
+                   //highest one received without gap (or of a stored upload)
+#define CHUNK_LIST 0x0007 //VERSION_EXTENDED only, next chunks of the file
+#define CHUNK_NEED 0x0008 //VERSION_EXTENDED only, one bit per chunk of the
+                          //list, set if the chunk has to be sent
+#define MAX_COMMAND CHUNK_NEED
 
 //Data structure of Header
+//(sizes for VERSION, then for VERSION_EXTENDED)
 typedef struct _header{
 	unsigned char version; //1byte
 	unsigned char userId;  //1byte
-	unsigned int sequence; //2bytes
-	unsigned int length;   //2bytes
-	unsigned int command;  //2bytes
+	unsigned int flags;    //none, 2bytes
+	unsigned int sequence; //2bytes, 4bytes
+	unsigned int length;   //2bytes, 4bytes
+	unsigned int command;  //2bytes, 2bytes (+2bytes reserved)
 } Header;
 
 //Data structure of the whole Packet
 typedef struct _packet{
         Header *packet_header;
 	unsigned char *packet_data;
+	uint64_t data_offset; //with FLAG_OFFSET, position of the data part
+	unsigned int raw_length; //with FLAG_COMPRESSED, size of the data
+	                         //part once decompressed
+	uint32_t checksum; //with FLAG_CHECKSUM, CRC32C after the data part
 } Packet;
 
+//Data structure of a received packet interpreted in place, the data part
+//points into the read bytes, so nothing has to be allocated or freed
+typedef struct _packet_view{
+	Header packet_header;
+	const unsigned char *packet_data;
+	unsigned int data_length;
+	uint64_t data_offset; //with FLAG_OFFSET, position of the data part
+	unsigned int raw_length; //with FLAG_COMPRESSED, size of the data
+	                         //part once decompressed
+	uint32_t checksum; //with FLAG_CHECKSUM, CRC32C after the data part
+} PacketView;
+
+//Data structure of the parameters carried by the data part of hello
+//commands, each one as a tag, a length and a value
+typedef struct _hello_params{
+	unsigned char version; //highest version known by the sender
+
+	//Transfer shared by several connections, each one sending its own
+	//range of the file (0 if the connection sends the whole file alone)
+	uint64_t transferId;
+	unsigned int numStreams;
+
+	//Transfer resumed after a lost connection, from the position known
+	//by the server (0 in the client hello)
+	int resume;
+	uint64_t resumeOffset;
+
+	//File sent as a list of chunks first (deduplication)
+	int dedup;
+
+	//Algorithm of the compressed data parts (COMPRESSION_NONE if
+	//the data parts are sent as they are)
+	unsigned char compression;
+
+	//Algorithm of the checksums of the data parts and of the file
+	//(CHECKSUM_NONE if nothing is checked)
+	unsigned char checksum;
+} HelloParams;
+
+//Data structure of one chunk of a file in a chunk list, known by the
+//digest of its bytes
+typedef struct _chunk_entry{
+	unsigned char digest[DIGEST_SIZE];
+	unsigned int length;
+} ChunkEntry;
+
+/*
+ * Size of the header starting with the given version, 0 if the version
+ * is unknown
+ */
+unsigned int header_size(unsigned char version);
+
 
 /*
  * Initialization of a new packet data structure with data and 
  * a header based on sequence number and command number
  */
-Packet * init_packet(int sequence, int command, unsigned char *packetData, 
-		     int packetDataLength);
+Packet * init_packet(unsigned char version, unsigned int sequence, 
+		     int command, unsigned char *packetData, 
+		     unsigned int packetDataLength);
+
+/*
+ * Giving to the data part of a packet its position in the file,
+ * written before it (VERSION_EXTENDED only)
+ */
+int set_packet_offset(Packet *packet, uint64_t dataOffset);
+
+/*
+ * Replacing the data part of a packet by its compressed bytes, its size
+ * once decompressed is written before them (VERSION_EXTENDED only)
+ */
+int set_packet_compressed(Packet *packet, unsigned char *compressedData,
+			  unsigned int compressedLength);
+
+/*
+ * Giving to a packet the checksum written after its data part
+ * (VERSION_EXTENDED only)
+ */
+int set_packet_checksum(Packet *packet, uint32_t checksum);
+
+/*
+ * Size of the header and of what comes before the data part
+ */
+unsigned int prefix_size(const Header *header);
+
+/*
+ * Size of what comes after the data part
+ */
+unsigned int trailer_size(const Header *header);
 
 /*
- * Initialization of only a header data structure from the read bytes
+ * Initialization of only a header data structure from the read bytes,
+ * as many as the size of header of their version
  */
 Header * read_header(const unsigned char *readHeader);
 
+/*
+ * Interpretation of the read bytes into a header data structure given
+ * by the caller
+ */
+int parse_header(const unsigned char *readHeader, Header *header);
+
 /*
  * Free-ing header data structure
  */
@@ -57,6 +209,21 @@ void free_header(Header *headerToFree);
  */
 Packet * read_packet(unsigned char *readPacket, unsigned int packetLength);
 
+/*
+ * Interpretation of the beginning of a packet (header and position of the
+ * data part if any) into a packet view given by the caller, its data part
+ * is only the one among the read bytes
+ */
+int read_packet_prefix(const unsigned char *readPacket, 
+		       unsigned int numReadBytes, PacketView *view);
+
+/*
+ * Interpretation of the read bytes into a packet view given by the caller,
+ * its data part stays valid as long as the read bytes
+ */
+int read_packet_view(const unsigned char *readPacket, 
+		     unsigned int packetLength, PacketView *view);
+
 /*
  * Free-ing packet data structure including header
  */
@@ -68,7 +235,52 @@ void free_packet(Packet *packetToFree);
 void free_packet_for_read(Packet *packetToFree);
 
 /*
- * Converting a packet data structure to bytes in order to send them over socket
+ * Converting only a header data structure to its bytes (8 or 16), written 
+ * to a buffer given by the caller (stack), the size of header is returned
+ */
+unsigned int headerToBytes(const Header *ptrHeader, unsigned char *headerBytes);
+
+/*
+ * Converting a header and the position of the data part if any to 
+ * their bytes, written to a buffer given by the caller (stack), 
+ * their size is returned
+ */
+unsigned int prefixToBytes(const Packet *ptrPacket, unsigned char *prefixBytes);
+
+/*
+ * Converting what comes after the data part (checksum) to its bytes,
+ * written to a buffer given by the caller (stack), its size is returned
+ */
+unsigned int trailerToBytes(const Packet *ptrPacket, 
+			    unsigned char *trailerBytes);
+
+/*
+ * Converting hello parameters to the data part of a hello command,
+ * the number of bytes written is returned
+ */
+unsigned int helloToBytes(const HelloParams *params, unsigned char *helloBytes);
+
+/*
+ * Interpretation of the data part of a hello command, the parameters
+ * not given keep their default value and the unknown ones are skipped
+ */
+int read_hello(const unsigned char *helloBytes, unsigned int helloLength,
+	       HelloParams *params);
+
+/*
+ * Converting a chunk of a list to its bytes (digest then length), written
+ * to a buffer given by the caller
+ */
+void chunkEntryToBytes(const ChunkEntry *entry, unsigned char *entryBytes);
+
+/*
+ * Interpretation of the bytes of a chunk of a list
+ */
+void read_chunk_entry(const unsigned char *entryBytes, ChunkEntry *entry);
+
+/*
+ * Converting a packet data structure to bytes in order to send them over socket,
+ * the bytes are taken from the buffer pool and given back with buffer_free
  */
 unsigned char * packetToBytes(Packet *ptrPacket);
 
@@ -79,7 +291,7 @@ unsigned char * packetToBytes(Packet *ptrPacket);
  * 
  * Server goes back to initial state
  */
-Packet *send_error_packet(unsigned int seq_num, int **current_state, 
-			  int init_code);
+Packet *send_error_packet(unsigned char version, unsigned int seq_num, 
+			  int **current_state, int init_code);
 
 #endif
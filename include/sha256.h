@@ -0,0 +1,42 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIGEST_SIZE 32 //size of a SHA-256 digest
+#define SHA256_BLOCK_SIZE 64 //bytes hashed at once
+
+//Data structure of a SHA-256 computation in progress
+typedef struct _sha256_context{
+	uint32_t state[8];
+	uint64_t numBytes; //bytes hashed so far
+	unsigned char block[SHA256_BLOCK_SIZE];
+	unsigned int blockLength;
+} Sha256Context;
+
+/*
+ * Initialization of a new SHA-256 computation
+ */
+void sha256_init(Sha256Context *context);
+
+/*
+ * Adding some bytes to a SHA-256 computation
+ */
+void sha256_update(Sha256Context *context, const unsigned char *data,
+		   size_t length);
+
+/*
+ * Finishing a SHA-256 computation, its digest is written to a buffer
+ * given by the caller
+ */
+void sha256_final(Sha256Context *context, unsigned char *digest);
+
+/*
+ * Computing at once the SHA-256 digest of some bytes
+ */
+void sha256(const unsigned char *data, size_t length, unsigned char *digest);
+
+#endif
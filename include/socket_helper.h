@@ -7,21 +7,100 @@
 #include <string.h>
 
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 
 #include "packet_handler.h"
+#include "buffer_pool.h"
 #include "csapp.h"
 
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "12345"
+
+//Where a socket is bound or connected, and how it is tuned
+typedef struct _socket_options{
+	const char *host; //name or address (IPv4 or IPv6), "*" for all
+	const char *port; //number or name of the service
+	int backlog; //connection requests queued before being accepted
+
+	//Sizes of the kernel buffers in bytes, 0 to keep the default ones
+	int receiveBuffer;
+	int sendBuffer;
+
+	int noDelay; //small segments sent at once (TCP_NODELAY)
+	int quickAck; //segments acknowledged at once (TCP_QUICKACK)
+} SocketOptions;
+
+/*
+ * Filling the socket options with their values by default: localhost:12345,
+ * a long queue of connection requests and the settings of the kernel
+ */
+void init_socket_options(SocketOptions *options);
+
+/*
+ * Applying the socket options to a socket, the sizes of its buffers
+ * and when its segments are sent and acknowledged
+ *
+ * The buffers must be sized before the connection is established
+ * (before listen() or connect()) for the window to be scaled accordingly
+ */
+int set_socket_options(int socket_fd, const SocketOptions *options);
+
+/*
+ * Creating a socket, binding it to the address and port of the socket
+ * options and preparing it
+ *
+ * With reusePort, several sockets can be bound to the same port and
+ * the kernel spreads the incoming connections among them
+ */
+int server_listening(const SocketOptions *options, int reusePort);
+
+/*
+ * Creating a socket, and connecting it to the address and port of
+ * the socket options
+ */
+int client_connecting(const SocketOptions *options);
+
+/*
+ * Switching a socket to non-blocking mode
+ */
+int set_nonblocking(int socket_fd);
+
+/*
+ * Sending a whole packet (blocking), the header is converted on the stack
+ * and sent with the data part in place (scatter-gather)
+ */
+void send_packet(int output_fd, Packet *packetToSend);
+
+/*
+ * Sending a whole packet (blocking), the header is sent first and held back
+ * by the kernel, then the data part is sent by the kernel straight from 
+ * a file (zero-copy) at the given position
+ */
+void send_packet_from_file(int output_fd, Packet *packetToSend, int input_fd,
+			   off_t dataOffset);
+
+/*
+ * Holding back (or releasing) the bytes sent over a socket until they
+ * fill whole segments
+ */
+int set_cork(int socket_fd, int enabled);
+
 /*
- * Creating a socket, binding it to localhost:12345 and preparing it
+ * Sending at once the small segments written to a socket, without waiting
+ * for the previous ones to be acknowledged (Nagle's algorithm disabled)
  */
-int server_listening(void);
+int set_nodelay(int socket_fd);
 
 /*
- * Creating a socket, and connecting it to localhost:12345
+ * Acknowledging at once the segments received on a socket, the kernel
+ * may fall back to delayed acknowledgements so it is asked again
+ * after each read
  */
-int client_connecting(void);
+int set_quickack(int socket_fd);
 
 /*
  * Reading bytes from a file descriptor (server-side or client-side) 
@@ -0,0 +1,251 @@
+#ifndef __STORAGE_H__
+#define __STORAGE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "packet_handler.h"
+#include "crc32c.h"
+#include "io_ring.h"
+#include "write_queue.h"
+
+#define DEFAULT_WINDOW_SIZE 1048576 //bytes kept in memory per upload (1MiB)
+#define MAX_NAME_SIZE 4096 //maximum length of a file name
+#define MAX_UPLOAD_NAME_SIZE 255 //maximum length of the name given by a client
+#define DEFAULT_UPLOAD_NAME "server.out" //name of an upload not named
+#define STORAGE_BLOCK_SIZE 4096 //windows are written in whole disk blocks
+#define MIN_PREALLOCATE_SIZE 4194304 //space reserved at once ahead of
+                                     //the writes, doubled each time (4MiB)
+#define MAX_PREALLOCATE_SIZE 67108864 //most space reserved at once (64MiB)
+
+#define DURABILITY_NONE 0 //stored files reach the disk when the kernel wants
+#define DURABILITY_FDATASYNC 1 //each file is synced before taking its name
+#define DURABILITY_DSYNC 2 //each write reaches the disk before returning
+                           //(O_DSYNC)
+#define DURABILITY_GROUP 3 //files synced by batches in the background, the
+                           //others (transfers, chunks) as with FDATASYNC
+#define CHECKPOINT_INTERVAL 67108864 //bytes of a resumable upload written
+                                     //between two checkpoints (64MiB)
+#define RESUME_MAX_AGE 604800 //seconds a resumable upload left untouched is
+                             //kept (7 days)
+#define RESUME_SWEEP_INTERVAL 3600 //seconds between two looks for the
+                                   //resumable uploads to remove
+#define VERIFY_BLOCK_SIZE 1048576 //bytes read back at once to check a file
+
+//Data structure of the record of a resumable upload, rewritten at each
+//checkpoint with the CRC32C of the bytes before it when it is known, so
+//that a resumed upload is not read back to be checked
+typedef struct _upload_record{
+	uint64_t checkpoint;
+	uint32_t checksum;
+	uint32_t checked; //1 if the checksum is the one of the checkpoint
+} UploadRecord;
+
+//Data structure of an upload being stored, the received data is
+//appended to a temporary file which takes the final name once stored
+typedef struct _upload{
+	int fd;
+	char tempName[MAX_NAME_SIZE];
+
+	//Bytes received but not written to the file yet
+	unsigned char *window;
+	unsigned int windowLength;
+	unsigned int windowSize;
+
+	//Position in the file of the first byte of the window
+	off_t offset;
+
+	//A resumable upload keeps its file when the connection is lost,
+	//with the position up to which it is surely written (checkpoint)
+	int resumable;
+	int recordFd; //-1 until the first checkpoint
+	char recordName[MAX_NAME_SIZE];
+	off_t checkpointOffset;
+
+	//CRC32C of the first bytes of the file, put together from the
+	//checksums of the data appended in order, so that most files don't
+	//have to be read back to be checked
+	uint32_t checksum;
+	off_t checksumLength;
+
+	//Space reserved on the disk ahead of the appended bytes, so that
+	//the file stays in few extents, given back past the end once stored
+	off_t allocatedLength;
+	int preallocate; //0 once the file system refused
+
+	//Windows written through a ring (NULL if written at once): a full
+	//window is written by the kernel while the spare one is filled,
+	//what is left of it to write is kept until its completion
+	IoRing *ring;
+	IoRingRequest writeRequest;
+	unsigned char *spareWindow;
+	const unsigned char *writeBytes;
+	unsigned int writeLength;
+	off_t writeOffset;
+	unsigned int numPendingWrites;
+	int writeFailed;
+
+	//Windows handed to the I/O threads instead (NULL if not), each
+	//one with its bytes, a new window being filled meanwhile
+	WriteTracker *tracker;
+} Upload;
+
+/*
+ * Choosing how surely the stored files are on the disk, once at startup
+ */
+void set_durability(int mode);
+
+/*
+ * Syncing the directory holding the given file, so that its name is on
+ * the disk too
+ *
+ * Returns ERR if the directory can't be synced
+ */
+int sync_directory(const char *fileName);
+
+/*
+ * Whether the name given by a client to its upload is a plain file name,
+ * which stays in the storage directory
+ */
+int valid_upload_name(const unsigned char *name, unsigned int length);
+
+/*
+ * Initialization of a new upload with a temporary file created next
+ * to the file it will become
+ */
+Upload * init_upload(const char *targetName, unsigned int windowSize);
+
+/*
+ * Resuming the upload kept in the given file, or starting it if there is
+ * none, from the position of its last checkpoint
+ *
+ * Returns NULL if the file can't be opened or is used by another connection
+ */
+Upload * resume_upload(const char *partName, unsigned int windowSize);
+
+/*
+ * Removing the resumable uploads of the given directory (files whose name
+ * starts with the given prefix) left untouched for RESUME_MAX_AGE, at most
+ * once every RESUME_SWEEP_INTERVAL
+ */
+void expire_resumable_uploads(const char *directory, const char *prefix);
+
+/*
+ * Writing the windows of the upload through a ring from now on, without
+ * waiting for them
+ */
+void upload_use_ring(Upload *upload, IoRing *ring);
+
+/*
+ * Handing the windows of the upload to the I/O threads from now on,
+ * without waiting for them, the waiter is told when the upload can take
+ * more data again
+ */
+void upload_use_io_threads(Upload *upload, WriteWaiter *waiter);
+
+/*
+ * Whether the upload should be given no more data for now, its windows
+ * not being written as fast as they come
+ */
+int upload_writes_stalled(Upload *upload);
+
+/*
+ * Appending received data to the upload, the window is written to the file
+ * each time it is full so the memory used stays bounded
+ */
+int upload_append(Upload *upload, const unsigned char *data,
+		  unsigned int dataLength);
+
+/*
+ * Writing received data at a given position of the upload, straight to
+ * the file without the window (ranges received in any order)
+ */
+int upload_write_at(Upload *upload, const unsigned char *data,
+		    unsigned int dataLength, off_t offset);
+
+/*
+ * Appending the first bytes of another file to the upload, copied by
+ * the kernel from file to file when possible
+ */
+int upload_append_file(Upload *upload, int input_fd, unsigned int length);
+
+/*
+ * Moving received data straight from a socket to the upload through a pipe,
+ * without copying them in memory (splice), at most maxBytes at once
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone or the file can't be written
+ */
+int upload_splice(Upload *upload, int socket_fd, int *pipe_fds,
+		  unsigned int maxBytes);
+
+/*
+ * Same as upload_splice, but at a given position of the file, moved
+ * forward by the number of bytes written (the window is not used)
+ */
+int upload_splice_at(Upload *upload, int socket_fd, int *pipe_fds,
+		     unsigned int maxBytes, off_t *offset);
+
+/*
+ * Adding to the checksum of the file the CRC32C of data appended at the
+ * given position, only if it follows the bytes already checked
+ */
+void upload_add_checksum(Upload *upload, off_t offset, uint32_t checksum,
+			 unsigned int dataLength);
+
+/*
+ * Checking the whole file of the upload against its CRC32C, put together
+ * as its bytes were appended (before a suspension included), it is read
+ * back only if some of them came without a checksum
+ *
+ * Returns ERR if the file is not the one expected
+ */
+int upload_verify(Upload *upload, uint32_t expectedChecksum);
+
+/*
+ * Writing what is left in the window and giving atomically the final name
+ * to the file, synced first as chosen at startup, the upload is free-ed
+ */
+int upload_commit(Upload *upload, const char *targetName);
+
+/*
+ * Writing what is left in the window and waiting for all the writes of the
+ * file, which can then be synced from any thread, the upload is given up
+ * if it can't be written
+ */
+int upload_finish(Upload *upload);
+
+/*
+ * Giving atomically the final name to a finished file, the upload is free-ed
+ * (given up if the name can't be given)
+ */
+int upload_rename(Upload *upload, const char *targetName);
+
+/*
+ * Writing the received data surely to the disk, then the position up to
+ * which they are written, for a resumable upload
+ */
+int upload_checkpoint(Upload *upload);
+
+/*
+ * Giving up an upload, the temporary file is removed and the upload is free-ed
+ */
+void upload_abort(Upload *upload);
+
+/*
+ * Leaving a resumable upload for a next connection, its file is kept
+ * up to its last checkpoint and the upload is free-ed
+ */
+void upload_suspend(Upload *upload);
+
+/*
+ * Leaving an upload when its connection fails, a resumable upload is
+ * suspended and any other one is given up
+ */
+void upload_release(Upload *upload);
+
+#endif
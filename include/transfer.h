@@ -0,0 +1,62 @@
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet_handler.h"
+#include "storage.h"
+
+#define MAX_STREAMS 64 //maximum number of connections sharing a transfer
+#define TRANSFER_MAX_WAIT 60 //seconds a transfer left by all its connections
+                             //waits for its other ones
+
+//Data structure of an upload shared by several connections, each one
+//writing its own ranges of the file at their position, kept in a registry
+//shared by all the event loops
+typedef struct _transfer{
+	uint64_t transferId;
+	Upload *upload;
+
+	unsigned int numStreams;  //connections expected
+	unsigned int numAttached; //connections using the transfer now
+	unsigned int numStored;   //connections whose ranges are all written
+	int failed;               //a connection left before its store
+	int committed;            //the file left the transfer to take its
+	                          //final name (or to be given up)
+	time_t leftTime;          //when its last connection left it
+
+	struct _transfer *next;
+} Transfer;
+
+/*
+ * Joining the transfer of the given ID, which is created by its first
+ * connection, next to the file it will become
+ *
+ * Returns NULL if the transfer already failed, is already complete or
+ * doesn't expect the same number of connections
+ */
+Transfer * attach_transfer(uint64_t transferId, unsigned int numStreams,
+			   const char *targetName);
+
+/*
+ * Telling that a connection has written all its ranges, the last one of
+ * the transfer is given the file to store, after checking it against its
+ * CRC32C if given (NULL for the other ones)
+ *
+ * Returns ERR if the transfer failed or the file is not the one sent
+ */
+int transfer_store(Transfer *transfer, const uint32_t *fileChecksum,
+		   Upload **upload);
+
+/*
+ * Leaving the transfer when the connection is closed, a transfer given
+ * up by one of its connections is removed with its temporary file, as
+ * well as the ones whose other connections never came
+ */
+void detach_transfer(Transfer *transfer, int stored);
+
+#endif
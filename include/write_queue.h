@@ -0,0 +1,178 @@
+#ifndef __WRITE_QUEUE_H__
+#define __WRITE_QUEUE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "csapp.h"
+#include "packet_handler.h"
+
+#define WRITE_QUEUE_SIZE 1024 //writes waiting in each queue (a power of two)
+#define MAX_IO_THREADS 64 //maximum number of threads writing the files
+#define MAX_PENDING_WRITES 4 //writes of one file handed at the same time
+#define MAX_WRITE_WAITERS 256 //event loops told when the writes catch up
+#define CACHE_LINE_SIZE 64 //bytes of a cache line, shared by no two counters
+
+//Data structure of an event loop told by the I/O threads that writes of
+//its uploads are done (its event file is readable then), so that its
+//connections which stopped reading can go on
+typedef struct _write_waiter{
+	int eventFd;
+} WriteWaiter;
+
+//Data structure of one write handed to an I/O thread, its bytes are a
+//window given back to the tracker once written
+typedef struct _write_request{
+	int fd;
+	off_t offset;
+	unsigned char *bytes;
+	unsigned int length;
+	struct _write_tracker *tracker;
+
+	struct _write_request *next; //held by the network thread
+} WriteRequest;
+
+//Data structure following the writes of one file handed to the I/O
+//threads: at most MAX_PENDING_WRITES of them at once, the next ones are
+//held by the network thread meanwhile (without waiting), whose connection
+//stops reading until the waiter is told there is room again
+typedef struct _write_tracker{
+	WriteWaiter *waiter;
+	int failed; //one of the writes couldn't be done
+	int stalled; //the waiter is told at the next write done
+
+	//Writes handed by the network thread, done by the I/O thread, and
+	//done ones waited for by the network thread (one post of the
+	//semaphore for each, the last thing the I/O thread does with the
+	//tracker)
+	unsigned int numHanded;
+	unsigned int numDone;
+	unsigned int numWaited;
+	sem_t done;
+
+	//Writes not handed yet, in order
+	WriteRequest *firstHeld;
+	WriteRequest *lastHeld;
+
+	//Windows written, given back by the I/O thread (stack linked by
+	//their first bytes) then taken by the network thread for the next
+	//writes
+	unsigned char *doneWindows;
+	unsigned char *freeWindows;
+} WriteTracker;
+
+//Data structure of one place of a queue, its sequence number tells
+//whether it is free for the producer of the given position or holds
+//a write for the consumer
+typedef struct _write_slot{
+	uint64_t sequence;
+	WriteRequest request;
+} WriteSlot;
+
+//Data structure of a bounded queue with many producers (the network
+//threads) and one consumer (its I/O thread), without lock: a producer
+//takes a position by moving the tail forward, then publishes its write
+//in the slot of this position
+typedef struct _write_queue{
+	uint64_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+	sem_t numWrites; //writes published, the I/O thread sleeps on it
+	int stalled; //the waiters are told once a place is free again
+
+	//Counters read by anyone, written without lock
+	uint64_t maxDepth __attribute__((aligned(CACHE_LINE_SIZE)));
+	uint64_t numFull; //times a producer found the queue full
+	uint64_t numWrittenBytes;
+
+	WriteSlot slots[WRITE_QUEUE_SIZE];
+	pthread_t thread;
+} WriteQueue;
+
+//Data structure of the depth metrics of a queue at a given time
+typedef struct _write_queue_stats{
+	uint64_t depth; //writes waiting in the queue
+	uint64_t maxDepth; //highest depth seen
+	uint64_t numQueued; //writes queued since the start
+	uint64_t numFull;
+	uint64_t numWrittenBytes;
+} WriteQueueStats;
+
+/*
+ * Starting the I/O threads, each one with its own queue, they run until
+ * the process ends
+ *
+ * Returns ERR if the number of threads is not valid
+ */
+int start_io_threads(unsigned int numThreads);
+
+/*
+ * Number of I/O threads started, 0 if the files are written by the network
+ * threads themselves
+ */
+unsigned int num_io_threads(void);
+
+/*
+ * Initialization of the waiter of an event loop, with its event file
+ *
+ * Returns NULL if the event file can't be created or too many event loops
+ * have one
+ */
+WriteWaiter * init_write_waiter(void);
+
+/*
+ * Emptying the event file of a waiter, before looking for the connections
+ * which can go on
+ */
+void take_write_notice(WriteWaiter *waiter);
+
+/*
+ * Initialization of the tracker of the writes of a new file, written by
+ * the network thread of the given waiter
+ */
+void init_write_tracker(WriteTracker *tracker, WriteWaiter *waiter);
+
+/*
+ * Free-ing the windows kept by a tracker, once all its writes are done
+ */
+void free_write_tracker(WriteTracker *tracker);
+
+/*
+ * Giving a window for the next bytes of the file, one written before if
+ * the I/O thread gave it back already
+ */
+unsigned char * tracker_window(WriteTracker *tracker, unsigned int size);
+
+/*
+ * Handing a window to write to the I/O threads, it is the tracker's from
+ * now on, without waiting: it is held if the file or the queue has no room
+ *
+ * Returns ERR if a previous write of the file couldn't be done
+ */
+int queue_write(WriteTracker *tracker, int fd, unsigned char *bytes,
+		unsigned int length, off_t offset);
+
+/*
+ * Whether the network thread should stop reading for the file, its held
+ * writes are handed first if there is room, the waiter is told once
+ * there may be room again
+ */
+int writes_stalled(WriteTracker *tracker);
+
+/*
+ * Waiting until all the writes of a file, held ones included, are done,
+ * before the file is read, synced or closed
+ *
+ * Returns ERR if one of them couldn't be done
+ */
+int wait_writes(WriteTracker *tracker);
+
+/*
+ * Depth metrics of the queue of the given I/O thread
+ */
+void write_queue_stats(unsigned int index, WriteQueueStats *stats);
+
+#endif
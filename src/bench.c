@@ -0,0 +1,591 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+
+#include "packet_handler.h"
+#include "socket_helper.h"
+#include "crc32c.h"
+#include "histogram.h"
+
+#define DEFAULT_CONNECTIONS 1
+#define DEFAULT_UPLOADS 10 //uploads run one after the other by a connection
+#define DEFAULT_FILE_SIZE 1048576 //synthetic file of each upload (1MiB)
+#define DEFAULT_CHUNK_SIZE 65536 //data part of each data delivery (64KiB)
+#define DEFAULT_WINDOW 8 //data deliveries sent but not acknowledged yet
+#define MAX_CONNECTIONS 1024 //maximum number of connections at the same time
+
+#define PHASE_CONNECT 0 //from socket() to the established connection
+#define PHASE_HELLO 1 //from the client hello to the server hello
+#define PHASE_DELIVERY 2 //from a data delivery to its acknowledgement
+#define PHASE_STORE 3 //from the data store to its acknowledgement
+#define PHASE_UPLOAD 4 //from socket() to the acknowledged store
+#define NUM_PHASES 5
+
+static const char *phaseNames[NUM_PHASES] = {
+	"connect", "hello", "delivery", "store", "upload"
+};
+
+//Data structure of the uploads run by every connection, all of them
+//sending the same synthetic data part again and again
+typedef struct _bench_config{
+	const SocketOptions *socketOptions;
+	unsigned int numUploads;
+	size_t fileSize;
+	unsigned int chunkSize;
+	unsigned int window;
+	int helloOnly; //connection closed after the server hello
+
+	//Data part of the deliveries, and its CRC32C (whole, and as
+	//the shorter last one) if the server checks them
+	unsigned char *payload;
+	int checksum;
+	uint32_t payloadChecksum;
+	uint32_t lastChecksum;
+	uint32_t fileChecksum;
+} BenchConfig;
+
+//Data structure of one connection of the benchmark, run by its own thread
+//with its own latencies merged at the end
+typedef struct _bench_worker{
+	pthread_t thread;
+	const BenchConfig *config;
+	unsigned int seed; //first sequence numbers
+
+	//Time each data delivery not acknowledged yet was sent, by
+	//sequence number modulo the window + 1
+	uint64_t *sentTimes;
+
+	Histogram phases[NUM_PHASES];
+	unsigned int numUploads; //uploads stored
+	unsigned int numFailures;
+	size_t numBytes; //bytes of the uploads stored
+} BenchWorker;
+
+/*
+ * Entry point of the thread of one connection, running its uploads
+ * one after the other
+ */
+void *bench_thread(void *args);
+
+/*
+ * Running one upload over a new connection, from the connection to the
+ * acknowledged store, and timing each phase
+ *
+ * Returns ERR if the upload failed, OK otherwise
+ */
+int run_upload(BenchWorker *worker);
+
+/*
+ * Reading the acknowledgements of the server until no more than
+ * maxOutstanding data deliveries are not acknowledged, each one gives
+ * its latency
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int wait_deliveries(BenchWorker *worker, int client_fd, unsigned int sequence,
+		    unsigned int *ackedSequence, unsigned int maxOutstanding);
+
+/*
+ * Printing the latencies of each phase as a table, and the throughput
+ */
+void print_report(FILE *output, const Histogram *phases,
+		  unsigned int numConnections, unsigned int numUploads,
+		  unsigned int numFailures, size_t numBytes, double elapsed);
+
+/*
+ * Writing the latencies of each phase and the throughput as JSON
+ */
+void write_json_report(FILE *output, const Histogram *phases,
+		       const BenchConfig *config, unsigned int numConnections,
+		       unsigned int numUploads, unsigned int numFailures,
+		       size_t numBytes, double elapsed);
+
+/*
+ * Current time of the monotonic clock in nanoseconds
+ */
+uint64_t now_nanoseconds(void);
+
+int main(int argc, char **argv)
+{
+	int numConnections = DEFAULT_CONNECTIONS;
+	int numUploads = DEFAULT_UPLOADS;
+	long long fileSize = DEFAULT_FILE_SIZE;
+	int chunkSize = DEFAULT_CHUNK_SIZE;
+	int window = DEFAULT_WINDOW;
+	int helloOnly = 0;
+	int integrity = 0;
+	const char *jsonPath = NULL;
+	SocketOptions socketOptions;
+	int option;
+
+	init_socket_options(&socketOptions);
+	while((option = getopt(argc, argv, "a:c:C:f:HiJ:k:nP:qR:S:u:")) != -1){
+		switch (option) {
+		case 'a':
+			socketOptions.host = optarg;
+			break;
+		case 'c':
+			chunkSize = atoi(optarg);
+			break;
+		case 'C':
+			numConnections = atoi(optarg);
+			break;
+		case 'f':
+			fileSize = atoll(optarg);
+			break;
+		case 'H':
+			helloOnly = 1;
+			break;
+		case 'i':
+			integrity = 1;
+			break;
+		case 'J':
+			jsonPath = optarg;
+			break;
+		case 'k':
+			window = atoi(optarg);
+			break;
+		case 'n':
+			socketOptions.noDelay = 1;
+			break;
+		case 'P':
+			socketOptions.port = optarg;
+			break;
+		case 'q':
+			socketOptions.quickAck = 1;
+			break;
+		case 'R':
+			socketOptions.receiveBuffer = atoi(optarg);
+			break;
+		case 'S':
+			socketOptions.sendBuffer = atoi(optarg);
+			break;
+		case 'u':
+			numUploads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "#Usage: %s [-a address] [-c chunk_size] \
+[-C connections] [-f file_size] [-H] [-i] [-J json_file] [-k window] [-n] \
+[-P port] [-q] [-R receive_buffer_size] [-S send_buffer_size] \
+[-u uploads_per_connection]\n", argv[0]);
+			return ERR;
+		}
+	}
+	if(numConnections < 1 || numConnections > MAX_CONNECTIONS){
+		fprintf(stderr, "#Error: number of connections must be between \
+1 and %d\n", MAX_CONNECTIONS);
+		return ERR;
+	}
+	if(numUploads < 1){
+		fprintf(stderr, "#Error: number of uploads must be positive\n");
+		return ERR;
+	}
+	if(fileSize < 0){
+		fprintf(stderr, "#Error: file size can't be negative\n");
+		return ERR;
+	}
+	if(chunkSize < 1 || chunkSize > MAX_DATA_SIZE_EXTENDED){
+		fprintf(stderr, "#Error: chunk size must be between 1 and \
+%d\n", MAX_DATA_SIZE_EXTENDED);
+		return ERR;
+	}
+	if(window < 1){
+		fprintf(stderr, "#Error: window must be positive\n");
+		return ERR;
+	}
+	if(socketOptions.receiveBuffer < 0 || socketOptions.sendBuffer < 0){
+		fprintf(stderr, "#Error: socket buffer sizes can't be \
+negative\n");
+		return ERR;
+	}
+
+	//A server closing the connection must not kill the benchmark
+	signal(SIGPIPE, SIG_IGN);
+
+	//The same random data part is sent by every delivery, so only
+	//the server and the network are measured
+	BenchConfig config;
+	config.socketOptions = &socketOptions;
+	config.numUploads = (unsigned int)(numUploads);
+	config.fileSize = (size_t)(fileSize);
+	config.chunkSize = (unsigned int)(chunkSize);
+	config.window = (unsigned int)(window);
+	config.helloOnly = helloOnly;
+	config.payload = malloc(config.chunkSize);
+	if(config.payload == NULL){
+		fprintf(stderr, "#Error: no memory for the data part\n");
+		return ERR;
+	}
+	srand(time(NULL));
+	unsigned int i;
+	for(i=0; i<config.chunkSize; i++){
+		config.payload[i] = (unsigned char)(rand());
+	}
+
+	//The checksum of the file is put together from the ones of
+	//its deliveries, without reading it
+	config.checksum = integrity;
+	config.payloadChecksum = crc32c(0, config.payload, config.chunkSize);
+	unsigned int lastLength = config.fileSize % config.chunkSize;
+	config.lastChecksum = crc32c(0, config.payload, lastLength);
+	config.fileChecksum = 0;
+	size_t numFullDeliveries = config.fileSize / config.chunkSize;
+	size_t j;
+	for(j=0; j<numFullDeliveries; j++){
+		config.fileChecksum = crc32c_combine(config.fileChecksum,
+						     config.payloadChecksum,
+						     config.chunkSize);
+	}
+	config.fileChecksum = crc32c_combine(config.fileChecksum,
+					     config.lastChecksum, lastLength);
+
+	BenchWorker *workers = calloc(numConnections, sizeof(BenchWorker));
+	if(workers == NULL){
+		fprintf(stderr, "#Error: no memory for the connections\n");
+		return ERR;
+	}
+
+	uint64_t startTime = now_nanoseconds();
+	for(i=0; i<(unsigned int)(numConnections); i++){
+		BenchWorker *worker = &(workers[i]);
+		worker->config = &config;
+		worker->seed = (unsigned int)(rand());
+		worker->sentTimes = calloc(config.window + 1,
+					   sizeof(uint64_t));
+		int phase;
+		for(phase=0; phase<NUM_PHASES; phase++){
+			init_histogram(&(worker->phases[phase]));
+		}
+		Pthread_create(&(worker->thread), NULL, bench_thread, worker);
+	}
+
+	//The latencies of all the connections are merged once they are done
+	Histogram phases[NUM_PHASES];
+	int phase;
+	for(phase=0; phase<NUM_PHASES; phase++){
+		init_histogram(&(phases[phase]));
+	}
+	unsigned int numStored = 0;
+	unsigned int numFailures = 0;
+	size_t numBytes = 0;
+	for(i=0; i<(unsigned int)(numConnections); i++){
+		BenchWorker *worker = &(workers[i]);
+		Pthread_join(worker->thread, NULL);
+		for(phase=0; phase<NUM_PHASES; phase++){
+			histogram_add(&(phases[phase]),
+				      &(worker->phases[phase]));
+		}
+		numStored += worker->numUploads;
+		numFailures += worker->numFailures;
+		numBytes += worker->numBytes;
+		free(worker->sentTimes);
+	}
+	double elapsed = (now_nanoseconds() - startTime) / 1e9;
+
+	print_report(stdout, phases, numConnections, numStored, numFailures,
+		     numBytes, elapsed);
+	if(jsonPath != NULL){
+		FILE *jsonFile = fopen(jsonPath, "w");
+		if(jsonFile == NULL){
+			fprintf(stderr, "#Error: can't write %s\n", jsonPath);
+		}else{
+			write_json_report(jsonFile, phases, &config,
+					  numConnections, numStored,
+					  numFailures, numBytes, elapsed);
+			fclose(jsonFile);
+		}
+	}
+
+	free(workers);
+	free(config.payload);
+	return (numFailures > 0) ? ERR : OK;
+}
+
+/*
+ * Entry point of the thread of one connection, running its uploads
+ * one after the other
+ */
+void *bench_thread(void *args)
+{
+	BenchWorker *worker = args;
+	unsigned int i;
+	for(i=0; i<worker->config->numUploads; i++){
+		if(run_upload(worker) == ERR){
+			worker->numFailures++;
+			continue;
+		}
+		worker->numUploads++;
+		if(!worker->config->helloOnly){
+			worker->numBytes += worker->config->fileSize;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Running one upload over a new connection, from the connection to the
+ * acknowledged store, and timing each phase
+ *
+ * Returns ERR if the upload failed, OK otherwise
+ */
+int run_upload(BenchWorker *worker)
+{
+	const BenchConfig *config = worker->config;
+	Histogram *phases = worker->phases;
+
+	//CONNECTION
+	uint64_t startTime = now_nanoseconds();
+	int client_fd = client_connecting(config->socketOptions);
+	if(client_fd == ERR){
+		return ERR;
+	}
+	uint64_t helloTime = now_nanoseconds();
+	histogram_record(&(phases[PHASE_CONNECT]), helloTime - startTime);
+
+	//CLIENT HELLO, only version 0x05 acknowledges what it receives
+	unsigned int sequence = rand_r(&(worker->seed))%(65535/2);
+	HelloParams hello;
+	memset(&hello, 0, sizeof(HelloParams));
+	hello.version = VERSION_EXTENDED;
+	hello.compression = COMPRESSION_NONE;
+	hello.checksum = config->checksum ? CHECKSUM_CRC32C : CHECKSUM_NONE;
+	unsigned char helloBytes[MAX_HELLO_SIZE];
+	unsigned int helloLength = helloToBytes(&hello, helloBytes);
+	Packet *packetToSend = init_packet(VERSION, ++sequence, CLIENT_HELLO,
+					   helloBytes, helloLength);
+	send_packet(client_fd, packetToSend);
+	free_packet(packetToSend);
+
+	//SERVER HELLO
+	Packet *readPacket;
+	if(read_check_packet(client_fd, &readPacket) == ERR){
+		close(client_fd);
+		return ERR;
+	}
+	Header *readHeader = readPacket->packet_header;
+	HelloParams agreed;
+	int status = OK;
+	if(readHeader->command != SERVER_HELLO ||
+	   read_hello(readPacket->packet_data, readHeader->length -
+		      header_size(readHeader->version), &agreed) == ERR ||
+	   agreed.version != VERSION_EXTENDED ||
+	   agreed.checksum != hello.checksum){
+		fprintf(stderr, "SERVER DOESN'T AGREE ON THE HELLO\n");
+		status = ERR;
+	}
+	free_packet_for_read(readPacket);
+	if(status == ERR){
+		close(client_fd);
+		return ERR;
+	}
+	uint64_t deliveryTime = now_nanoseconds();
+	histogram_record(&(phases[PHASE_HELLO]), deliveryTime - helloTime);
+
+	//Only the handshake is measured
+	if(config->helloOnly){
+		close(client_fd);
+		histogram_record(&(phases[PHASE_UPLOAD]),
+				 deliveryTime - startTime);
+		return OK;
+	}
+
+	//DATA DELIVERY, no more than a window of packets is not
+	//acknowledged, then all of them before the store (an empty file
+	//is sent as one empty delivery)
+	unsigned int ackedSequence = sequence;
+	size_t offset = 0;
+	do{
+		unsigned int length = config->chunkSize;
+		uint32_t checksum = config->payloadChecksum;
+		if(config->fileSize - offset < length){
+			length = (unsigned int)(config->fileSize - offset);
+			checksum = config->lastChecksum;
+		}
+
+		packetToSend = init_packet(VERSION_EXTENDED, ++sequence,
+					   DATA_DELIVERY, config->payload,
+					   length);
+		if(config->checksum){
+			set_packet_checksum(packetToSend, checksum);
+		}
+		worker->sentTimes[sequence % (config->window + 1)] =
+			now_nanoseconds();
+		send_packet(client_fd, packetToSend);
+		free_packet(packetToSend);
+		offset += length;
+
+		status = wait_deliveries(worker, client_fd, sequence,
+					 &ackedSequence, config->window);
+	}while(offset < config->fileSize && status == OK);
+	if(status == OK){
+		status = wait_deliveries(worker, client_fd, sequence,
+					 &ackedSequence, 0);
+	}
+	if(status == ERR){
+		close(client_fd);
+		return ERR;
+	}
+
+	//DATA STORE, acknowledged once the file is stored
+	uint64_t storeTime = now_nanoseconds();
+	packetToSend = init_packet(VERSION_EXTENDED, ++sequence, DATA_STORE,
+				   NULL, 0);
+	if(config->checksum){
+		set_packet_checksum(packetToSend, config->fileChecksum);
+	}
+	send_packet(client_fd, packetToSend);
+	free_packet(packetToSend);
+
+	if(read_check_packet(client_fd, &readPacket) == ERR){
+		close(client_fd);
+		return ERR;
+	}
+	if(readPacket->packet_header->command != ACK ||
+	   readPacket->packet_header->sequence != sequence){
+		fprintf(stderr, "ERROR PACKET RECEIVED\n");
+		status = ERR;
+	}
+	free_packet_for_read(readPacket);
+	close(client_fd);
+	if(status == ERR){
+		return ERR;
+	}
+
+	uint64_t endTime = now_nanoseconds();
+	histogram_record(&(phases[PHASE_STORE]), endTime - storeTime);
+	histogram_record(&(phases[PHASE_UPLOAD]), endTime - startTime);
+	return OK;
+}
+
+/*
+ * Reading the acknowledgements of the server until no more than
+ * maxOutstanding data deliveries are not acknowledged, each one gives
+ * its latency
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int wait_deliveries(BenchWorker *worker, int client_fd, unsigned int sequence,
+		    unsigned int *ackedSequence, unsigned int maxOutstanding)
+{
+	unsigned int ringSize = worker->config->window + 1;
+
+	Packet *readPacket;
+	while(sequence - *ackedSequence > maxOutstanding){
+		if(read_check_packet(client_fd, &readPacket) == ERR){
+			return ERR;
+		}
+
+		int command = readPacket->packet_header->command;
+		unsigned int acked = readPacket->packet_header->sequence;
+		free_packet_for_read(readPacket);
+
+		//The acknowledgement covers all the deliveries up to its
+		//sequence number, which must have been sent
+		if(command != ACK || acked - *ackedSequence >
+		   sequence - *ackedSequence){
+			fprintf(stderr, "ERROR PACKET RECEIVED\n");
+			return ERR;
+		}
+		uint64_t ackTime = now_nanoseconds();
+		while(*ackedSequence != acked){
+			*ackedSequence += 1;
+			histogram_record(&(worker->phases[PHASE_DELIVERY]),
+				ackTime -
+				worker->sentTimes[*ackedSequence % ringSize]);
+		}
+	}
+
+	return OK;
+}
+
+/*
+ * Printing the latencies of each phase as a table, and the throughput
+ */
+void print_report(FILE *output, const Histogram *phases,
+		  unsigned int numConnections, unsigned int numUploads,
+		  unsigned int numFailures, size_t numBytes, double elapsed)
+{
+	fprintf(output, "%-10s %10s %10s %10s %10s %10s %10s %10s\n",
+		"PHASE", "COUNT", "MIN(us)", "MEAN(us)", "P50(us)",
+		"P99(us)", "P999(us)", "MAX(us)");
+
+	int phase;
+	for(phase=0; phase<NUM_PHASES; phase++){
+		const Histogram *histogram = &(phases[phase]);
+		if(histogram->totalCount == 0){
+			continue;
+		}
+		fprintf(output, "%-10s %10llu %10.1f %10.1f %10.1f %10.1f \
+%10.1f %10.1f\n", phaseNames[phase],
+			(unsigned long long)(histogram->totalCount),
+			histogram->min / 1e3, histogram_mean(histogram) / 1e3,
+			histogram_percentile(histogram, 50.0) / 1e3,
+			histogram_percentile(histogram, 99.0) / 1e3,
+			histogram_percentile(histogram, 99.9) / 1e3,
+			histogram->max / 1e3);
+	}
+
+	fprintf(output, "%u UPLOADS (%u FAILED) OVER %u CONNECTION(S) IN \
+%.3f s: %.1f uploads/s, %.1f MB/s\n", numUploads, numFailures,
+		numConnections, elapsed,
+		(elapsed > 0) ? numUploads / elapsed : 0.0,
+		(elapsed > 0) ? numBytes / elapsed / 1e6 : 0.0);
+}
+
+/*
+ * Writing the latencies of each phase and the throughput as JSON
+ */
+void write_json_report(FILE *output, const Histogram *phases,
+		       const BenchConfig *config, unsigned int numConnections,
+		       unsigned int numUploads, unsigned int numFailures,
+		       size_t numBytes, double elapsed)
+{
+	fprintf(output, "{\n");
+	fprintf(output, "  \"connections\": %u,\n", numConnections);
+	fprintf(output, "  \"file_size\": %zu,\n", config->fileSize);
+	fprintf(output, "  \"chunk_size\": %u,\n", config->chunkSize);
+	fprintf(output, "  \"window\": %u,\n", config->window);
+	fprintf(output, "  \"uploads\": %u,\n", numUploads);
+	fprintf(output, "  \"failures\": %u,\n", numFailures);
+	fprintf(output, "  \"bytes\": %zu,\n", numBytes);
+	fprintf(output, "  \"seconds\": %.6f,\n", elapsed);
+	fprintf(output, "  \"uploads_per_second\": %.3f,\n",
+		(elapsed > 0) ? numUploads / elapsed : 0.0);
+	fprintf(output, "  \"megabytes_per_second\": %.3f,\n",
+		(elapsed > 0) ? numBytes / elapsed / 1e6 : 0.0);
+	fprintf(output, "  \"phases\": {");
+
+	//Latencies in microseconds, the phases never run are left out
+	const char *separator = "\n";
+	int phase;
+	for(phase=0; phase<NUM_PHASES; phase++){
+		const Histogram *histogram = &(phases[phase]);
+		if(histogram->totalCount == 0){
+			continue;
+		}
+		fprintf(output, "%s    \"%s\": {\"count\": %llu, \
+\"min_us\": %.3f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \
+\"p999_us\": %.3f, \"max_us\": %.3f}", separator, phaseNames[phase],
+			(unsigned long long)(histogram->totalCount),
+			histogram->min / 1e3, histogram_mean(histogram) / 1e3,
+			histogram_percentile(histogram, 50.0) / 1e3,
+			histogram_percentile(histogram, 99.0) / 1e3,
+			histogram_percentile(histogram, 99.9) / 1e3,
+			histogram->max / 1e3);
+		separator = ",\n";
+	}
+	fprintf(output, "\n  }\n}\n");
+}
+
+/*
+ * Current time of the monotonic clock in nanoseconds
+ */
+uint64_t now_nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec)*1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,127 @@
+#include <pthread.h>
+
+#include "buffer_pool.h"
+
+static const size_t classSizes[NUM_BUFFER_CLASSES] = {
+	SMALL_BUFFER_SIZE, MEDIUM_BUFFER_SIZE, LARGE_BUFFER_SIZE
+};
+static const unsigned int maxFreeBuffers[NUM_BUFFER_CLASSES] = {
+	MAX_FREE_SMALL_BUFFERS, MAX_FREE_MEDIUM_BUFFERS, MAX_FREE_LARGE_BUFFERS
+};
+
+//Free lists of each thread, so that no lock is taken
+static __thread BufferHeader *freeLists[NUM_BUFFER_CLASSES];
+static __thread unsigned int numFreeBuffers[NUM_BUFFER_CLASSES];
+
+//The free lists of a thread are free-ed when it exits
+static pthread_key_t exitKey;
+static pthread_once_t exitKeyOnce = PTHREAD_ONCE_INIT;
+static __thread int exitKeySet = 0;
+
+/*
+ * Free-ing the free lists of a thread which exits
+ */
+static void free_lists(void *args)
+{
+	(void)(args);
+	int sizeClass;
+	for(sizeClass=0; sizeClass<NUM_BUFFER_CLASSES; sizeClass++){
+		while(freeLists[sizeClass] != NULL){
+			BufferHeader *header = freeLists[sizeClass];
+			freeLists[sizeClass] = header->info.next;
+			free(header);
+		}
+		numFreeBuffers[sizeClass] = 0;
+	}
+}
+
+/*
+ * Creating the key whose destructor empties the free lists
+ */
+static void create_exit_key(void)
+{
+	pthread_key_create(&exitKey, free_lists);
+}
+
+/*
+ * Class of the smallest buffers big enough for the given size
+ */
+static unsigned int size_class(size_t size)
+{
+	unsigned int sizeClass = 0;
+	while(sizeClass < NUM_BUFFER_CLASSES && size > classSizes[sizeClass]){
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+/*
+ * Taking a buffer of at least the given size, from the free list of
+ * the thread for its class, or allocated if the list is empty
+ */
+void * buffer_alloc(size_t size)
+{
+	unsigned int sizeClass = size_class(size);
+	BufferHeader *header;
+
+	if(sizeClass < NUM_BUFFER_CLASSES && freeLists[sizeClass] != NULL){
+		header = freeLists[sizeClass];
+		freeLists[sizeClass] = header->info.next;
+		numFreeBuffers[sizeClass]--;
+		return header + 1;
+	}
+
+	//Only the first buffers of a thread, or bigger ones, are allocated
+	size_t bufferSize = (sizeClass < NUM_BUFFER_CLASSES) ? 
+		classSizes[sizeClass] : size;
+	header = malloc(sizeof(BufferHeader) + bufferSize);
+	if(header == NULL){
+		fprintf(stderr, "Error of allocating a buffer\n");
+		exit(1);
+	}
+	header->info.sizeClass = sizeClass;
+	header->info.next = NULL;
+
+	return header + 1;
+}
+
+/*
+ * Same as buffer_alloc, the given size being filled with zeros
+ */
+void * buffer_calloc(size_t size)
+{
+	void *buffer = buffer_alloc(size);
+	memset(buffer, 0, size);
+	return buffer;
+}
+
+/*
+ * Giving back a buffer to the free list of the thread, or free-ing it
+ * if the list is full
+ */
+void buffer_free(void *buffer)
+{
+	if(buffer == NULL){
+		return;
+	}
+
+	BufferHeader *header = (BufferHeader *)(buffer) - 1;
+	unsigned int sizeClass = header->info.sizeClass;
+	if(sizeClass >= NUM_BUFFER_CLASSES || 
+	   numFreeBuffers[sizeClass] >= maxFreeBuffers[sizeClass]){
+		free(header);
+		return;
+	}
+
+	//The first buffer kept by a thread asks for its lists to be free-ed
+	//when it exits
+	if(!exitKeySet){
+		pthread_once(&exitKeyOnce, create_exit_key);
+		pthread_setspecific(exitKey, &exitKeySet);
+		exitKeySet = 1;
+	}
+
+	header->info.next = freeLists[sizeClass];
+	freeLists[sizeClass] = header;
+	numFreeBuffers[sizeClass]++;
+}
@@ -0,0 +1,124 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include "chunk_store.h"
+
+//Size of the path of a chunk: the store, its subdirectory and its digest
+#define CHUNK_PATH_SIZE (CHUNK_DIR_SIZE + 2*DIGEST_SIZE + 8)
+
+//Directory of the chunk store, set once at startup
+static char storeDirectory[CHUNK_DIR_SIZE] = CHUNK_STORE_NAME;
+
+/*
+ * Path of the file of a chunk in the store, in a directory named by the first
+ * byte of the digest so that no directory gets too big
+ */
+static void chunk_path(const unsigned char *digest, char *path)
+{
+	int position = snprintf(path, CHUNK_PATH_SIZE, "%s/%02x/", 
+				storeDirectory, digest[0]);
+	int i;
+	for(i=0; i<DIGEST_SIZE; i++){
+		position += snprintf(path + position, CHUNK_PATH_SIZE - position,
+				     "%02x", digest[i]);
+	}
+}
+
+/*
+ * Putting the chunk store in the given storage directory, once at startup
+ * (the working directory otherwise)
+ */
+void set_chunk_store_directory(const char *storageDirectory)
+{
+	snprintf(storeDirectory, CHUNK_DIR_SIZE, "%s/%s", storageDirectory,
+		 CHUNK_STORE_NAME);
+}
+
+/*
+ * Telling whether the chunk of the given digest is in the store
+ */
+int chunk_store_has(const unsigned char *digest)
+{
+	char path[CHUNK_PATH_SIZE];
+	chunk_path(digest, path);
+	return access(path, F_OK) == 0;
+}
+
+/*
+ * Adding a chunk to the store once its bytes are checked against its digest,
+ * the chunk appears in the store only once it is whole
+ */
+int chunk_store_put(const unsigned char *digest, const unsigned char *data,
+		    unsigned int length)
+{
+	unsigned char computedDigest[DIGEST_SIZE];
+	sha256(data, length, computedDigest);
+	if(memcmp(computedDigest, digest, DIGEST_SIZE) != 0){
+		fprintf(stderr, "Error of storing a chunk: wrong digest\n");
+		return ERR;
+	}
+
+	//The directories are created the first time
+	char path[CHUNK_PATH_SIZE];
+	snprintf(path, CHUNK_PATH_SIZE, "%s", storeDirectory);
+	mkdir(path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+	snprintf(path, CHUNK_PATH_SIZE, "%s/%02x", storeDirectory, digest[0]);
+	mkdir(path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+
+	//Written to a temporary file first, then renamed atomically
+	char tempPath[CHUNK_PATH_SIZE + 8];
+	chunk_path(digest, path);
+	snprintf(tempPath, CHUNK_PATH_SIZE + 8, "%s.XXXXXX", path);
+	int fd = mkstemp(tempPath);
+	if(fd < 0){
+		fprintf(stderr, "Error of storing a chunk [mkstemp()]\n");
+		return ERR;
+	}
+	fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+	ssize_t numWrittenBytes;
+	while(length > 0){
+		numWrittenBytes = write(fd, data, length);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Error of storing a chunk [write()]\n");
+			close(fd);
+			unlink(tempPath);
+			return ERR;
+		}
+		data += numWrittenBytes;
+		length -= numWrittenBytes;
+	}
+	close(fd);
+
+	if(rename(tempPath, path) < 0){
+		fprintf(stderr, "Error of storing a chunk [rename()]\n");
+		unlink(tempPath);
+		return ERR;
+	}
+
+	return OK;
+}
+
+/*
+ * Opening the file of the chunk of the given digest, to be read
+ *
+ * Returns the file descriptor, or ERR if the chunk is not in the store
+ */
+int chunk_store_open(const unsigned char *digest)
+{
+	char path[CHUNK_PATH_SIZE];
+	chunk_path(digest, path);
+
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if(fd < 0){
+		fprintf(stderr, "Error of reading a chunk [open()]\n");
+		return ERR;
+	}
+	return fd;
+}
@@ -0,0 +1,87 @@
+#include "chunker.h"
+
+//Random value of each byte for the rolling hash (gear), filled once
+static uint64_t gearTable[256];
+static int gearTableReady = 0;
+
+/*
+ * Filling the table of the rolling hash with a fixed sequence of
+ * pseudo-random values (splitmix64), so all clients cut alike
+ */
+static void init_gear_table(void)
+{
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	int i;
+	for(i=0; i<256; i++){
+		seed += 0x9E3779B97F4A7C15ULL;
+		uint64_t value = seed;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+		gearTable[i] = value ^ (value >> 31);
+	}
+	gearTableReady = 1;
+}
+
+/*
+ * Length of the chunk starting at the given bytes, found by a rolling hash
+ * over their content so that the same content gives the same chunks
+ * wherever it is in the file
+ */
+unsigned int next_chunk_length(const unsigned char *data, size_t size)
+{
+	if(!gearTableReady){
+		init_gear_table();
+	}
+
+	if(size <= CHUNK_MIN_SIZE){
+		return size;
+	}
+	if(size > MAX_CHUNK_SIZE){
+		size = MAX_CHUNK_SIZE;
+	}
+
+	//Each byte shifts the hash, so its high bits only depend on
+	//the last 64 bytes
+	uint64_t hash = 0;
+	size_t i;
+	for(i=CHUNK_MIN_SIZE - 64; i<CHUNK_MIN_SIZE; i++){
+		hash = (hash << 1) + gearTable[data[i]];
+	}
+	for(i=CHUNK_MIN_SIZE; i<size; i++){
+		hash = (hash << 1) + gearTable[data[i]];
+		if((hash & CHUNK_BOUNDARY_MASK) == 0){
+			return i + 1;
+		}
+	}
+
+	return size;
+}
+
+/*
+ * Cutting the whole contents of a file into chunks with their digest
+ *
+ * Returns the list of chunks, to be free-ed by the caller
+ */
+Chunk * chunk_contents(const unsigned char *contents, size_t size,
+		       unsigned int *numChunks)
+{
+	unsigned int capacity = size/CHUNK_MIN_SIZE + 1;
+	Chunk *chunks = calloc(capacity, sizeof(Chunk));
+
+	size_t offset = 0;
+	*numChunks = 0;
+	while(offset < size){
+		Chunk *chunk = &(chunks[*numChunks]);
+		chunk->offset = offset;
+		chunk->entry.length = next_chunk_length(contents + offset, 
+							size - offset);
+		sha256(contents + offset, chunk->entry.length, 
+		       chunk->entry.digest);
+		chunk->needed = 0;
+
+		offset += chunk->entry.length;
+		(*numChunks)++;
+	}
+
+	return chunks;
+}
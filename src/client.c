@@ -4,8 +4,14 @@
 #include <string.h>
 #include <time.h>
 
+#include <sys/random.h>
+#include <limits.h>
+
 #include "packet_handler.h"
 #include "socket_helper.h"
+#include "chunker.h"
+#include "compressor.h"
+#include "crc32c.h"
 
 #define STATE_INIT 1 //initial state before connection setup
 #define STATE_HELLO 2 //state after sending a Hello command or Delivery command
@@ -13,130 +19,921 @@
 #define STATE_STORE 4 //state after sending a Data Store command
 
 #define MAX_DATA_SIZE 21880 //65527 //not including 8bytes of header
+#define DEFAULT_DATA_SIZE_EXTENDED 1048576 //with VERSION_EXTENDED (1MiB)
+#define DEFAULT_WINDOW 8 //data deliveries sent but not acknowledged yet
+#define MAX_STREAMS 64 //maximum number of connections sharing a transfer
+
+//Data structure of the file to send, either mapped into memory or
+//sent straight from its descriptor by the kernel (zero-copy)
+typedef struct _file_source{
+	int fd;
+	char *contents; //NULL when sent from the descriptor or empty
+	size_t size;
+} FileSource;
+
+//Data structure of what the client knows about its connection
+typedef struct _client_session{
+	int client_fd;
+	const SocketOptions *socketOptions; //server address, socket tuning
+	int current_state;
+	unsigned int current_sequence;
+	unsigned char version; //version of header agreed with the server
+	HelloParams hello;     //parameters offered in the client hello
+	int transferAgreed;    //server puts our range in the shared transfer
+	int dedupAgreed;       //server builds the file from its chunks
+	int compressionAgreed; //server decompresses the data parts
+	int checksumAgreed;    //server checks the data parts and the file
+
+	//Highest sequence number acknowledged by the server, and maximum
+	//number of packets sent but not acknowledged (VERSION_EXTENDED)
+	unsigned int ackedSequence;
+	unsigned int window;
+	int corked;
+
+	//Range of the file sent over this connection, in fragments of 
+	//chunkSize, and the result of the upload
+	const FileSource *source;
+	size_t rangeStart;
+	size_t rangeEnd;
+	unsigned int chunkSize;
+	int status;
+
+	//Chunks of the file, found by their content (deduplication)
+	Chunk *chunks;
+	unsigned int numChunks;
+
+	//Threads compressing the fragments ahead, and the compressed bytes
+	//sent instead of the next data part (NULL if sent as it is)
+	unsigned int numWorkers;
+	const unsigned char *compressedData;
+	unsigned int compressedLength;
+	uint32_t dataChecksum; //CRC32C of the next data part as sent
+
+	//CRC32C of the whole file sent with the store, computed while the
+	//fragments are sent when they cover the file in order
+	uint32_t fileChecksum;
+	int fileChecksumKnown;
+
+	//Name the server gives to the file, carried by the store (NULL for
+	//the name chosen by the server)
+	const char *storeName;
+} ClientSession;
 
 /*
- * Reading the whole file and send them as strings
+ * Opening the file to send, it is mapped into memory unless it is sent
+ * from its descriptor (zero-copy)
  */
-char *read_whole_file(const char *filename, int *filesize);
+void open_file_source(const char *filename, int zeroCopy, 
+		      FileSource *source);
+
+/*
+ * Closing the file to send, unmapping it if needed
+ */
+void close_file_source(FileSource *source);
+
+/*
+ * ID of the transfer of a file, the same as long as the file keeps
+ * its path, its size and its time of modification
+ */
+uint64_t file_transfer_id(const char *filename, const FileSource *source);
 
 /*
  * Creating packets to be sent to server according to actual state of
  * the client
  */
-void reply_from_client(int client_fd, int status_read, int *current_state, 
-		       int *current_sequence, Packet *readPacket, 
-		       unsigned char *dataToSend, int packetDataLength,
+void reply_from_client(ClientSession *session, int status_read, 
+		       Packet *readPacket, const FileSource *source, 
+		       size_t dataOffset, unsigned int packetDataLength, 
 		       int numberDeliveriesRemaining);
 
+/*
+ * Adopting the version of header agreed in the server hello
+ */
+void read_server_hello(ClientSession *session, Packet *readPacket);
+
+/*
+ * Sending the range of the file of a session over a new connection,
+ * from the hello to the acknowledged store
+ *
+ * Returns ERR if the upload failed, OK otherwise
+ */
+int run_session(ClientSession *session);
+
+/*
+ * Entry point of a thread sending the range of one connection
+ */
+void *stream_thread(void *args);
+
+/*
+ * Sending the range of the file of a session in fragments, the server
+ * hello being the last packet read
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int send_range(ClientSession *session, Packet *serverHello);
+
+/*
+ * Sending the list of the chunks of the file, then the chunks the server
+ * misses, the server hello being the last packet read
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int send_chunks(ClientSession *session, Packet *serverHello);
+
+/*
+ * Sending the given fragments of the file, each one compressed by a pool
+ * of workers ahead of being sent if the server agreed on it
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int send_fragments(ClientSession *session, Packet *serverHello,
+		   const Fragment *fragments, size_t numFragments);
+
+/*
+ * Reading the acknowledgements of the server until no more than
+ * maxOutstanding packets are sent but not acknowledged
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int wait_acknowledgement(ClientSession *session, unsigned int maxOutstanding);
+
 int main(int argc, char **argv)
 {
+	int zeroCopy = 0;
+	int legacyVersion = 0;
+	unsigned int chunkSize = DEFAULT_DATA_SIZE_EXTENDED;
+	int window = DEFAULT_WINDOW;
+	int numStreams = 1;
+	int resumable = 0;
+	int dedup = 0;
+	int compress = 0;
+	int integrity = 0;
+	const char *storeName = NULL;
+	long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	SocketOptions socketOptions;
+	int option;
+
+	init_socket_options(&socketOptions);
+	while((option = getopt(argc, argv, "4a:c:dij:k:lno:p:P:qrR:S:z")) != -1){
+		switch (option) {
+		case '4':
+			legacyVersion = 1;
+			break;
+		case 'a':
+			socketOptions.host = optarg;
+			break;
+		case 'c':
+			chunkSize = (unsigned int)(atoi(optarg));
+			break;
+		case 'd':
+			dedup = 1;
+			break;
+		case 'i':
+			integrity = 1;
+			break;
+		case 'j':
+			numWorkers = atol(optarg);
+			break;
+		case 'k':
+			window = atoi(optarg);
+			break;
+		case 'l':
+			compress = 1;
+			break;
+		case 'n':
+			socketOptions.noDelay = 1;
+			break;
+		case 'o':
+			storeName = optarg;
+			break;
+		case 'p':
+			numStreams = atoi(optarg);
+			break;
+		case 'P':
+			socketOptions.port = optarg;
+			break;
+		case 'q':
+			socketOptions.quickAck = 1;
+			break;
+		case 'r':
+			resumable = 1;
+			break;
+		case 'R':
+			socketOptions.receiveBuffer = atoi(optarg);
+			break;
+		case 'S':
+			socketOptions.sendBuffer = atoi(optarg);
+			break;
+		case 'z':
+			zeroCopy = 1;
+			break;
+		default:
+			fprintf(stderr, "#Usage: %s [-4] [-a address] [-c chunk_size] \
+[-d] [-i] [-j workers] [-k window] [-l] [-n] [-o stored_name] [-p streams] \
+[-P port] [-q] [-r] [-R receive_buffer_size] [-S send_buffer_size] [-z] filename\n", 
+				argv[0]);
+			return ERR;
+		}
+	}
 	
 	//Test if we have argument of filename
-	if(argc != 2){
+	if(argc - optind != 1){
 		fprintf(stderr, 
 			"#Error: require only one argument - \
 the filename\n");
 		return ERR;
 	}
+	if(chunkSize < 1 || chunkSize > MAX_DATA_SIZE_EXTENDED){
+		fprintf(stderr, "#Error: chunk size must be between 1 and \
+%d\n", MAX_DATA_SIZE_EXTENDED);
+		return ERR;
+	}
+	if(window < 1){
+		fprintf(stderr, "#Error: window must be positive\n");
+		return ERR;
+	}
+	if(socketOptions.receiveBuffer < 0 || socketOptions.sendBuffer < 0){
+		fprintf(stderr, "#Error: socket buffer sizes can't be \
+negative\n");
+		return ERR;
+	}
+	if(numStreams < 1 || numStreams > MAX_STREAMS){
+		fprintf(stderr, "#Error: number of streams must be between \
+1 and %d\n", MAX_STREAMS);
+		return ERR;
+	}
+	if((numStreams > 1 || resumable) && legacyVersion){
+		fprintf(stderr, "#Error: several streams or a resumable \
+upload need version 0x05\n");
+		return ERR;
+	}
+	if(numStreams > 1 && resumable){
+		fprintf(stderr, "#Error: only an upload over one stream can \
+be resumed\n");
+		return ERR;
+	}
+	if(dedup && (legacyVersion || numStreams > 1 || resumable)){
+		fprintf(stderr, "#Error: chunks are only sent over one stream \
+of version 0x05, without resuming\n");
+		return ERR;
+	}
+	if((compress || integrity) && legacyVersion){
+		fprintf(stderr, "#Error: compression and checksums need \
+version 0x05\n");
+		return ERR;
+	}
+	if(numWorkers < 1 || numWorkers > MAX_COMPRESSOR_WORKERS){
+		fprintf(stderr, "#Error: number of workers must be between \
+1 and %d\n", MAX_COMPRESSOR_WORKERS);
+		return ERR;
+	}
+
+	//The upload is timed from the connection to the acknowledged store
+	struct timespec startTime;
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+	//Opening the input file, its chunks are found in its mapping
+	//and its fragments compressed and checked from it
+	FileSource source;
+	open_file_source(argv[optind], 
+			 zeroCopy && !dedup && !compress && !integrity, 
+			 &source);
+	size_t file_size = source.size;
+
+	Chunk *chunks = NULL;
+	unsigned int numFileChunks = 0;
+	if(dedup){
+		chunks = chunk_contents((const unsigned char *)(source.contents),
+					file_size, &numFileChunks);
+	}
+
+	//Each connection sends as many whole fragments as the others,
+	//and has at least one to send
+	size_t numChunks = (file_size + chunkSize - 1)/chunkSize;
+	if((size_t)(numStreams) > numChunks){
+		numStreams = (numChunks > 0) ? (int)(numChunks) : 1;
+	}
+
+	//A resumable upload is known by the server under an ID given by
+	//the file, several connections share a transfer of random ID
+	uint64_t transferId = 0;
+	if(resumable){
+		transferId = file_transfer_id(argv[optind], &source);
+		fprintf(stderr, "RESUMABLE UPLOAD %016llx\n", 
+			(unsigned long long)(transferId));
+	}else if(numStreams > 1){
+		while(transferId == 0){
+			if(getrandom(&transferId, sizeof(uint64_t), 0) != 
+			   sizeof(uint64_t)){
+				transferId = ((uint64_t)(time(NULL)) << 32) |
+					(uint64_t)(getpid());
+			}
+		}
+	}
+
+	//Several connections all send the checksum of the whole file,
+	//computed once before they start
+	uint32_t fileChecksum = 0;
+	if(integrity && numStreams > 1){
+		fileChecksum = crc32c(0, (const unsigned char *)(source.contents),
+				      file_size);
+	}
+
+	//Generation of a random sequence number
+	srand(time(NULL));
+
+	ClientSession sessions[MAX_STREAMS];
+	int i;
+	for(i=0; i<numStreams; i++){
+		ClientSession *session = &(sessions[i]);
+		session->current_state = STATE_INIT;
+		session->socketOptions = &socketOptions;
+		session->current_sequence = rand()%(65535/2);
+
+		//The first version of header is used until the server agrees 
+		//on a newer one, a legacy client doesn't offer any
+		session->version = VERSION;
+		session->hello.version = legacyVersion ? VERSION : 
+			VERSION_EXTENDED;
+		session->hello.transferId = transferId;
+		session->hello.numStreams = numStreams;
+		session->hello.resume = resumable;
+		session->hello.resumeOffset = 0;
+		session->hello.dedup = dedup;
+		session->hello.compression = compress ? COMPRESSION_LZ4 : 
+			COMPRESSION_NONE;
+		session->dedupAgreed = 0;
+		session->compressionAgreed = 0;
+		session->numWorkers = (unsigned int)(numWorkers);
+		session->compressedData = NULL;
+		session->compressedLength = 0;
+		session->dataChecksum = 0;
+		session->hello.checksum = integrity ? CHECKSUM_CRC32C : 
+			CHECKSUM_NONE;
+		session->checksumAgreed = 0;
+		session->fileChecksum = fileChecksum;
+		session->fileChecksumKnown = (integrity && numStreams > 1);
+		session->chunks = chunks;
+		session->numChunks = numFileChunks;
+		session->transferAgreed = 0;
+		session->window = window;
+		session->corked = zeroCopy;
+
+		session->source = &source;
+		session->rangeStart = (numChunks*i/numStreams)*chunkSize;
+		session->rangeEnd = (numChunks*(i+1)/numStreams)*chunkSize;
+		if(session->rangeEnd > file_size){
+			session->rangeEnd = file_size;
+		}
+		session->chunkSize = chunkSize;
+		session->status = OK;
+		session->storeName = storeName;
+	}
+
+	//One thread per connection, each one with its own range
+	int status_upload = OK;
+	if(numStreams == 1){
+		status_upload = run_session(&(sessions[0]));
+	}else{
+		pthread_t streams[MAX_STREAMS];
+		for(i=0; i<numStreams; i++){
+			Pthread_create(&streams[i], NULL, stream_thread, 
+				       &(sessions[i]));
+		}
+		for(i=0; i<numStreams; i++){
+			Pthread_join(streams[i], NULL);
+			if(sessions[i].status == ERR){
+				status_upload = ERR;
+			}
+		}
+	}
+		
+	close_file_source(&source);
+	if(chunks != NULL){
+		free(chunks);
+	}
+
+	if(status_upload == ERR){
+		fprintf(stderr, "UPLOAD FAILED\n");
+		return ERR;
+	}
+
+	//Only the extended version knows when the file is stored
+	if(sessions[0].version == VERSION_EXTENDED){
+		struct timespec endTime;
+		clock_gettime(CLOCK_MONOTONIC, &endTime);
+		double elapsed = (endTime.tv_sec - startTime.tv_sec) + 
+			(endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+		fprintf(stderr, "UPLOAD STORED: %zu bytes in %.3f s \
+(%.1f MB/s) over %d stream(s)\n", file_size, elapsed, 
+			(elapsed > 0) ? file_size / elapsed / 1e6 : 0.0,
+			numStreams);
+	}
+	return OK;
+}
+
+/*
+ * Entry point of a thread sending the range of one connection
+ */
+void *stream_thread(void *args)
+{
+	ClientSession *session = args;
+	session->status = run_session(session);
+
+	//The other ranges are useless without this one, and the other
+	//connections may wait for a server which gave up on the transfer
+	if(session->status == ERR){
+		fprintf(stderr, "UPLOAD FAILED\n");
+		exit(1);
+	}
+	return NULL;
+}
+
+/*
+ * Sending the range of the file of a session over a new connection,
+ * from the hello to the acknowledged store
+ *
+ * Returns ERR if the upload failed, OK otherwise
+ */
+int run_session(ClientSession *session)
+{
+	const FileSource *source = session->source;
 
-	//Reading the input file
-	int file_size = 0;
-	char *fileContents = read_whole_file(argv[1], &file_size);
-	
 	//New client socket
-	int client_fd = client_connecting();
-	if(client_fd == ERR){
+	session->client_fd = client_connecting(session->socketOptions);
+	if(session->client_fd == ERR){
 		fprintf(stderr, "Error of establishing a client socket\n");
-		free(fileContents);
 		return ERR;
 	}
 
 	Packet *readPacket = NULL;
-	int current_state = STATE_INIT;
 	int status_read = OK;
-
-	//Generation of a random sequence number
-	srand(time(NULL));
-	int current_sequence = rand()%(65535/2);
 	
 	//CLIENT HELLO
-	reply_from_client(client_fd, status_read, &current_state, 
-			  &current_sequence, readPacket, 
-			  (unsigned char *)(fileContents), 0, 0);
+	reply_from_client(session, status_read, readPacket, source, 0, 0, 0);
 
 	//WAITING FOR SERVER HELLO
-	status_read = read_check_packet(client_fd, &readPacket);
+	status_read = read_check_packet(session->client_fd, &readPacket);
+	if(status_read == OK){
+		read_server_hello(session, readPacket);
+	}
+	session->ackedSequence = session->current_sequence;
+
+	//A range of the file is useless if the server doesn't put it
+	//together with the other ones
+	if(status_read == OK && session->hello.transferId != 0 &&
+	   !session->transferAgreed){
+		fprintf(stderr, "SERVER DOESN'T SUPPORT SEVERAL STREAMS\n");
+		status_read = ERR;
+	}
 	
 	//--------------- DATA DELIVERY ------------------------//
-        int i;
-
-	int numberSending = (int)(file_size/MAX_DATA_SIZE);
-	int numberDeliveriesRemaining = numberSending;
-	if((file_size%MAX_DATA_SIZE) != 0 ){
-		numberDeliveriesRemaining++;
-	}
-
-	//Delivery of all the fragments of file except the last one
-	for(i=0; i<numberSending; i++){
-		reply_from_client(client_fd, status_read, &current_state, 
-				  &current_sequence, readPacket, 
-				  (unsigned char *)(fileContents + 
-						    i*MAX_DATA_SIZE),
-				  MAX_DATA_SIZE, numberDeliveriesRemaining);
-		numberDeliveriesRemaining--;
-	}
-
-	//Delivery of the last fragment
-	if(numberDeliveriesRemaining == 1)
-	{
-		reply_from_client(client_fd, status_read, &current_state, 
-				  &current_sequence, readPacket, 
-				  (unsigned char *)(fileContents + 
-						    numberSending
-						    *MAX_DATA_SIZE),
-				  file_size%MAX_DATA_SIZE, 
-				  numberDeliveriesRemaining);	
+	//A file sent as chunks is first listed, then only the missing
+	//chunks are sent
+	if(status_read == OK && session->dedupAgreed){
+		status_read = send_chunks(session, readPacket);
+	}else if(status_read == OK){
+		status_read = send_range(session, readPacket);
 	}
 	//-------------- END OF DATA DELIVERY ------------------//
 
-	free_packet(readPacket);
-	readPacket = NULL;
+	if(readPacket != NULL){
+		free_packet_for_read(readPacket);
+		readPacket = NULL;
+	}
+
+	//The fragments sent don't cover the whole file (chunks, resumed
+	//upload), its checksum is computed now
+	if(status_read == OK && session->checksumAgreed && 
+	   !session->fileChecksumKnown){
+		session->fileChecksum = crc32c(0, 
+			(const unsigned char *)(source->contents), 
+			source->size);
+		session->fileChecksumKnown = 1;
+	}
 
 	//DATA STORE
-	reply_from_client(client_fd, status_read, &current_state, 
-			  &current_sequence, readPacket, 
-			  (unsigned char *)(fileContents), 0, 0);
+	if(status_read == OK){
+		reply_from_client(session, status_read, readPacket, source, 
+				  0, 0, 0);
+
+		//Waiting for the store to be acknowledged
+		status_read = wait_acknowledgement(session, 0);
+	}
 		
-	free(fileContents);
-	return OK;
+	close(session->client_fd);
+	return status_read;
 }
 
 /*
- * Reading the whole file and send them as strings
+ * Sending the range of the file of a session in fragments, the server
+ * hello being the last packet read
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int send_range(ClientSession *session, Packet *serverHello)
+{
+	unsigned int chunkSize = session->chunkSize;
+	int status_read = OK;
+	size_t i;
+
+	//Fragments as big as the agreed version allows
+	if(session->version == VERSION){
+		chunkSize = MAX_DATA_SIZE;
+	}
+
+	//An empty file is sent as one empty fragment
+	size_t rangeSize = session->rangeEnd - session->rangeStart;
+	size_t numFragments = (rangeSize + chunkSize - 1)/chunkSize;
+	if(numFragments == 0){
+		numFragments = 1;
+	}
+	Fragment *fragments = calloc(numFragments, sizeof(Fragment));
+	for(i=0; i<numFragments; i++){
+		fragments[i].offset = session->rangeStart + i*chunkSize;
+		fragments[i].length = chunkSize;
+		if(i == numFragments - 1){
+			fragments[i].length = rangeSize - i*chunkSize;
+		}
+	}
+
+	//Headers and data parts sent by the kernel are held back until
+	//they fill whole segments
+	if(session->corked){
+		set_cork(session->client_fd, 1);
+	}
+
+	status_read = send_fragments(session, serverHello, fragments, 
+				     numFragments);
+	free(fragments);
+
+	if(session->corked){
+		set_cork(session->client_fd, 0);
+	}
+
+	return status_read;
+}
+
+/*
+ * Sending the list of the chunks of the file, then the chunks the server
+ * misses, the server hello being the last packet read
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
  */
-char *read_whole_file(const char *filename, int *filesize)
+int send_chunks(ClientSession *session, Packet *serverHello)
 {
-	*filesize = 0;
+	Chunk *chunks = session->chunks;
+	unsigned int numChunks = session->numChunks;
+
+	//As many chunks per list as a packet can carry, at least one list
+	//is sent even for an empty file
+	unsigned int maxListed = MAX_DATA_SIZE_EXTENDED / CHUNK_ENTRY_SIZE;
+	unsigned char *listBytes = malloc(maxListed*CHUNK_ENTRY_SIZE);
+	unsigned int firstListed = 0;
+	unsigned int numNeeded = 0;
+	size_t numNeededBytes = 0;
+	unsigned int i;
+
+	do{
+		unsigned int numListed = numChunks - firstListed;
+		if(numListed > maxListed){
+			numListed = maxListed;
+		}
+		for(i=0; i<numListed; i++){
+			chunkEntryToBytes(&(chunks[firstListed+i].entry),
+					  listBytes + i*CHUNK_ENTRY_SIZE);
+		}
+
+		session->current_sequence += 1;
+		Packet *packetToSend = init_packet(session->version, 
+						   session->current_sequence,
+						   CHUNK_LIST, listBytes, 
+						   numListed*CHUNK_ENTRY_SIZE);
+		send_packet(session->client_fd, packetToSend);
+		free_packet(packetToSend);
+
+		//The server answers with one bit per chunk of the list
+		Packet *readPacket;
+		if(read_check_packet(session->client_fd, &readPacket) == ERR){
+			free(listBytes);
+			return ERR;
+		}
+		Header *readHeader = readPacket->packet_header;
+		if(readHeader->command != CHUNK_NEED || 
+		   readHeader->length - header_size(readHeader->version) <
+		   (numListed + 7)/8){
+			fprintf(stderr, "ERROR PACKET RECEIVED\n");
+			free_packet_for_read(readPacket);
+			free(listBytes);
+			return ERR;
+		}
+		for(i=0; i<numListed; i++){
+			Chunk *chunk = &(chunks[firstListed+i]);
+			chunk->needed = (readPacket->packet_data[i/8] >> 
+					 (i%8)) & 1;
+			if(chunk->needed){
+				numNeeded++;
+				numNeededBytes += chunk->entry.length;
+			}
+		}
+		free_packet_for_read(readPacket);
+		session->ackedSequence = session->current_sequence;
+
+		firstListed += numListed;
+	}while(firstListed < numChunks);
+	free(listBytes);
 
-	FILE *new_file = fopen(filename, "rb");
-	if(new_file == NULL){
+	fprintf(stderr, "SENDING %u OF %u CHUNKS (%zu OF %zu BYTES)\n",
+		numNeeded, numChunks, numNeededBytes, session->source->size);
+
+	//The server has them all, the file can be stored
+	if(numNeeded == 0){
+		session->current_state = STATE_DELIVERY;
+		return OK;
+	}
+
+	//Each missing chunk is one data delivery, sliced straight out
+	//of the mapping
+	Fragment *fragments = calloc(numNeeded, sizeof(Fragment));
+	unsigned int numFragments = 0;
+	for(i=0; i<numChunks; i++){
+		if(chunks[i].needed){
+			fragments[numFragments].offset = chunks[i].offset;
+			fragments[numFragments].length = chunks[i].entry.length;
+			numFragments++;
+		}
+	}
+
+	int status_read = send_fragments(session, serverHello, fragments,
+					 numFragments);
+	free(fragments);
+
+	return status_read;
+}
+
+/*
+ * Sending the given fragments of the file, each one compressed by a pool
+ * of workers ahead of being sent if the server agreed on it
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int send_fragments(ClientSession *session, Packet *serverHello,
+		   const Fragment *fragments, size_t numFragments)
+{
+	CompressorPool *pool = NULL;
+	if(session->compressionAgreed){
+		pool = init_compressor_pool(
+			(const unsigned char *)(session->source->contents),
+			fragments, numFragments, session->numWorkers, 
+			session->checksumAgreed);
+	}
+
+	//The checksum of the file is put together from the ones of the
+	//fragments, if they cover it in order
+	size_t numCheckedBytes = 0;
+
+	int status_read = OK;
+	size_t i;
+	for(i=0; i<numFragments && status_read == OK; i++){
+		//The compressed bytes are sent instead, when smaller
+		uint32_t rawChecksum = 0;
+		if(pool != NULL){
+			const CompressedFragment *compressed = 
+				compressor_wait(pool, i);
+			if(compressed->length > 0){
+				session->compressedData = compressed->bytes;
+				session->compressedLength = compressed->length;
+			}
+			rawChecksum = compressed->rawChecksum;
+			session->dataChecksum = compressed->checksum;
+		}else if(session->checksumAgreed){
+			rawChecksum = crc32c(0, 
+				(const unsigned char *)(session->source->contents) +
+				fragments[i].offset, fragments[i].length);
+			session->dataChecksum = rawChecksum;
+		}
+		if(session->checksumAgreed && !session->fileChecksumKnown &&
+		   fragments[i].offset == numCheckedBytes){
+			session->fileChecksum = crc32c_combine(
+				session->fileChecksum, rawChecksum, 
+				fragments[i].length);
+			numCheckedBytes += fragments[i].length;
+		}
+
+		reply_from_client(session, status_read, serverHello, 
+				  session->source, fragments[i].offset,
+				  fragments[i].length, numFragments - i);
+		session->compressedData = NULL;
+		if(pool != NULL){
+			compressor_release(pool, i);
+		}
+
+		//No more than a window of packets is not acknowledged yet
+		if(i < numFragments - 1){
+			status_read = wait_acknowledgement(session, 
+							   session->window);
+		}
+	}
+
+	if(status_read == OK && numCheckedBytes == session->source->size){
+		session->fileChecksumKnown = 1;
+	}
+
+	if(pool != NULL){
+		fprintf(stderr, "COMPRESSED %zu BYTES INTO %zu\n",
+			pool->numRawBytes, pool->numSentBytes);
+		free_compressor_pool(pool);
+	}
+
+	return status_read;
+}
+
+/*
+ * Opening the file to send, it is mapped into memory unless it is sent
+ * from its descriptor (zero-copy)
+ */
+void open_file_source(const char *filename, int zeroCopy, 
+		      FileSource *source)
+{
+	source->contents = NULL;
+	source->size = 0;
+
+	source->fd = open(filename, O_RDONLY);
+	if(source->fd < 0){
 		fprintf(stderr, "ERROR OF OPENING FILE\n");
 		exit(1);
 	}
 
 	//Looking for the size of file
-	fseek(new_file, 0, SEEK_END);
-	long file_size = ftell(new_file);
-	*filesize = file_size;
-	fseek(new_file, 0, SEEK_SET);
-
-	//Reading the whole file and put them onto a string
-	char *output_string = calloc(file_size, sizeof(char));
-	fread(output_string, file_size, 1, new_file);
+	struct stat fileStatus;
+	Fstat(source->fd, &fileStatus);
+	source->size = fileStatus.st_size;
+
+	//The kernel sends the file from its descriptor, and an empty file 
+	//can't be mapped, there is nothing to send anyway
+	if(zeroCopy || source->size == 0){
+		return;
+	}
+
+	//Mapping the whole file, its pages are read by the kernel only 
+	//when they are sent, from the beginning to the end
+	source->contents = Mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, 
+				source->fd, 0);
+	if(madvise(source->contents, source->size, MADV_SEQUENTIAL) < 0){
+		fprintf(stderr, "Warning: no read-ahead advice for the file\n");
+	}
 	
-	fclose(new_file);
+	//The mapping stays valid once the file is closed
+	close(source->fd);
+	source->fd = -1;
+}
+
+/*
+ * Closing the file to send, unmapping it if needed
+ */
+void close_file_source(FileSource *source)
+{
+	if(source->contents != NULL){
+		Munmap(source->contents, source->size);
+		source->contents = NULL;
+	}
+	if(source->fd >= 0){
+		close(source->fd);
+		source->fd = -1;
+	}
+}
+
+/*
+ * ID of the transfer of a file, the same as long as the file keeps
+ * its path, its size and its time of modification
+ */
+uint64_t file_transfer_id(const char *filename, const FileSource *source)
+{
+	char path[PATH_MAX];
+	if(realpath(filename, path) == NULL){
+		snprintf(path, PATH_MAX, "%s", filename);
+	}
+
+	struct stat fileStatus;
+	if(stat(path, &fileStatus) < 0){
+		fileStatus.st_mtime = 0;
+	}
+
+	//FNV-1a hash of the path, then of the size and the time
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for(i=0; path[i] != '\0'; i++){
+		hash = (hash ^ (unsigned char)(path[i])) * 1099511628211ULL;
+	}
+	uint64_t values[2] = {source->size, (uint64_t)(fileStatus.st_mtime)};
+	for(i=0; i<sizeof(values); i++){
+		hash = (hash ^ ((unsigned char *)(values))[i]) * 
+			1099511628211ULL;
+	}
+
+	//0 means no transfer
+	return (hash != 0) ? hash : 1;
+}
+
+/*
+ * Adopting the version of header agreed in the server hello
+ */
+void read_server_hello(ClientSession *session, Packet *readPacket)
+{
+	Header *readPacketHeader = readPacket->packet_header;
+	if(readPacketHeader->command != SERVER_HELLO){
+		return;
+	}
+
+	//A server without hello parameters only knows the first version
+	HelloParams agreed;
+	if(read_hello(readPacket->packet_data, readPacketHeader->length - 
+		      header_size(readPacketHeader->version), &agreed) == ERR){
+		return;
+	}
+
+	//Only a version we offered can be agreed
+	if(agreed.version == VERSION_EXTENDED &&
+	   session->hello.version == VERSION_EXTENDED){
+		session->version = VERSION_EXTENDED;
+	}
+
+	//The server joined us to the transfer we asked for
+	if(session->hello.transferId != 0 &&
+	   agreed.transferId == session->hello.transferId &&
+	   agreed.numStreams == session->hello.numStreams){
+		session->transferAgreed = 1;
+	}
+
+	//The server builds the file from the chunks, or it gets it whole
+	if(session->hello.dedup && agreed.dedup){
+		session->dedupAgreed = 1;
+	}
+
+	//The server decompresses the data parts, or gets them as they are
+	if(session->hello.compression != COMPRESSION_NONE &&
+	   agreed.compression == session->hello.compression){
+		session->compressionAgreed = 1;
+	}
+
+	//The server checks the data parts and the file, or trusts them
+	if(session->hello.checksum != CHECKSUM_NONE &&
+	   agreed.checksum == session->hello.checksum){
+		session->checksumAgreed = 1;
+	}
 
-	return output_string;
+	//Only the data not received yet by the server is sent
+	if(session->transferAgreed && session->hello.resume && agreed.resume){
+		if(agreed.resumeOffset > session->rangeEnd){
+			fprintf(stderr, "SERVER HAS MORE THAN THE FILE\n");
+			session->transferAgreed = 0;
+			return;
+		}
+		session->rangeStart = agreed.resumeOffset;
+		fprintf(stderr, "RESUMING AT %llu\n", 
+			(unsigned long long)(agreed.resumeOffset));
+	}
+}
+
+/*
+ * Reading the acknowledgements of the server until no more than
+ * maxOutstanding packets are sent but not acknowledged
+ *
+ * Returns ERR if the server sends an error or is gone, OK otherwise
+ */
+int wait_acknowledgement(ClientSession *session, unsigned int maxOutstanding)
+{
+	//Only the extended version has acknowledgements
+	if(session->version != VERSION_EXTENDED){
+		return OK;
+	}
+
+	//Holding back the last bytes could delay the acknowledgement
+	if(session->current_sequence - session->ackedSequence > 
+	   maxOutstanding && session->corked){
+		set_cork(session->client_fd, 0);
+		set_cork(session->client_fd, 1);
+	}
+
+	Packet *readPacket;
+	while(session->current_sequence - session->ackedSequence > 
+	      maxOutstanding){
+		if(read_check_packet(session->client_fd, &readPacket) == ERR){
+			return ERR;
+		}
+
+		int command = readPacket->packet_header->command;
+		unsigned int sequence = readPacket->packet_header->sequence;
+		free_packet_for_read(readPacket);
+
+		if(command != ACK){
+			fprintf(stderr, "ERROR PACKET RECEIVED\n");
+			return ERR;
+		}
+		session->ackedSequence = sequence;
+	}
+
+	return OK;
 }
 
 /*
@@ -145,13 +942,26 @@ char *read_whole_file(const char *filename, int *filesize)
  * Creating packets to be sent to server according to actual state of
  * the client
  */
-void reply_from_client(int client_fd, int status_read, int *current_state, 
-		       int *current_sequence, Packet *readPacket, 
-		       unsigned char *dataToSend, int packetDataLength,
+void reply_from_client(ClientSession *session, int status_read, 
+		       Packet *readPacket, const FileSource *source, 
+		       size_t dataOffset, unsigned int packetDataLength, 
 		       int numberDeliveriesRemaining)
 {
-	//Increasing sequence number
-	(*current_sequence) += 1;
+	int *current_state = &(session->current_state);
+
+	//The data part is in the mapping, or is only given by the kernel
+	//when it is sent
+	unsigned char *dataToSend = NULL;
+	if(source->contents != NULL){
+		dataToSend = (unsigned char *)(source->contents + dataOffset);
+	}
+
+	//Increasing sequence number, going back to 0 after 65535 (2bytes)
+	//for the first version
+	session->current_sequence += 1;
+	if(session->version == VERSION){
+		session->current_sequence %= 65536;
+	}
 
 	Header *readPacketHeader;
 	if(readPacket == NULL){
@@ -161,30 +971,56 @@ void reply_from_client(int client_fd, int status_read, int *current_state,
 	}
 
 	Packet *packetToSend;
+	unsigned char helloBytes[MAX_HELLO_SIZE];
+	unsigned int helloLength;
 
 	if(status_read == ERR){
 		packetToSend = send_error_packet(
-			readPacketHeader->sequence, 
+			session->version, readPacketHeader->sequence, 
 			&current_state,(int)(STATE_INIT));
 	}else{
 		//We test the current command according to the 
 		//current state of client
 		switch (*current_state) {
 		case STATE_INIT:
-			//INITIAL STATE
-			packetToSend = init_packet(*current_sequence, 
-						   CLIENT_HELLO, NULL, 
-						   0);
+			//INITIAL STATE, the hello carries the parameters
+			//offered to the server, unless it is a legacy one
+			helloLength = 0;
+			if(session->hello.version != VERSION){
+				helloLength = helloToBytes(&(session->hello), 
+							   helloBytes);
+			}
+			packetToSend = init_packet(VERSION,
+						   session->current_sequence, 
+						   CLIENT_HELLO, helloBytes, 
+						   helloLength);
 			*current_state = STATE_HELLO;
 			break;
 		case STATE_HELLO:
 			//STATE after sending CLIENT HELLO
 			switch (readPacketHeader->command) {
 			case SERVER_HELLO:
-				packetToSend = init_packet(*current_sequence, 
+				packetToSend = init_packet(session->version,
+							   session->current_sequence, 
 							   DATA_DELIVERY, 
 							   dataToSend,
 							   packetDataLength);
+
+				//The server puts each range of a transfer
+				//at its position
+				if(packetToSend != NULL && 
+				   session->transferAgreed){
+					set_packet_offset(packetToSend, 
+							  dataOffset);
+				}
+
+				//The compressed bytes replace the data part
+				if(packetToSend != NULL &&
+				   session->compressedData != NULL){
+					set_packet_compressed(packetToSend,
+						(unsigned char *)(session->compressedData),
+						session->compressedLength);
+				}
 				
 				if(numberDeliveriesRemaining == 1){
 					*current_state = STATE_DELIVERY;
@@ -192,6 +1028,7 @@ void reply_from_client(int client_fd, int status_read, int *current_state,
 				break;
 			default:
 				packetToSend = send_error_packet(
+					session->version,
 					readPacketHeader->sequence, 
 					&current_state,(int)(STATE_INIT));
 				break;
@@ -200,29 +1037,55 @@ void reply_from_client(int client_fd, int status_read, int *current_state,
 		case STATE_DELIVERY:
 			//STATE after sending THE WHOLE DATA
 			if(readPacketHeader == NULL){
-				packetToSend = init_packet(*current_sequence, 
+				//The name of the file, if any, is the data
+				//part of the store
+				unsigned int nameLength = 
+					(session->storeName != NULL) ?
+					strlen(session->storeName) : 0;
+				packetToSend = init_packet(session->version,
+							   session->current_sequence, 
 							   DATA_STORE, 
-							   NULL,
-							   0);
+							   (unsigned char *)(session->storeName),
+							   nameLength);
 				*current_state = STATE_STORE;
 				break;
 			}else{
 				packetToSend = send_error_packet(
+					session->version,
 					readPacketHeader->sequence, 
 					&current_state,(int)(STATE_INIT));
 			}
 		default:
 			packetToSend = send_error_packet(
+				session->version,
 				readPacketHeader->sequence, 
 				&current_state,(int)(STATE_INIT));
 			break;
 		}
 	}
 
+	//Each data part is checked by the server as it is sent, and the
+	//store with the whole file
+	if(packetToSend != NULL && session->checksumAgreed){
+		Header *packetHeader = packetToSend->packet_header;
+		if(packetHeader->command == DATA_DELIVERY){
+			set_packet_checksum(packetToSend, 
+					    session->dataChecksum);
+		}else if(packetHeader->command == DATA_STORE){
+			set_packet_checksum(packetToSend, 
+					    session->fileChecksum);
+		}
+	}
+
+	//The data part is sent straight from the file contents
 	if(packetToSend != NULL){
-		char *bytesToBeSent = (char *)(packetToBytes(packetToSend));
-                Rio_writen(client_fd, bytesToBeSent, 8+packetDataLength);
+		if(packetToSend->packet_header->command == DATA_DELIVERY &&
+		   dataToSend == NULL && packetDataLength > 0){
+			send_packet_from_file(session->client_fd, packetToSend, 
+					      source->fd, dataOffset);
+		}else{
+			send_packet(session->client_fd, packetToSend);
+		}
 		free_packet(packetToSend);
-		free(bytesToBeSent);
 	}
 }
@@ -0,0 +1,187 @@
+#include "compressor.h"
+#include "csapp.h"
+#include "crc32c.h"
+
+/*
+ * Compressing one fragment into its slot with the table of positions of
+ * the worker, only kept if it gets smaller with its decompressed size,
+ * then computing the checksums if asked
+ */
+static void compress_fragment(CompressorPool *pool, size_t index,
+			      CompressedFragment *slot, uint32_t *table)
+{
+	const Fragment *fragment = &(pool->fragments[index]);
+
+	slot->length = 0;
+	if(fragment->length > RAW_LENGTH_SIZE + 1){
+		slot->length = lz4_compress(pool->contents + fragment->offset,
+					    fragment->length, slot->bytes,
+					    fragment->length - 
+					    RAW_LENGTH_SIZE - 1, table);
+	}
+
+	if(pool->checksums){
+		slot->rawChecksum = crc32c(0, pool->contents + fragment->offset,
+					   fragment->length);
+		slot->checksum = slot->rawChecksum;
+		if(slot->length > 0){
+			slot->checksum = crc32c(0, slot->bytes, slot->length);
+		}
+	}
+	slot->index = index;
+}
+
+/*
+ * Entry point of a worker, compressing the next fragment as long as
+ * a slot is free
+ */
+static void *compressor_worker(void *args)
+{
+	CompressorPool *pool = args;
+
+	//One table for all the fragments of the worker, so that it is not
+	//allocated and cleared for each one
+	uint32_t *table = calloc(LZ4_TABLE_SIZE, sizeof(uint32_t));
+
+	pthread_mutex_lock(&(pool->lock));
+	while(1){
+		while(!pool->stopping && 
+		      pool->nextCompressed < pool->numFragments &&
+		      pool->nextCompressed >= pool->nextSent + pool->numSlots){
+			pthread_cond_wait(&(pool->changed), &(pool->lock));
+		}
+		if(pool->stopping || pool->nextCompressed >= pool->numFragments){
+			break;
+		}
+
+		//The fragment is compressed without holding the lock
+		size_t index = pool->nextCompressed++;
+		CompressedFragment *slot = &(pool->slots[index % pool->numSlots]);
+		pthread_mutex_unlock(&(pool->lock));
+
+		compress_fragment(pool, index, slot, table);
+
+		pthread_mutex_lock(&(pool->lock));
+		pool->numRawBytes += pool->fragments[index].length;
+		pool->numSentBytes += (slot->length > 0) ? 
+			slot->length + RAW_LENGTH_SIZE : 
+			pool->fragments[index].length;
+		slot->ready = 1;
+		pthread_cond_broadcast(&(pool->changed));
+	}
+	pthread_mutex_unlock(&(pool->lock));
+
+	free(table);
+	return NULL;
+}
+
+/*
+ * Initialization of a pool of workers compressing the given fragments of
+ * the file contents, and computing their checksums if asked, they start
+ * at once
+ */
+CompressorPool * init_compressor_pool(const unsigned char *contents,
+				      const Fragment *fragments,
+				      size_t numFragments, 
+				      unsigned int numWorkers, int checksums)
+{
+	CompressorPool *new_pool = calloc(1, sizeof(CompressorPool));
+
+	new_pool->contents = contents;
+	new_pool->fragments = fragments;
+	new_pool->numFragments = numFragments;
+	new_pool->checksums = checksums;
+
+	pthread_mutex_init(&(new_pool->lock), NULL);
+	pthread_cond_init(&(new_pool->changed), NULL);
+	new_pool->nextCompressed = 0;
+	new_pool->nextSent = 0;
+	new_pool->stopping = 0;
+
+	//Each worker can compress one fragment while another one waits
+	//to be sent
+	unsigned int maxLength = 0;
+	size_t i;
+	for(i=0; i<numFragments; i++){
+		if(fragments[i].length > maxLength){
+			maxLength = fragments[i].length;
+		}
+	}
+	new_pool->numSlots = 2*numWorkers;
+	if(new_pool->numSlots < MIN_COMPRESSOR_SLOTS){
+		new_pool->numSlots = MIN_COMPRESSOR_SLOTS;
+	}
+	new_pool->slots = calloc(new_pool->numSlots, 
+				 sizeof(CompressedFragment));
+	for(i=0; i<new_pool->numSlots; i++){
+		new_pool->slots[i].ready = 0;
+		new_pool->slots[i].bytes = malloc(maxLength + 1);
+	}
+
+	new_pool->numWorkers = numWorkers;
+	new_pool->workers = calloc(numWorkers, sizeof(pthread_t));
+	for(i=0; i<numWorkers; i++){
+		Pthread_create(&(new_pool->workers[i]), NULL, 
+			       compressor_worker, new_pool);
+	}
+
+	return new_pool;
+}
+
+/*
+ * Stopping the workers and free-ing the pool, the fragments not sent
+ * yet are dropped
+ */
+void free_compressor_pool(CompressorPool *pool)
+{
+	pthread_mutex_lock(&(pool->lock));
+	pool->stopping = 1;
+	pthread_cond_broadcast(&(pool->changed));
+	pthread_mutex_unlock(&(pool->lock));
+
+	unsigned int i;
+	for(i=0; i<pool->numWorkers; i++){
+		Pthread_join(pool->workers[i], NULL);
+	}
+	free(pool->workers);
+
+	for(i=0; i<pool->numSlots; i++){
+		free(pool->slots[i].bytes);
+	}
+	free(pool->slots);
+
+	pthread_mutex_destroy(&(pool->lock));
+	pthread_cond_destroy(&(pool->changed));
+	free(pool);
+}
+
+/*
+ * Waiting for a fragment to be compressed, the fragments have to be
+ * asked in order
+ */
+const CompressedFragment * compressor_wait(CompressorPool *pool, 
+					   size_t index)
+{
+	CompressedFragment *slot = &(pool->slots[index % pool->numSlots]);
+
+	pthread_mutex_lock(&(pool->lock));
+	while(!(slot->ready && slot->index == index)){
+		pthread_cond_wait(&(pool->changed), &(pool->lock));
+	}
+	pthread_mutex_unlock(&(pool->lock));
+
+	return slot;
+}
+
+/*
+ * Giving back the slot of a fragment sent, for the next fragment
+ * to be compressed
+ */
+void compressor_release(CompressorPool *pool, size_t index)
+{
+	pthread_mutex_lock(&(pool->lock));
+	pool->slots[index % pool->numSlots].ready = 0;
+	pool->nextSent = index + 1;
+	pthread_cond_broadcast(&(pool->changed));
+	pthread_mutex_unlock(&(pool->lock));
+}
@@ -0,0 +1,465 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "connection.h"
+#include "metrics.h"
+
+//Biggest data delivery kept whole in the receive buffer, set once at
+//startup
+static unsigned int frameLimit = MAX_FRAME_SIZE;
+
+/*
+ * Interpretating a whole frame into a packet view, a data part is checked
+ * against its checksum then given decompressed
+ *
+ * Returns ERR if the frame is not a valid packet
+ */
+static int interpret_frame(Connection *conn, const Frame *frame, 
+			   PacketView *readPacket)
+{
+	//Interpretating the frame into a packet view, without any copy
+	if(read_packet_view(frame->bytes, frame->length, readPacket) == ERR){
+		fprintf(stderr, "Error of reading the paket\n");
+		return ERR;
+	}
+
+	//Each data part comes with its checksum once agreed in hello, the
+	//checksum of a store is the one of the whole file
+	if(conn->checksum != CHECKSUM_NONE &&
+	   (readPacket->packet_header.command == DATA_DELIVERY ||
+	    readPacket->packet_header.command == DATA_STORE) &&
+	   !(readPacket->packet_header.flags & FLAG_CHECKSUM)){
+		fprintf(stderr, "Error of data part without checksum\n");
+		return ERR;
+	}
+	if((readPacket->packet_header.flags & FLAG_CHECKSUM) &&
+	   readPacket->packet_header.command != DATA_STORE){
+		if(conn->checksum != CHECKSUM_CRC32C ||
+		   crc32c(0, readPacket->packet_data, 
+			  readPacket->data_length) != readPacket->checksum){
+			fprintf(stderr, "Error of checksum of data part\n");
+			return ERR;
+		}
+	}
+
+	//The data part is decompressed before being handled, only with
+	//the algorithm agreed in hello
+	if(readPacket->packet_header.flags & FLAG_COMPRESSED){
+		if(conn->compression != COMPRESSION_LZ4 ||
+		   readPacket->raw_length > MAX_DATA_SIZE_EXTENDED){
+			fprintf(stderr, "Error of compressed data part\n");
+			return ERR;
+		}
+		if(conn->rawBuffer == NULL){
+			conn->rawBuffer = calloc(MAX_DATA_SIZE_EXTENDED,
+						 sizeof(unsigned char));
+		}
+		int rawLength = lz4_decompress(readPacket->packet_data,
+					       readPacket->data_length,
+					       conn->rawBuffer,
+					       readPacket->raw_length);
+		if(rawLength == ERR || 
+		   (unsigned int)(rawLength) != readPacket->raw_length){
+			fprintf(stderr, "Error of decompressing data part\n");
+			return ERR;
+		}
+		readPacket->packet_data = conn->rawBuffer;
+		readPacket->data_length = rawLength;
+	}
+
+	return OK;
+}
+
+/*
+ * Setting the size of the biggest data delivery kept whole in the receive
+ * buffer (at least a frame of VERSION), the rest of a bigger one goes to
+ * the upload as it is read
+ */
+void set_frame_limit(unsigned int numBytes)
+{
+	frameLimit = (numBytes > MAX_FRAME_SIZE) ? numBytes : MAX_FRAME_SIZE;
+}
+
+/*
+ * Initialization of a new connection context for a non-blocking socket
+ */
+Connection * init_connection(int fd, int init_state)
+{
+	Connection *new_connection = calloc(1, sizeof(Connection));
+
+	new_connection->fd = fd;
+	new_connection->current_state = init_state;
+	new_connection->quickAck = 0;
+	new_connection->version = VERSION;
+	new_connection->lastSequence = 0;
+	new_connection->storedSequence = 0;
+	new_connection->ackPending = 0;
+	new_connection->upload = NULL;
+	new_connection->transfer = NULL;
+	new_connection->transferStored = 0;
+	new_connection->dedup = NULL;
+
+	new_connection->decoder = init_frame_decoder();
+	new_connection->compression = COMPRESSION_NONE;
+	new_connection->rawBuffer = NULL;
+	new_connection->checksum = CHECKSUM_NONE;
+
+	new_connection->spliceRemaining = 0;
+	new_connection->spliceOffset = 0;
+	new_connection->pipe_fds[0] = -1;
+	new_connection->pipe_fds[1] = -1;
+
+	new_connection->sendBuffer = NULL;
+	new_connection->sendLength = 0;
+	new_connection->sendCapacity = 0;
+
+	metrics_connection_opened();
+	return new_connection;
+}
+
+/*
+ * Free-ing connection context including its buffers, the socket is closed
+ */
+void free_connection(Connection *connToFree)
+{
+	metrics_connection_closed();
+	close(connToFree->fd);
+	//An upload not stored yet is given up, or kept to be resumed
+	if(connToFree->upload != NULL){
+		upload_release(connToFree->upload);
+	}
+	if(connToFree->transfer != NULL){
+		detach_transfer(connToFree->transfer, 
+				connToFree->transferStored);
+	}
+	if(connToFree->dedup != NULL){
+		free_dedup_upload(connToFree->dedup);
+	}
+	free_frame_decoder(connToFree->decoder);
+	if(connToFree->rawBuffer != NULL){
+		free(connToFree->rawBuffer);
+	}
+	if(connToFree->pipe_fds[0] >= 0){
+		close(connToFree->pipe_fds[0]);
+		close(connToFree->pipe_fds[1]);
+	}
+	if(connToFree->sendBuffer != NULL){
+		free(connToFree->sendBuffer);
+	}
+	free(connToFree);
+}
+
+/*
+ * Reading once from the socket into the free space of receive buffer
+ *
+ * Returns the number of bytes read, 0 if the socket has nothing more for now
+ * or ERR if the client is gone
+ */
+int connection_receive(Connection *conn)
+{
+	//Reading as much as the socket has, up to a whole read chunk
+	unsigned int freeBytes;
+	unsigned char *space = decoder_space(conn->decoder, &freeBytes);
+
+	ssize_t numReadBytes;
+	do{
+		numReadBytes = read(conn->fd, space, freeBytes);
+	}while(numReadBytes < 0 && errno == EINTR);
+
+	if(numReadBytes < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return 0;
+		}
+		fprintf(stderr, "Error of reading from a client\n");
+		return ERR;
+	}
+
+	//Client closed the connection
+	if(numReadBytes == 0){
+		return ERR;
+	}
+
+	if(conn->quickAck){
+		set_quickack(conn->fd);
+	}
+	decoder_commit(conn->decoder, numReadBytes);
+	return numReadBytes;
+}
+
+/*
+ * Copying bytes already received from the socket (io_uring backend) into
+ * the free space of receive buffer
+ *
+ * Returns the number of bytes taken, which may be less than given if
+ * the packets already buffered have to be handled first
+ */
+unsigned int connection_receive_bytes(Connection *conn,
+				      const unsigned char *bytes,
+				      unsigned int numBytes)
+{
+	return decoder_consume(conn->decoder, bytes, numBytes);
+}
+
+/*
+ * Interpretating in place the next whole packet found in the receive buffer,
+ * the view is valid until the next reception, a data part is checked
+ * against its checksum then given decompressed
+ *
+ * Returns OK with a packet, NEED_MORE_BYTES if the packet is not
+ * complete yet or ERR if the bytes are not a valid packet
+ */
+int connection_next_packet(Connection *conn, PacketView *readPacket)
+{
+	Frame frame;
+	int status_decode = decoder_next_frame(conn->decoder, &frame);
+	if(status_decode != OK){
+		return status_decode;
+	}
+	return interpret_frame(conn, &frame, readPacket);
+}
+
+/*
+ * Interpretating in place the next whole packet found at the beginning of
+ * bytes received outside the receive buffer (io_uring backend), as long
+ * as the receive buffer is empty, the view is valid as long as the bytes
+ *
+ * Returns OK with a packet and the number of bytes it takes,
+ * NEED_MORE_BYTES if the bytes don't hold a whole packet or some are
+ * buffered before them, or ERR if the bytes are not a valid packet
+ */
+int connection_packet_in(Connection *conn, const unsigned char *bytes,
+			 unsigned int numBytes, PacketView *readPacket,
+			 unsigned int *packetLength)
+{
+	if(conn->decoder->end > conn->decoder->start){
+		return NEED_MORE_BYTES;
+	}
+
+	Frame frame;
+	int status_decode = next_frame_in(bytes, numBytes, &frame);
+	if(status_decode != OK){
+		return status_decode;
+	}
+	*packetLength = frame.length;
+	return interpret_frame(conn, &frame, readPacket);
+}
+
+/*
+ * Taking in place the beginning of an incomplete DATA DELIVERY packet whose
+ * rest of data part is big enough to be moved straight from the socket
+ * to the upload (splice, if asked), or too big to be buffered whole
+ *
+ * Returns OK with the buffered part of the packet, NEED_MORE_BYTES if
+ * the packet is not worth it or ERR if the bytes are not a valid packet
+ */
+int connection_take_partial_packet(Connection *conn, PacketView *readPacket,
+				   int splicing)
+{
+	FrameDecoder *decoder = conn->decoder;
+	unsigned int numBufferedBytes = decoder->end - decoder->start;
+
+	unsigned char *packetStart = decoder->buffer + decoder->start;
+	if(numBufferedBytes < 1 || 
+	   numBufferedBytes < header_size(packetStart[0])){
+		return NEED_MORE_BYTES;
+	}
+	Header readHeader;
+	if(parse_header(packetStart, &readHeader) == ERR){
+		return ERR;
+	}
+	//The position of the data part is needed as well, a compressed or
+	//checked one has to be read in memory
+	if(readHeader.command != DATA_DELIVERY ||
+	   (readHeader.flags & (FLAG_COMPRESSED | FLAG_CHECKSUM)) ||
+	   numBufferedBytes < prefix_size(&readHeader)){
+		return NEED_MORE_BYTES;
+	}
+	if(readHeader.length <= frameLimit &&
+	   (!splicing || 
+	    readHeader.length - numBufferedBytes < SPLICE_MIN_SIZE)){
+		return NEED_MORE_BYTES;
+	}
+
+	Frame frame;
+	if(decoder_take_partial(decoder, &frame) != OK ||
+	   read_packet_prefix(frame.bytes, frame.length, readPacket) == ERR){
+		return ERR;
+	}
+	conn->spliceRemaining = readHeader.length - frame.length;
+
+	return OK;
+}
+
+/*
+ * Moving the rest of the current data part straight from the socket 
+ * to the upload
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone
+ */
+int connection_splice(Connection *conn)
+{
+	if(conn->upload == NULL && conn->transfer == NULL){
+		return ERR;
+	}
+
+	//The pipe is created the first time, as big as allowed
+	if(conn->pipe_fds[0] < 0){
+		if(pipe2(conn->pipe_fds, O_CLOEXEC) < 0){
+			fprintf(stderr, "Error of creating a pipe\n");
+			conn->pipe_fds[0] = -1;
+			return ERR;
+		}
+		fcntl(conn->pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+	}
+
+	unsigned int maxBytes = conn->spliceRemaining;
+	if(maxBytes > SPLICE_PIPE_SIZE){
+		maxBytes = SPLICE_PIPE_SIZE;
+	}
+
+	//The ranges of a transfer are written at their position
+	int numMovedBytes;
+	if(conn->transfer != NULL){
+		numMovedBytes = upload_splice_at(conn->transfer->upload, 
+						 conn->fd, conn->pipe_fds, 
+						 maxBytes, 
+						 &(conn->spliceOffset));
+	}else{
+		numMovedBytes = upload_splice(conn->upload, conn->fd, 
+					      conn->pipe_fds, maxBytes);
+	}
+	if(numMovedBytes > 0){
+		conn->spliceRemaining -= numMovedBytes;
+	}
+	return numMovedBytes;
+}
+
+/*
+ * Reading the rest of the current data part from the socket and copying
+ * it to the upload, through the receive buffer
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone or the file can't be written
+ */
+int connection_stream(Connection *conn)
+{
+	//The receive buffer holds nothing else meanwhile, the bytes of
+	//the next packet are only read after the data part
+	unsigned int freeBytes;
+	unsigned char *space = decoder_space(conn->decoder, &freeBytes);
+	if(freeBytes > conn->spliceRemaining){
+		freeBytes = conn->spliceRemaining;
+	}
+
+	ssize_t numReadBytes;
+	do{
+		numReadBytes = read(conn->fd, space, freeBytes);
+	}while(numReadBytes < 0 && errno == EINTR);
+
+	if(numReadBytes < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return 0;
+		}
+		fprintf(stderr, "Error of reading from a client\n");
+		return ERR;
+	}
+
+	//Client closed the connection
+	if(numReadBytes == 0){
+		return ERR;
+	}
+
+	if(conn->quickAck){
+		set_quickack(conn->fd);
+	}
+	return connection_stream_bytes(conn, space, 
+				       (unsigned int)(numReadBytes));
+}
+
+/*
+ * Copying to the upload the bytes of the rest of the current data part
+ * found at the beginning of the given ones (io_uring backend)
+ *
+ * Returns the number of bytes taken, or ERR if the file can't be written
+ */
+int connection_stream_bytes(Connection *conn, const unsigned char *bytes,
+			    unsigned int numBytes)
+{
+	if(numBytes > conn->spliceRemaining){
+		numBytes = conn->spliceRemaining;
+	}
+
+	//The ranges of a transfer are written at their position
+	int status;
+	if(conn->transfer != NULL){
+		status = upload_write_at(conn->transfer->upload, bytes, 
+					 numBytes, conn->spliceOffset);
+		conn->spliceOffset += numBytes;
+	}else if(conn->upload != NULL){
+		status = upload_append(conn->upload, bytes, numBytes);
+	}else{
+		status = ERR;
+	}
+	if(status == ERR){
+		return ERR;
+	}
+
+	conn->spliceRemaining -= numBytes;
+	return (int)(numBytes);
+}
+
+/*
+ * Queuing bytes to be sent to the client, then trying to send them
+ */
+int connection_send(Connection *conn, const unsigned char *bytes,
+		    unsigned int numBytes)
+{
+	if(conn->sendLength + numBytes > conn->sendCapacity){
+		conn->sendCapacity = conn->sendLength + numBytes;
+		conn->sendBuffer = realloc(conn->sendBuffer,
+					   conn->sendCapacity*
+					   sizeof(unsigned char));
+	}
+	memcpy(conn->sendBuffer + conn->sendLength, bytes, numBytes);
+	conn->sendLength += numBytes;
+
+	return connection_flush(conn);
+}
+
+/*
+ * Sending as many queued bytes as the socket accepts
+ */
+int connection_flush(Connection *conn)
+{
+	unsigned int numSentBytes = 0;
+
+	while(numSentBytes < conn->sendLength){
+		ssize_t numWrittenBytes = write(conn->fd,
+						conn->sendBuffer + numSentBytes,
+						conn->sendLength - numSentBytes);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			//The rest is sent once the socket is writable again
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}
+			fprintf(stderr, "Error of writing to a client\n");
+			return ERR;
+		}
+		numSentBytes += numWrittenBytes;
+	}
+
+	//Nothing to move if nothing was sent (the buffer may not even be
+	//allocated yet)
+	if(numSentBytes > 0){
+		memmove(conn->sendBuffer, conn->sendBuffer + numSentBytes,
+			conn->sendLength - numSentBytes);
+		conn->sendLength -= numSentBytes;
+	}
+
+	return OK;
+}
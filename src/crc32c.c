@@ -0,0 +1,299 @@
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+//Tables of the software implementation, a byte followed by 0 to 7 bytes
+static uint32_t sliceTables[8][256];
+
+//Tables moving a CRC forward over a block of zeros, for the 3 streams
+//of the hardware implementation to be put together
+static uint32_t longShiftTables[4][256];
+static uint32_t shortShiftTables[4][256];
+
+//Operators moving a CRC forward over 2^n bytes of zeros, to combine
+//the CRCs of blocks of any length
+static uint32_t zeroOperators[64][32];
+
+static uint32_t (*crc32c_function)(uint32_t crc, const unsigned char *data,
+				   size_t length);
+static const char *implementationName;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * Multiplying a vector by a matrix over GF(2)
+ */
+static uint32_t gf2_matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+	uint32_t sum = 0;
+	while(vector != 0){
+		if(vector & 1){
+			sum ^= *matrix;
+		}
+		vector >>= 1;
+		matrix++;
+	}
+	return sum;
+}
+
+/*
+ * Squaring a matrix over GF(2)
+ */
+static void gf2_matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+	int n;
+	for(n=0; n<32; n++){
+		square[n] = gf2_matrix_times(matrix, matrix[n]);
+	}
+}
+
+/*
+ * Building the operators moving a CRC forward over 2^n bytes of zeros
+ */
+static void build_zero_operators(void)
+{
+	uint32_t operator[32];
+	uint32_t square[32];
+	int n;
+
+	//Operator for one bit of zero, squared 3 times for one byte
+	operator[0] = CRC32C_POLYNOMIAL;
+	for(n=1; n<32; n++){
+		operator[n] = (uint32_t)(1) << (n-1);
+	}
+	gf2_matrix_square(square, operator);
+	gf2_matrix_square(operator, square);
+	gf2_matrix_square(zeroOperators[0], operator);
+
+	for(n=1; n<64; n++){
+		gf2_matrix_square(zeroOperators[n], zeroOperators[n-1]);
+	}
+}
+
+/*
+ * Building the tables moving a CRC forward over length bytes of zeros,
+ * the length is a power of 2
+ */
+static void build_shift_tables(uint32_t tables[4][256], size_t length)
+{
+	uint32_t even[32];
+	uint32_t odd[32];
+	int n;
+
+	//Operator for one bit of zero, then squared up to the length
+	odd[0] = CRC32C_POLYNOMIAL;
+	for(n=1; n<32; n++){
+		odd[n] = (uint32_t)(1) << (n-1);
+	}
+	gf2_matrix_square(even, odd); //2 bits
+	gf2_matrix_square(odd, even); //4 bits
+
+	uint32_t *operator = odd;
+	while(length > 0){
+		gf2_matrix_square(even, odd); //1 byte, 4 bytes...
+		operator = even;
+		length >>= 1;
+		if(length == 0){
+			break;
+		}
+		gf2_matrix_square(odd, even); //2 bytes, 8 bytes...
+		operator = odd;
+		length >>= 1;
+	}
+
+	for(n=0; n<256; n++){
+		tables[0][n] = gf2_matrix_times(operator, n);
+		tables[1][n] = gf2_matrix_times(operator, n << 8);
+		tables[2][n] = gf2_matrix_times(operator, n << 16);
+		tables[3][n] = gf2_matrix_times(operator, (uint32_t)(n) << 24);
+	}
+}
+
+/*
+ * Moving a CRC forward over a block of zeros
+ */
+static uint32_t shift_crc(uint32_t tables[4][256], uint32_t crc)
+{
+	return tables[0][crc & 0xFF] ^ tables[1][(crc >> 8) & 0xFF] ^
+		tables[2][(crc >> 16) & 0xFF] ^ tables[3][crc >> 24];
+}
+
+/*
+ * CRC32C computed by tables, 8 bytes at a time (slicing-by-8, on a little
+ * endian processor)
+ */
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *data,
+				size_t length)
+{
+	crc = ~crc;
+
+	while(length > 0 && ((uintptr_t)(data) & 7) != 0){
+		crc = sliceTables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+
+	while(length >= 8){
+		uint64_t word;
+		memcpy(&word, data, sizeof(uint64_t));
+		word ^= crc;
+		crc = sliceTables[7][word & 0xFF] ^
+			sliceTables[6][(word >> 8) & 0xFF] ^
+			sliceTables[5][(word >> 16) & 0xFF] ^
+			sliceTables[4][(word >> 24) & 0xFF] ^
+			sliceTables[3][(word >> 32) & 0xFF] ^
+			sliceTables[2][(word >> 40) & 0xFF] ^
+			sliceTables[1][(word >> 48) & 0xFF] ^
+			sliceTables[0][word >> 56];
+		data += 8;
+		length -= 8;
+	}
+
+	while(length > 0){
+		crc = sliceTables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * CRC32C computed by the SSE4.2 instruction, over 3 streams at once
+ * to hide its latency, put together by shifting them over their blocks
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *data,
+				size_t length)
+{
+	uint64_t crc0 = (uint32_t)(~crc);
+
+	while(length > 0 && ((uintptr_t)(data) & 7) != 0){
+		crc0 = _mm_crc32_u8((uint32_t)(crc0), *data++);
+		length--;
+	}
+
+	const size_t blockSizes[2] = {CRC32C_LONG_BLOCK, CRC32C_SHORT_BLOCK};
+	uint32_t (*shiftTables[2])[256] = {longShiftTables, shortShiftTables};
+	int i;
+	for(i=0; i<2; i++){
+		size_t blockSize = blockSizes[i];
+		while(length >= 3*blockSize){
+			uint64_t crc1 = 0;
+			uint64_t crc2 = 0;
+			const unsigned char *end = data + blockSize;
+			do{
+				uint64_t words[3];
+				memcpy(&words[0], data, sizeof(uint64_t));
+				memcpy(&words[1], data + blockSize, 
+				       sizeof(uint64_t));
+				memcpy(&words[2], data + 2*blockSize, 
+				       sizeof(uint64_t));
+				crc0 = _mm_crc32_u64(crc0, words[0]);
+				crc1 = _mm_crc32_u64(crc1, words[1]);
+				crc2 = _mm_crc32_u64(crc2, words[2]);
+				data += 8;
+			}while(data < end);
+			crc0 = shift_crc(shiftTables[i], (uint32_t)(crc0)) ^ 
+				crc1;
+			crc0 = shift_crc(shiftTables[i], (uint32_t)(crc0)) ^ 
+				crc2;
+			data += 2*blockSize;
+			length -= 3*blockSize;
+		}
+	}
+
+	while(length >= 8){
+		uint64_t word;
+		memcpy(&word, data, sizeof(uint64_t));
+		crc0 = _mm_crc32_u64(crc0, word);
+		data += 8;
+		length -= 8;
+	}
+	while(length > 0){
+		crc0 = _mm_crc32_u8((uint32_t)(crc0), *data++);
+		length--;
+	}
+
+	return ~(uint32_t)(crc0);
+}
+#endif
+
+/*
+ * Building the tables and choosing the implementation, once
+ */
+static void crc32c_init(void)
+{
+	uint32_t n;
+	int k;
+	for(n=0; n<256; n++){
+		uint32_t crc = n;
+		for(k=0; k<8; k++){
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : 
+				crc >> 1;
+		}
+		sliceTables[0][n] = crc;
+	}
+	for(n=0; n<256; n++){
+		uint32_t crc = sliceTables[0][n];
+		for(k=1; k<8; k++){
+			crc = sliceTables[0][crc & 0xFF] ^ (crc >> 8);
+			sliceTables[k][n] = crc;
+		}
+	}
+
+	build_zero_operators();
+
+	crc32c_function = crc32c_software;
+	implementationName = "slicing-by-8";
+#if defined(__x86_64__)
+	if(__builtin_cpu_supports("sse4.2")){
+		build_shift_tables(longShiftTables, CRC32C_LONG_BLOCK);
+		build_shift_tables(shortShiftTables, CRC32C_SHORT_BLOCK);
+		crc32c_function = crc32c_hardware;
+		implementationName = "sse4.2";
+	}
+#endif
+}
+
+/*
+ * Adding some bytes to a CRC32C, starting from 0 for the first bytes,
+ * computed by the SSE4.2 instruction when the processor has it or by
+ * tables 8 bytes at a time otherwise (chosen at the first call)
+ */
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t length)
+{
+	pthread_once(&initOnce, crc32c_init);
+	return crc32c_function(crc, data, length);
+}
+
+/*
+ * CRC32C of two blocks put one after the other, from the CRC32C of each
+ * block and the length of the second one, without reading them again
+ */
+uint32_t crc32c_combine(uint32_t firstCrc, uint32_t secondCrc, 
+			uint64_t secondLength)
+{
+	pthread_once(&initOnce, crc32c_init);
+
+	int n;
+	for(n=0; secondLength != 0; n++){
+		if(secondLength & 1){
+			firstCrc = gf2_matrix_times(zeroOperators[n], firstCrc);
+		}
+		secondLength >>= 1;
+	}
+
+	return firstCrc ^ secondCrc;
+}
+
+/*
+ * Name of the implementation chosen for this processor
+ */
+const char * crc32c_implementation(void)
+{
+	pthread_once(&initOnce, crc32c_init);
+	return implementationName;
+}
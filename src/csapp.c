@@ -572,6 +572,52 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - robustly write all the bytes of several buffers (unbuffered),
+ *    the iovec array is consumed as the bytes are written
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t n = 0;
+	ssize_t nwritten;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		n += iov[i].iov_len;
+
+	while (1) {
+		/* skip the buffers fully written */
+		while (iovcnt > 0 && iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt == 0)
+			break;
+
+		if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+			if (errno == EINTR)  /* interrupted by sig handler return */
+				nwritten = 0;    /* and call writev() again */
+			else
+				return -1;       /* errno set by writev() */
+		}
+		/* consume the written bytes from the buffers */
+		for (i = 0; nwritten > 0; i++) {
+			if ((size_t)(nwritten) >= iov[i].iov_len) {
+				nwritten -= iov[i].iov_len;
+				iov[i].iov_len = 0;
+			}
+			else {
+				iov[i].iov_base = (char *)(iov[i].iov_base) + nwritten;
+				iov[i].iov_len -= nwritten;
+				nwritten = 0;
+			}
+		}
+	}
+	return n;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -693,6 +739,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 		unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	if (rio_writev(fd, iov, iovcnt) < 0)
+		unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
 	rio_readinitb(rp, fd);
@@ -0,0 +1,207 @@
+#include <unistd.h>
+
+#include "dedup.h"
+
+#define INITIAL_REQUESTED_SIZE 1024 //initial size of the set of chunks asked
+
+/*
+ * Position in the set of the chunks asked to the client where the given
+ * digest is, or would be added
+ */
+static unsigned int find_requested(const DedupUpload *dedup, 
+				   const unsigned char *digest)
+{
+	//The digest is already spread enough to be used as a hash
+	unsigned int position = ((unsigned int)(digest[0]) << 24 | 
+				 (unsigned int)(digest[1]) << 16 |
+				 (unsigned int)(digest[2]) << 8 | digest[3]) & 
+		(dedup->requestedSize - 1);
+
+	while(dedup->requested[position] != 0 && 
+	      memcmp(dedup->entries[dedup->requested[position]-1].digest,
+		     digest, DIGEST_SIZE) != 0){
+		position = (position + 1) & (dedup->requestedSize - 1);
+	}
+	return position;
+}
+
+/*
+ * Adding a chunk to the set of the chunks asked to the client, the set
+ * is twice as big once half full
+ */
+static void add_requested(DedupUpload *dedup, unsigned int index)
+{
+	if(2*(dedup->numMissing + 1) > dedup->requestedSize){
+		unsigned int *oldRequested = dedup->requested;
+		unsigned int oldSize = dedup->requestedSize;
+
+		dedup->requestedSize *= 2;
+		dedup->requested = calloc(dedup->requestedSize, 
+					  sizeof(unsigned int));
+		unsigned int i;
+		for(i=0; i<oldSize; i++){
+			if(oldRequested[i] != 0){
+				dedup->requested[find_requested(dedup,
+					dedup->entries[oldRequested[i]-1].digest)] =
+					oldRequested[i];
+			}
+		}
+		free(oldRequested);
+	}
+
+	dedup->requested[find_requested(dedup, dedup->entries[index].digest)] =
+		index + 1;
+}
+
+/*
+ * Initialization of a new upload sent as a list of chunks
+ */
+DedupUpload * init_dedup_upload(void)
+{
+	DedupUpload *new_dedup = calloc(1, sizeof(DedupUpload));
+
+	new_dedup->entries = NULL;
+	new_dedup->numEntries = 0;
+	new_dedup->capacity = 0;
+
+	new_dedup->missing = NULL;
+	new_dedup->numMissing = 0;
+	new_dedup->nextMissing = 0;
+
+	new_dedup->requestedSize = INITIAL_REQUESTED_SIZE;
+	new_dedup->requested = calloc(new_dedup->requestedSize, 
+				      sizeof(unsigned int));
+
+	return new_dedup;
+}
+
+/*
+ * Free-ing upload data structure including its lists
+ */
+void free_dedup_upload(DedupUpload *dedupToFree)
+{
+	free(dedupToFree->entries);
+	free(dedupToFree->missing);
+	free(dedupToFree->requested);
+	free(dedupToFree);
+}
+
+/*
+ * Adding the next chunks of the file given in a chunk list, one bit per
+ * chunk is set in the bitmap given by the caller if the chunk is missing
+ *
+ * Returns ERR if the list is invalid, OK otherwise
+ */
+int dedup_add_list(DedupUpload *dedup, const unsigned char *listBytes,
+		   unsigned int listLength, unsigned char *needBitmap)
+{
+	if(listLength % CHUNK_ENTRY_SIZE != 0){
+		fprintf(stderr, "Chunk list is invalid\n");
+		return ERR;
+	}
+	unsigned int numListed = listLength / CHUNK_ENTRY_SIZE;
+	memset(needBitmap, 0, (numListed + 7)/8);
+
+	//Room for all the chunks of the list at once
+	if(dedup->numEntries + numListed > dedup->capacity){
+		dedup->capacity = 2*(dedup->numEntries + numListed);
+		dedup->entries = realloc(dedup->entries, 
+					 dedup->capacity*sizeof(ChunkEntry));
+		dedup->missing = realloc(dedup->missing,
+					 dedup->capacity*sizeof(unsigned int));
+	}
+
+	unsigned int i;
+	for(i=0; i<numListed; i++){
+		unsigned int index = dedup->numEntries;
+		ChunkEntry *entry = &(dedup->entries[index]);
+		read_chunk_entry(listBytes + i*CHUNK_ENTRY_SIZE, entry);
+		if(entry->length == 0 || entry->length > MAX_CHUNK_SIZE){
+			fprintf(stderr, "Chunk list is invalid\n");
+			return ERR;
+		}
+		dedup->numEntries++;
+
+		//Each missing chunk is asked once
+		if(dedup->requested[find_requested(dedup, entry->digest)] != 0 ||
+		   chunk_store_has(entry->digest)){
+			continue;
+		}
+		add_requested(dedup, index);
+		dedup->missing[dedup->numMissing++] = index;
+		needBitmap[i/8] |= (unsigned char)(1 << (i%8));
+	}
+
+	return OK;
+}
+
+/*
+ * Storing the next missing chunk received from the client
+ *
+ * Returns ERR if it is not the chunk expected, OK otherwise
+ */
+int dedup_put_chunk(DedupUpload *dedup, const unsigned char *data,
+		    unsigned int dataLength)
+{
+	if(dedup->nextMissing >= dedup->numMissing){
+		fprintf(stderr, "Chunk received but not asked\n");
+		return ERR;
+	}
+
+	ChunkEntry *entry = &(dedup->entries[dedup->missing[dedup->nextMissing]]);
+	if(dataLength != entry->length){
+		fprintf(stderr, "Chunk received of wrong length\n");
+		return ERR;
+	}
+	if(chunk_store_put(entry->digest, data, dataLength) == ERR){
+		return ERR;
+	}
+	dedup->nextMissing++;
+
+	return OK;
+}
+
+/*
+ * Building the file from the chunks in the store, once all the missing
+ * ones are received, next to the given final name and checked against its
+ * CRC32C if given
+ *
+ * Returns NULL if the file can't be built or is not the one sent
+ */
+Upload * dedup_assemble(DedupUpload *dedup, const char *targetName,
+			unsigned int windowSize, const uint32_t *fileChecksum)
+{
+	if(dedup->nextMissing != dedup->numMissing){
+		fprintf(stderr, "Chunks still missing\n");
+		return NULL;
+	}
+
+	Upload *upload = init_upload(targetName, windowSize);
+	if(upload == NULL){
+		return NULL;
+	}
+
+	unsigned int i;
+	for(i=0; i<dedup->numEntries; i++){
+		int chunk_fd = chunk_store_open(dedup->entries[i].digest);
+		if(chunk_fd == ERR){
+			upload_abort(upload);
+			return NULL;
+		}
+		int status_append = upload_append_file(upload, chunk_fd, 
+						       dedup->entries[i].length);
+		close(chunk_fd);
+		if(status_append == ERR){
+			upload_abort(upload);
+			return NULL;
+		}
+	}
+
+	if(fileChecksum != NULL && 
+	   upload_verify(upload, *fileChecksum) == ERR){
+		upload_abort(upload);
+		return NULL;
+	}
+
+	return upload;
+}
@@ -0,0 +1,227 @@
+#include "frame_decoder.h"
+
+/*
+ * Moving the beginning of the incomplete frame to the front of the buffer
+ */
+static void move_to_front(FrameDecoder *decoder)
+{
+	memmove(decoder->buffer, decoder->buffer + decoder->start,
+		decoder->end - decoder->start);
+	decoder->end -= decoder->start;
+	decoder->start = 0;
+}
+
+/*
+ * Giving the buffer a new size, the buffered bytes at its front
+ */
+static void resize_buffer(FrameDecoder *decoder, unsigned int capacity)
+{
+	move_to_front(decoder);
+	decoder->capacity = capacity;
+	decoder->buffer = realloc(decoder->buffer, 
+				  decoder->capacity*sizeof(unsigned char));
+}
+
+/*
+ * Initialization of a new decoder with an empty buffer big enough for
+ * one incomplete frame (VERSION) followed by a whole read chunk
+ */
+FrameDecoder * init_frame_decoder(void)
+{
+	FrameDecoder *new_decoder = calloc(1, sizeof(FrameDecoder));
+
+	new_decoder->capacity = DECODER_BUFFER_SIZE;
+	new_decoder->buffer = calloc(new_decoder->capacity,
+				     sizeof(unsigned char));
+	new_decoder->start = 0;
+	new_decoder->end = 0;
+	new_decoder->pendingLength = 0;
+
+	return new_decoder;
+}
+
+/*
+ * Free-ing decoder data structure including its buffer
+ */
+void free_frame_decoder(FrameDecoder *decoderToFree)
+{
+	free(decoderToFree->buffer);
+	free(decoderToFree);
+}
+
+/*
+ * Giving the free space where the next bytes of the stream can be read to,
+ * the frames handed out before are no longer valid after this call, the
+ * buffer grows only once filled by the bytes of a big frame, and shrinks
+ * back once that frame is handed out
+ */
+unsigned char * decoder_space(FrameDecoder *decoder, unsigned int *freeBytes)
+{
+	//A big frame has been handed out, the buffer goes back to its
+	//first size unless the next frame is a big one as well
+	if(decoder->capacity > DECODER_BUFFER_SIZE &&
+	   decoder->end - decoder->start <= MAX_FRAME_SIZE &&
+	   decoder->pendingLength <= MAX_FRAME_SIZE){
+		resize_buffer(decoder, DECODER_BUFFER_SIZE);
+	}
+
+	//Once the whole frames are handed out, only the beginning of
+	//an incomplete frame is left, we move it to the front
+	if(decoder->start > 0 &&
+	   decoder->capacity - decoder->end < READ_CHUNK_SIZE){
+		move_to_front(decoder);
+	}
+
+	//The buffer is full of a big frame, it grows by steps so that a
+	//header alone holds no memory, up to the whole frame and a read
+	//chunk after it
+	if(decoder->capacity - decoder->end < READ_CHUNK_SIZE &&
+	   decoder->pendingLength + READ_CHUNK_SIZE > decoder->capacity){
+		unsigned int capacity = 2*decoder->capacity;
+		if(capacity > decoder->pendingLength + READ_CHUNK_SIZE){
+			capacity = decoder->pendingLength + READ_CHUNK_SIZE;
+		}
+		resize_buffer(decoder, capacity);
+	}
+
+	*freeBytes = decoder->capacity - decoder->end;
+	return decoder->buffer + decoder->end;
+}
+
+/*
+ * Adding to the buffered bytes the ones just read into the free space
+ */
+void decoder_commit(FrameDecoder *decoder, unsigned int numBytes)
+{
+	decoder->end += numBytes;
+}
+
+/*
+ * Copying a chunk of bytes of any size into the decoder
+ *
+ * Returns the number of bytes taken, which may be less than given if
+ * the frames already buffered have to be handed out first
+ */
+unsigned int decoder_consume(FrameDecoder *decoder,
+			     const unsigned char *chunk, unsigned int numBytes)
+{
+	unsigned int freeBytes;
+	unsigned char *space = decoder_space(decoder, &freeBytes);
+
+	if(numBytes > freeBytes){
+		numBytes = freeBytes;
+	}
+	memcpy(space, chunk, numBytes);
+	decoder_commit(decoder, numBytes);
+
+	return numBytes;
+}
+
+/*
+ * Cutting the next whole frame out of bytes kept outside any decoder
+ *
+ * Returns OK with a frame, NEED_MORE_BYTES if the frame is not complete
+ * yet (with its length once its header is whole, 0 before) or ERR if the
+ * header is invalid
+ */
+int next_frame_in(const unsigned char *bytes, unsigned int numBytes,
+		  Frame *frame)
+{
+	frame->bytes = bytes;
+	frame->length = 0;
+
+	//Waiting for the header first, its size depends on its version
+	if(numBytes < 1){
+		return NEED_MORE_BYTES;
+	}
+	unsigned int headerSize = header_size(bytes[0]);
+	if(headerSize == 0){
+		fprintf(stderr, "Error of reading frame header\n");
+		return ERR;
+	}
+	if(numBytes < headerSize){
+		return NEED_MORE_BYTES;
+	}
+
+	//Accessing the length of frame found in the header
+	Header readHeader;
+	if(parse_header(bytes, &readHeader) == ERR){
+		fprintf(stderr, "Error of reading frame header\n");
+		return ERR;
+	}
+	frame->length = readHeader.length;
+
+	if(frame->length < headerSize){
+		fprintf(stderr, "Error of read frame length\n");
+		return ERR;
+	}
+
+	//Waiting for the data part
+	if(numBytes < frame->length){
+		return NEED_MORE_BYTES;
+	}
+	return OK;
+}
+
+/*
+ * Handing out the next whole frame found in the buffered bytes, valid
+ * until the next call to the decoder
+ *
+ * Returns OK with a frame, NEED_MORE_BYTES if the frame is not
+ * complete yet or ERR if the header is invalid
+ */
+int decoder_next_frame(FrameDecoder *decoder, Frame *frame)
+{
+	int status = next_frame_in(decoder->buffer + decoder->start,
+				   decoder->end - decoder->start, frame);
+
+	//The buffer makes room for the data part as it comes
+	decoder->pendingLength = (status == NEED_MORE_BYTES) ? 
+		frame->length : 0;
+	if(status != OK){
+		return status;
+	}
+	decoder->start += frame->length;
+
+	//Nothing left, the next bytes can go to the front
+	if(decoder->start == decoder->end){
+		decoder->start = 0;
+		decoder->end = 0;
+	}
+
+	return OK;
+}
+
+/*
+ * Handing out the beginning of an incomplete frame whose header is whole,
+ * the rest of its data part is then left to the caller to be taken from 
+ * the stream
+ *
+ * Returns OK with the buffered part of the frame, NEED_MORE_BYTES if 
+ * the header is not complete yet or ERR if the header is invalid
+ */
+int decoder_take_partial(FrameDecoder *decoder, Frame *frame)
+{
+	unsigned int numBufferedBytes = decoder->end - decoder->start;
+
+	if(numBufferedBytes < 1 || 
+	   numBufferedBytes < header_size(decoder->buffer[decoder->start])){
+		return NEED_MORE_BYTES;
+	}
+
+	Header readHeader;
+	if(parse_header(decoder->buffer + decoder->start, &readHeader) == ERR){
+		fprintf(stderr, "Error of reading frame header\n");
+		return ERR;
+	}
+
+	frame->bytes = decoder->buffer + decoder->start;
+	frame->length = numBufferedBytes;
+
+	//Everything buffered is handed out, the next bytes go to the front
+	decoder->start = 0;
+	decoder->end = 0;
+	decoder->pendingLength = 0;
+
+	return OK;
+}
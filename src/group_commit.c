@@ -0,0 +1,213 @@
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/eventfd.h>
+
+#include "group_commit.h"
+
+//Uploads waiting for the next batch, in their order of arrival
+static CommitRequest *pendingFirst = NULL;
+static CommitRequest *pendingLast = NULL;
+static pthread_mutex_t pendingMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Syncing the data of all the files of a batch, with one call for the
+ * whole file system if the batch is big enough
+ */
+static void sync_batch(CommitRequest *batch, unsigned int batchSize)
+{
+	CommitRequest *request;
+
+	if(batchSize >= SYNCFS_MIN_BATCH && syncfs(batch->upload->fd) == 0){
+		return;
+	}
+
+	for(request=batch; request!=NULL; request=request->next){
+		if(fdatasync(request->upload->fd) < 0){
+			fprintf(stderr, "Error of storing an upload \
+[fdatasync()]\n");
+			request->status = ERR;
+		}
+	}
+}
+
+/*
+ * Whether two files are in the same directory
+ */
+static int same_directory(const char *fileName, const char *otherName)
+{
+	const char *slash = strrchr(fileName, '/');
+	const char *otherSlash = strrchr(otherName, '/');
+	size_t length = (slash == NULL) ? 0 : (size_t)(slash - fileName);
+	size_t otherLength = (otherSlash == NULL) ? 0 :
+		(size_t)(otherSlash - otherName);
+
+	return length == otherLength && 
+		strncmp(fileName, otherName, length) == 0;
+}
+
+/*
+ * Handing a commit done back to the event loop waiting for it
+ */
+static void hand_back(CommitRequest *request)
+{
+	CommitWaiter *waiter = request->waiter;
+
+	request->next = __atomic_load_n(&(waiter->done), __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&(waiter->done), &(request->next),
+					   request, 1, __ATOMIC_RELEASE,
+					   __ATOMIC_RELAXED)){
+	}
+
+	uint64_t one = 1;
+	while(write(waiter->eventFd, &one, sizeof(uint64_t)) < 0 &&
+	      errno == EINTR){
+	}
+}
+
+/*
+ * Entry point of the committing thread: all the uploads finished while
+ * the previous batch was synced make the next one, so that one sync
+ * covers many files when they come fast
+ */
+static void *commit_thread(void *args)
+{
+	(void)(args);
+	CommitRequest *batch;
+	CommitRequest *request;
+	CommitRequest *next;
+	unsigned int batchSize;
+
+	while(1){
+		pthread_mutex_lock(&pendingMutex);
+		while(pendingFirst == NULL){
+			pthread_cond_wait(&pendingCond, &pendingMutex);
+		}
+		batch = pendingFirst;
+		pendingFirst = NULL;
+		pendingLast = NULL;
+		pthread_mutex_unlock(&pendingMutex);
+
+		batchSize = 0;
+		for(request=batch; request!=NULL; request=request->next){
+			batchSize++;
+		}
+		sync_batch(batch, batchSize);
+
+		//The data is on the disk, the names come next, then
+		//the directories holding them
+		const char *syncedDirectoryOf = NULL;
+		for(request=batch; request!=NULL; request=request->next){
+			if(request->status == ERR){
+				upload_abort(request->upload);
+				continue;
+			}
+			request->status = upload_rename(request->upload,
+							request->targetName);
+		}
+		for(request=batch; request!=NULL; request=request->next){
+			if(request->status == ERR){
+				continue;
+			}
+			//Most of the time, the same directory for all
+			if(syncedDirectoryOf == NULL ||
+			   !same_directory(syncedDirectoryOf, 
+					   request->targetName)){
+				if(sync_directory(request->targetName) 
+				   == ERR){
+					request->status = ERR;
+					continue;
+				}
+				syncedDirectoryOf = request->targetName;
+			}
+		}
+
+		for(request=batch; request!=NULL; request=next){
+			next = request->next;
+			hand_back(request);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Starting the thread which syncs the finished uploads by batches, it runs
+ * until the process ends
+ */
+void start_group_commit(void)
+{
+	pthread_t thread;
+	Pthread_create(&thread, NULL, commit_thread, NULL);
+	Pthread_detach(thread);
+}
+
+/*
+ * Initialization of the waiter of an event loop, with its event file
+ *
+ * Returns NULL if the event file can't be created
+ */
+CommitWaiter * init_commit_waiter(void)
+{
+	CommitWaiter *new_waiter = calloc(1, sizeof(CommitWaiter));
+	new_waiter->eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(new_waiter->eventFd < 0){
+		fprintf(stderr, "Error of creating the event file of the \
+commits\n");
+		free(new_waiter);
+		return NULL;
+	}
+	new_waiter->done = NULL;
+	return new_waiter;
+}
+
+/*
+ * Free-ing the waiter of an event loop, once no commit of it is left
+ */
+void free_commit_waiter(CommitWaiter *waiter)
+{
+	close(waiter->eventFd);
+	free(waiter);
+}
+
+/*
+ * Handing a finished upload to the committing thread, the upload is its
+ * own from now on
+ */
+void queue_commit(CommitWaiter *waiter, Upload *upload,
+		  const char *targetName, void *context)
+{
+	CommitRequest *request = malloc(sizeof(CommitRequest));
+	request->upload = upload;
+	snprintf(request->targetName, MAX_NAME_SIZE, "%s", targetName);
+	request->context = context;
+	request->status = OK;
+	request->waiter = waiter;
+	request->next = NULL;
+
+	pthread_mutex_lock(&pendingMutex);
+	if(pendingLast == NULL){
+		pendingFirst = request;
+	}else{
+		pendingLast->next = request;
+	}
+	pendingLast = request;
+	pthread_cond_signal(&pendingCond);
+	pthread_mutex_unlock(&pendingMutex);
+}
+
+/*
+ * Taking all the commits done for an event loop, to be free-ed by it
+ *
+ * Returns NULL if there is none
+ */
+CommitRequest * take_done_commits(CommitWaiter *waiter)
+{
+	uint64_t numDone;
+	while(read(waiter->eventFd, &numDone, sizeof(uint64_t)) < 0 &&
+	      errno == EINTR){
+	}
+
+	return __atomic_exchange_n(&(waiter->done), NULL, __ATOMIC_ACQUIRE);
+}
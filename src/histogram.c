@@ -0,0 +1,127 @@
+#include "histogram.h"
+
+/*
+ * Index of the count of the bucket holding a value: the values below
+ * HISTOGRAM_SUB_BUCKETS have their own count, then each power of two
+ * is cut in HISTOGRAM_HALF_BUCKETS buckets
+ */
+static unsigned int counts_index(uint64_t value)
+{
+	if(value < HISTOGRAM_SUB_BUCKETS){
+		return (unsigned int)(value);
+	}
+
+	//The sub-bucket is given by the highest bits of the value
+	unsigned int bucket = 63 - __builtin_clzll(value) -
+		(HISTOGRAM_SUB_BITS - 1);
+	unsigned int subBucket = (unsigned int)(value >> bucket);
+	return (bucket + 1)*HISTOGRAM_HALF_BUCKETS +
+		(subBucket - HISTOGRAM_HALF_BUCKETS);
+}
+
+/*
+ * Highest value counted by the count at the given index
+ */
+static uint64_t highest_value(unsigned int index)
+{
+	if(index < HISTOGRAM_SUB_BUCKETS){
+		return index;
+	}
+
+	unsigned int bucket = index/HISTOGRAM_HALF_BUCKETS - 1;
+	uint64_t subBucket = index%HISTOGRAM_HALF_BUCKETS +
+		HISTOGRAM_HALF_BUCKETS;
+	return (subBucket << bucket) + ((1ULL << bucket) - 1);
+}
+
+/*
+ * Emptying a histogram
+ */
+void init_histogram(Histogram *histogram)
+{
+	memset(histogram->counts, 0, sizeof(histogram->counts));
+	histogram->totalCount = 0;
+	histogram->min = UINT64_MAX;
+	histogram->max = 0;
+	histogram->sum = 0;
+}
+
+/*
+ * Counting one value in its bucket
+ */
+void histogram_record(Histogram *histogram, uint64_t value)
+{
+	histogram->counts[counts_index(value)]++;
+	histogram->totalCount++;
+	if(value < histogram->min){
+		histogram->min = value;
+	}
+	if(value > histogram->max){
+		histogram->max = value;
+	}
+	histogram->sum += value;
+}
+
+/*
+ * Adding the values counted by a histogram to another one
+ */
+void histogram_add(Histogram *histogram, const Histogram *other)
+{
+	unsigned int i;
+	for(i=0; i<HISTOGRAM_COUNTS; i++){
+		histogram->counts[i] += other->counts[i];
+	}
+	histogram->totalCount += other->totalCount;
+	if(other->min < histogram->min){
+		histogram->min = other->min;
+	}
+	if(other->max > histogram->max){
+		histogram->max = other->max;
+	}
+	histogram->sum += other->sum;
+}
+
+/*
+ * Value below which the given percentage of the values are, given as
+ * the highest value of its bucket (0 for an empty histogram)
+ */
+uint64_t histogram_percentile(const Histogram *histogram, double percentile)
+{
+	if(histogram->totalCount == 0){
+		return 0;
+	}
+
+	//Rank of the value looked for, at least the first one
+	uint64_t rank = (uint64_t)(percentile/100.0 * histogram->totalCount
+				   + 0.5);
+	if(rank < 1){
+		rank = 1;
+	}
+	if(rank > histogram->totalCount){
+		rank = histogram->totalCount;
+	}
+
+	uint64_t numCounted = 0;
+	unsigned int i;
+	for(i=0; i<HISTOGRAM_COUNTS; i++){
+		numCounted += histogram->counts[i];
+		if(numCounted >= rank){
+			break;
+		}
+	}
+
+	//The bucket is no wider than the values really counted
+	uint64_t value = highest_value(i);
+	return (value < histogram->max) ? value : histogram->max;
+}
+
+/*
+ * Mean of the counted values (0 for an empty histogram)
+ */
+double histogram_mean(const Histogram *histogram)
+{
+	if(histogram->totalCount == 0){
+		return 0;
+	}
+	return (double)(histogram->sum / histogram->totalCount);
+}
@@ -0,0 +1,493 @@
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "io_ring.h"
+
+/*
+ * Handing the new requests to the kernel and waiting for completions
+ * (io_uring_enter), retried when interrupted
+ */
+static int enter_ring(IoRing *ring, unsigned int minComplete)
+{
+	int result;
+	do{
+		//The kernel takes the requests up to the shared tail
+		unsigned int numToSubmit = ring->sqLocalTail -
+			__atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		__atomic_store_n(ring->sqTail, ring->sqLocalTail,
+				 __ATOMIC_RELEASE);
+		result = syscall(__NR_io_uring_enter, ring->fd, numToSubmit,
+				 minComplete,
+				 (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0,
+				 NULL, 0);
+	}while(result < 0 && errno == EINTR);
+
+	//The completion queue is full, the caller has to take some first
+	if(result < 0 && (errno == EBUSY || errno == EAGAIN)){
+		return OK;
+	}
+	if(result < 0){
+		fprintf(stderr, "Error of submitting to the ring \
+[io_uring_enter()]\n");
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Taking the next completion straight from the completion queue
+ *
+ * Returns 1 with a completion, 0 if the queue is empty
+ */
+static int pop_completion(IoRing *ring, IoRingCompletion *completion)
+{
+	unsigned int head = *(ring->cqHead);
+	if(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)){
+		return 0;
+	}
+
+	struct io_uring_cqe *cqe = &(ring->cqes[head & ring->cqMask]);
+	completion->userData = cqe->user_data;
+	completion->result = cqe->res;
+	completion->flags = cqe->flags;
+	__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/*
+ * Completing an inline request by its own function
+ *
+ * Returns 1 if the completion was the one of an inline request
+ */
+static int complete_inline(const IoRingCompletion *completion)
+{
+	if(!(completion->userData & IO_RING_INLINE)){
+		return 0;
+	}
+	IoRingRequest *request = (IoRingRequest *)(uintptr_t)
+		(completion->userData & ~(uint64_t)(IO_RING_INLINE));
+	request->complete(request, completion->result);
+	return 1;
+}
+
+/*
+ * Keeping a completion for later, the kept ones are handed out in order
+ */
+static void defer_completion(IoRing *ring, const IoRingCompletion *completion)
+{
+	//Room is made at the end, by moving the kept ones to the beginning
+	//or by growing the array
+	if(ring->firstDeferred + ring->numDeferred == ring->deferredCapacity){
+		if(ring->firstDeferred > 0){
+			memmove(ring->deferred,
+				ring->deferred + ring->firstDeferred,
+				ring->numDeferred*sizeof(IoRingCompletion));
+			ring->firstDeferred = 0;
+		}else{
+			ring->deferredCapacity = (ring->deferredCapacity > 0) ?
+				2*ring->deferredCapacity : IO_RING_ENTRIES;
+			ring->deferred = realloc(ring->deferred,
+				ring->deferredCapacity*sizeof(IoRingCompletion));
+		}
+	}
+	ring->deferred[ring->firstDeferred + ring->numDeferred] = *completion;
+	ring->numDeferred++;
+}
+
+/*
+ * Taking a free entry of the submission queue, the queue is handed to
+ * the kernel first if it is full
+ */
+static struct io_uring_sqe * get_sqe(IoRing *ring)
+{
+	unsigned int numEntries = ring->sqMask + 1;
+	while(ring->sqLocalTail - __atomic_load_n(ring->sqHead,
+						  __ATOMIC_ACQUIRE)
+	      >= numEntries){
+		enter_ring(ring, 0);
+	}
+
+	unsigned int index = ring->sqLocalTail & ring->sqMask;
+	struct io_uring_sqe *sqe = &(ring->sqes[index]);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sqArray[index] = index;
+	ring->sqLocalTail++;
+
+	return sqe;
+}
+
+/*
+ * Initialization of a new io_uring instance with its queues mapped
+ *
+ * Returns NULL if the kernel doesn't have io_uring (or forbids it)
+ */
+IoRing * init_io_ring(unsigned int numEntries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(struct io_uring_params));
+	int fd = syscall(__NR_io_uring_setup, numEntries, &params);
+	if(fd < 0){
+		fprintf(stderr, "Error of creating a ring [io_uring_setup()]\n");
+		return NULL;
+	}
+
+	IoRing *new_ring = calloc(1, sizeof(IoRing));
+	new_ring->fd = fd;
+
+	//Both queues share one mapping on the kernels which allow it
+	new_ring->sqRingSize = params.sq_off.array +
+		params.sq_entries*sizeof(unsigned int);
+	new_ring->cqRingSize = params.cq_off.cqes +
+		params.cq_entries*sizeof(struct io_uring_cqe);
+	int singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(singleMapping){
+		if(new_ring->cqRingSize > new_ring->sqRingSize){
+			new_ring->sqRingSize = new_ring->cqRingSize;
+		}
+		new_ring->cqRingSize = new_ring->sqRingSize;
+	}
+
+	new_ring->sqRing = mmap(NULL, new_ring->sqRingSize,
+				PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+				fd, IORING_OFF_SQ_RING);
+	new_ring->cqRing = new_ring->sqRing;
+	if(!singleMapping && new_ring->sqRing != MAP_FAILED){
+		new_ring->cqRing = mmap(NULL, new_ring->cqRingSize,
+					PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_POPULATE,
+					fd, IORING_OFF_CQ_RING);
+	}
+	new_ring->sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+	new_ring->sqes = mmap(NULL, new_ring->sqesSize,
+			      PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+			      fd, IORING_OFF_SQES);
+	if(new_ring->sqRing == MAP_FAILED || new_ring->cqRing == MAP_FAILED ||
+	   new_ring->sqes == MAP_FAILED){
+		fprintf(stderr, "Error of mapping a ring [mmap()]\n");
+		if(new_ring->sqes != MAP_FAILED){
+			munmap(new_ring->sqes, new_ring->sqesSize);
+		}
+		if(!singleMapping && new_ring->cqRing != MAP_FAILED){
+			munmap(new_ring->cqRing, new_ring->cqRingSize);
+		}
+		if(new_ring->sqRing != MAP_FAILED){
+			munmap(new_ring->sqRing, new_ring->sqRingSize);
+		}
+		close(fd);
+		free(new_ring);
+		return NULL;
+	}
+
+	unsigned char *sqRing = new_ring->sqRing;
+	new_ring->sqHead = (unsigned int *)(sqRing + params.sq_off.head);
+	new_ring->sqTail = (unsigned int *)(sqRing + params.sq_off.tail);
+	new_ring->sqMask = *(unsigned int *)(sqRing + params.sq_off.ring_mask);
+	new_ring->sqArray = (unsigned int *)(sqRing + params.sq_off.array);
+	new_ring->sqLocalTail = *(new_ring->sqTail);
+
+	unsigned char *cqRing = new_ring->cqRing;
+	new_ring->cqHead = (unsigned int *)(cqRing + params.cq_off.head);
+	new_ring->cqTail = (unsigned int *)(cqRing + params.cq_off.tail);
+	new_ring->cqMask = *(unsigned int *)(cqRing + params.cq_off.ring_mask);
+	new_ring->cqes = (struct io_uring_cqe *)(cqRing + params.cq_off.cqes);
+
+	new_ring->deferred = NULL;
+	new_ring->numDeferred = 0;
+	new_ring->firstDeferred = 0;
+	new_ring->deferredCapacity = 0;
+	new_ring->bufferRing = NULL;
+	new_ring->buffers = NULL;
+
+	return new_ring;
+}
+
+/*
+ * Free-ing an io_uring instance, its queues and its buffers
+ */
+void free_io_ring(IoRing *ring)
+{
+	munmap(ring->sqes, ring->sqesSize);
+	if(ring->cqRing != ring->sqRing){
+		munmap(ring->cqRing, ring->cqRingSize);
+	}
+	munmap(ring->sqRing, ring->sqRingSize);
+
+	//The kernel lets go of the provided buffers with the ring
+	close(ring->fd);
+	free(ring->bufferRing);
+	free(ring->buffers);
+	free(ring->deferred);
+	free(ring);
+}
+
+/*
+ * Giving the kernel a ring of buffers to pick from for the receptions
+ * (IOSQE_BUFFER_SELECT), their number must be a power of two
+ *
+ * Returns ERR if the kernel doesn't know rings of provided buffers
+ */
+int io_ring_provide_buffers(IoRing *ring, unsigned int numBuffers,
+			    unsigned int bufferSize)
+{
+	void *bufferRing;
+	if(posix_memalign(&bufferRing, sysconf(_SC_PAGESIZE),
+			  numBuffers*sizeof(struct io_uring_buf)) != 0){
+		fprintf(stderr, "Error of allocating the buffers of a ring\n");
+		return ERR;
+	}
+	memset(bufferRing, 0, numBuffers*sizeof(struct io_uring_buf));
+
+	struct io_uring_buf_reg registration;
+	memset(&registration, 0, sizeof(struct io_uring_buf_reg));
+	registration.ring_addr = (uint64_t)(uintptr_t)(bufferRing);
+	registration.ring_entries = numBuffers;
+	registration.bgid = IO_RING_BUFFER_GROUP;
+	if(syscall(__NR_io_uring_register, ring->fd,
+		   IORING_REGISTER_PBUF_RING, &registration, 1) < 0){
+		fprintf(stderr, "Error of giving buffers to a ring \
+[io_uring_register()]\n");
+		free(bufferRing);
+		return ERR;
+	}
+
+	ring->bufferRing = bufferRing;
+	ring->buffers = malloc((size_t)(numBuffers)*bufferSize);
+	ring->numBuffers = numBuffers;
+	ring->bufferSize = bufferSize;
+
+	//All of them are free at first
+	unsigned int i;
+	for(i=0; i<numBuffers; i++){
+		struct io_uring_buf *buffer = &(ring->bufferRing->bufs[i]);
+		buffer->addr = (uint64_t)(uintptr_t)(ring->buffers +
+						      (size_t)(i)*bufferSize);
+		buffer->len = bufferSize;
+		buffer->bid = i;
+	}
+	__atomic_store_n(&(ring->bufferRing->tail), numBuffers,
+			 __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+/*
+ * Checking that the kernel receives with multishot requests into the
+ * provided buffers (Linux 6.0, io_uring and rings of buffers are older),
+ * by receiving one byte from a pair of sockets, the buffers are given
+ * first
+ *
+ * Returns ERR if the receptions would fail
+ */
+int io_ring_probe_receive(IoRing *ring)
+{
+	int socket_fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, 
+		      socket_fds) < 0){
+		return ERR;
+	}
+	unsigned char byte = 0;
+	if(write(socket_fds[1], &byte, 1) != 1){
+		close(socket_fds[0]);
+		close(socket_fds[1]);
+		return ERR;
+	}
+
+	//The reception goes on after the byte only if multishot is known,
+	//it is then ended by closing the other socket
+	int status = ERR;
+	int more = 1;
+	IoRingCompletion completion;
+	io_ring_receive(ring, socket_fds[0], 0);
+	while(more){
+		while(!pop_completion(ring, &completion)){
+			if(enter_ring(ring, 1) == ERR){
+				close(socket_fds[0]);
+				close(socket_fds[1]);
+				return ERR;
+			}
+		}
+		more = (completion.flags & IORING_CQE_F_MORE) != 0;
+		if(completion.flags & IORING_CQE_F_BUFFER){
+			io_ring_recycle_buffer(ring, completion.flags);
+		}
+		if(completion.result > 0 && more){
+			status = OK;
+			close(socket_fds[1]);
+			socket_fds[1] = -1;
+		}
+	}
+
+	close(socket_fds[0]);
+	if(socket_fds[1] >= 0){
+		close(socket_fds[1]);
+	}
+	return status;
+}
+
+/*
+ * Bytes of the provided buffer given in a completion
+ */
+unsigned char * io_ring_buffer(IoRing *ring, unsigned int flags)
+{
+	unsigned int bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+	return ring->buffers + (size_t)(bufferId)*ring->bufferSize;
+}
+
+/*
+ * Giving back to the kernel the provided buffer of a completion, once
+ * its bytes are used
+ */
+void io_ring_recycle_buffer(IoRing *ring, unsigned int flags)
+{
+	unsigned int bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+	unsigned short tail = ring->bufferRing->tail;
+
+	struct io_uring_buf *buffer =
+		&(ring->bufferRing->bufs[tail & (ring->numBuffers - 1)]);
+	buffer->addr = (uint64_t)(uintptr_t)(io_ring_buffer(ring, flags));
+	buffer->len = ring->bufferSize;
+	buffer->bid = bufferId;
+	__atomic_store_n(&(ring->bufferRing->tail), (unsigned short)(tail + 1),
+			 __ATOMIC_RELEASE);
+}
+
+/*
+ * Accepting all the connection requests of a listening socket with one
+ * request (multishot), the new sockets are non-blocking
+ */
+void io_ring_accept(IoRing *ring, int server_fd, uint64_t userData)
+{
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = server_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	sqe->user_data = userData;
+}
+
+/*
+ * Receiving from a socket into the provided buffers with one request
+ * (multishot), for as long as the socket is open and buffers are left
+ */
+void io_ring_receive(IoRing *ring, int socket_fd, uint64_t userData)
+{
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = socket_fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = IO_RING_BUFFER_GROUP;
+	sqe->user_data = userData;
+}
+
+/*
+ * Waiting once for a socket to be ready for the given events (poll)
+ */
+void io_ring_poll(IoRing *ring, int socket_fd, unsigned int events,
+		  uint64_t userData)
+{
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = socket_fd;
+	sqe->poll32_events = events;
+	sqe->user_data = userData;
+}
+
+/*
+ * Writing bytes at a position of a file
+ */
+void io_ring_write(IoRing *ring, int fd, const unsigned char *bytes,
+		   unsigned int numBytes, off_t offset, uint64_t userData)
+{
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(bytes);
+	sqe->len = numBytes;
+	sqe->off = offset;
+	sqe->user_data = userData;
+}
+
+/*
+ * Cancelling the requests submitted with the given user data
+ */
+void io_ring_cancel(IoRing *ring, uint64_t targetUserData,
+		    uint64_t userData)
+{
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = targetUserData;
+	sqe->user_data = userData;
+}
+
+/*
+ * Handing the submitted requests to the kernel, then waiting for at least
+ * minComplete completions (none if some completions are already waiting)
+ *
+ * Returns ERR if the kernel refused them
+ */
+int io_ring_submit(IoRing *ring, unsigned int minComplete)
+{
+	if(ring->numDeferred > 0 ||
+	   *(ring->cqHead) != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)){
+		minComplete = 0;
+	}
+	if(minComplete == 0 && ring->sqLocalTail == *(ring->sqTail)){
+		return OK;
+	}
+	return enter_ring(ring, minComplete);
+}
+
+/*
+ * Taking the next completion, the ones of inline requests are completed
+ * by their own function on the way
+ *
+ * Returns 1 with a completion, 0 if there is none for now
+ */
+int io_ring_next_completion(IoRing *ring, IoRingCompletion *completion)
+{
+	if(ring->numDeferred > 0){
+		*completion = ring->deferred[ring->firstDeferred];
+		ring->firstDeferred++;
+		ring->numDeferred--;
+		if(ring->numDeferred == 0){
+			ring->firstDeferred = 0;
+		}
+		return 1;
+	}
+
+	while(pop_completion(ring, completion)){
+		if(!complete_inline(completion)){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Waiting until a counter of inline requests drops to 0, the other
+ * completions seen meanwhile are kept for io_ring_next_completion
+ *
+ * Returns ERR if the kernel can't be waited for
+ */
+int io_ring_wait_inline(IoRing *ring, const unsigned int *numPending)
+{
+	IoRingCompletion completion;
+	while(*numPending > 0){
+		while(pop_completion(ring, &completion)){
+			if(!complete_inline(&completion)){
+				defer_completion(ring, &completion);
+			}
+		}
+		if(*numPending > 0 && enter_ring(ring, 1) == ERR){
+			return ERR;
+		}
+	}
+	return OK;
+}
@@ -0,0 +1,250 @@
+#include "lz4.h"
+
+/*
+ * Reading 4 bytes at any position
+ */
+static uint32_t read32(const unsigned char *bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(uint32_t));
+	return value;
+}
+
+/*
+ * Position in the table of the compressor of 4 bytes
+ */
+static unsigned int hash_sequence(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/*
+ * Writing a length which doesn't fit in its 4 bits of the token, as bytes
+ * of 255 followed by the rest
+ */
+static unsigned char * write_length(unsigned char *output, unsigned int length)
+{
+	while(length >= 255){
+		*output++ = 255;
+		length -= 255;
+	}
+	*output++ = (unsigned char)(length);
+	return output;
+}
+
+/*
+ * Writing one sequence: token, literals, then the match if any
+ *
+ * Returns the end of the sequence, or NULL if it doesn't fit
+ */
+static unsigned char * write_sequence(unsigned char *output, 
+				      const unsigned char *outputEnd,
+				      const unsigned char *literals, 
+				      unsigned int numLiterals,
+				      unsigned int offset, 
+				      unsigned int matchLength)
+{
+	//Worst case size of the sequence
+	if((size_t)(outputEnd - output) < 1 + numLiterals + numLiterals/255 + 1 +
+	   2 + matchLength/255 + 1){
+		return NULL;
+	}
+
+	unsigned char *token = output++;
+	*token = 0;
+
+	if(numLiterals >= 15){
+		*token = 15 << 4;
+		output = write_length(output, numLiterals - 15);
+	}else{
+		*token = (unsigned char)(numLiterals << 4);
+	}
+	memcpy(output, literals, numLiterals);
+	output += numLiterals;
+
+	//The last sequence has only literals
+	if(matchLength == 0){
+		return output;
+	}
+
+	*output++ = (unsigned char)(offset & 0xFF);
+	*output++ = (unsigned char)(offset >> 8);
+
+	matchLength -= LZ4_MIN_MATCH;
+	if(matchLength >= 15){
+		*token |= 15;
+		output = write_length(output, matchLength - 15);
+	}else{
+		*token |= (unsigned char)(matchLength);
+	}
+
+	return output;
+}
+
+/*
+ * Compressing some bytes into one block of the LZ4 block format, written to
+ * a buffer given by the caller, with a table of LZ4_TABLE_SIZE positions
+ * kept by the caller from one block to the next (never cleared, what is
+ * left of a previous block is checked before being used)
+ *
+ * Returns the size of the block, or 0 if it doesn't fit in the buffer
+ */
+unsigned int lz4_compress(const unsigned char *source, unsigned int sourceSize,
+			  unsigned char *block, unsigned int blockCapacity,
+			  uint32_t *table)
+{
+	const unsigned char *input = source;
+	const unsigned char *anchor = source; //first literal not written
+	const unsigned char *inputEnd = source + sourceSize;
+	unsigned char *output = block;
+	const unsigned char *outputEnd = block + blockCapacity;
+
+	if(sourceSize > LZ4_MF_LIMIT){
+		const unsigned char *matchFindLimit = inputEnd - LZ4_MF_LIMIT;
+		const unsigned char *matchLimit = inputEnd - LZ4_LAST_LITERALS;
+		unsigned int numMisses = 0;
+
+		while(input < matchFindLimit){
+			uint32_t sequence = read32(input);
+			unsigned int hash = hash_sequence(sequence);
+			uint32_t position = (uint32_t)(input - source);
+			uint32_t matchPosition = table[hash];
+			table[hash] = position;
+
+			//A position left by a previous block may be anywhere,
+			//it is only a candidate like the others
+			if(matchPosition >= position || 
+			   position - matchPosition > LZ4_MAX_OFFSET ||
+			   read32(source + matchPosition) != sequence){
+				//Data hard to compress is skipped faster
+				input += 1 + (numMisses++ >> 6);
+				continue;
+			}
+			numMisses = 0;
+			const unsigned char *reference = source + matchPosition;
+
+			//Extending the match backward, then forward
+			while(input > anchor && reference > source &&
+			      input[-1] == reference[-1]){
+				input--;
+				reference--;
+			}
+			unsigned int matchLength = LZ4_MIN_MATCH;
+			while(input + matchLength < matchLimit &&
+			      input[matchLength] == reference[matchLength]){
+				matchLength++;
+			}
+
+			output = write_sequence(output, outputEnd, anchor,
+						input - anchor, 
+						input - reference, 
+						matchLength);
+			if(output == NULL){
+				return 0;
+			}
+
+			input += matchLength;
+			anchor = input;
+		}
+	}
+
+	//The rest is written as literals
+	output = write_sequence(output, outputEnd, anchor, inputEnd - anchor,
+				0, 0);
+	if(output == NULL){
+		return 0;
+	}
+
+	return output - block;
+}
+
+/*
+ * Reading a length which doesn't fit in its 4 bits of the token
+ *
+ * Returns ERR if the block ends before it
+ */
+static int read_length(const unsigned char **input, 
+		       const unsigned char *inputEnd, unsigned int *length)
+{
+	unsigned char lengthByte;
+	do{
+		if(*input >= inputEnd){
+			return ERR;
+		}
+		lengthByte = *(*input)++;
+		*length += lengthByte;
+	}while(lengthByte == 255);
+
+	return OK;
+}
+
+/*
+ * Decompressing one block of the LZ4 block format, written to a buffer
+ * given by the caller
+ *
+ * Returns the number of bytes decompressed, or ERR if the block is invalid
+ * or doesn't fit in the buffer
+ */
+int lz4_decompress(const unsigned char *block, unsigned int blockSize,
+		   unsigned char *output, unsigned int outputCapacity)
+{
+	const unsigned char *input = block;
+	const unsigned char *inputEnd = block + blockSize;
+	unsigned char *outputStart = output;
+	unsigned char *outputEnd = output + outputCapacity;
+
+	while(input < inputEnd){
+		unsigned char token = *input++;
+
+		//Literals
+		unsigned int numLiterals = token >> 4;
+		if(numLiterals == 15 && 
+		   read_length(&input, inputEnd, &numLiterals) == ERR){
+			return ERR;
+		}
+		if(numLiterals > (size_t)(inputEnd - input) || 
+		   numLiterals > (size_t)(outputEnd - output)){
+			return ERR;
+		}
+		memcpy(output, input, numLiterals);
+		input += numLiterals;
+		output += numLiterals;
+
+		//The last sequence has only literals
+		if(input == inputEnd){
+			break;
+		}
+
+		//Match, which may overlap the bytes it produces
+		if(inputEnd - input < 2){
+			return ERR;
+		}
+		unsigned int offset = input[0] | (input[1] << 8);
+		input += 2;
+		if(offset == 0 || offset > (size_t)(output - outputStart)){
+			return ERR;
+		}
+
+		unsigned int matchLength = token & 15;
+		if(matchLength == 15 && 
+		   read_length(&input, inputEnd, &matchLength) == ERR){
+			return ERR;
+		}
+		matchLength += LZ4_MIN_MATCH;
+		if(matchLength > (size_t)(outputEnd - output)){
+			return ERR;
+		}
+
+		const unsigned char *reference = output - offset;
+		if(offset >= matchLength){
+			memcpy(output, reference, matchLength);
+			output += matchLength;
+		}else{
+			while(matchLength-- > 0){
+				*output++ = *reference++;
+			}
+		}
+	}
+
+	return output - outputStart;
+}
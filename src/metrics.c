@@ -0,0 +1,498 @@
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+
+//Counters kept once the listener is started, set once at startup
+static int metricsEnabled = 0;
+
+//Counters of all the threads which counted something, pushed without lock
+//by each thread the first time
+static ThreadMetrics *allMetrics = NULL;
+
+//Counters of the current thread, NULL until it counts something
+static __thread ThreadMetrics *threadMetrics = NULL;
+
+//Bounds of the store latency buckets, in nanoseconds then as written
+//in the scrapes (in seconds)
+static const uint64_t storeBounds[NUM_STORE_BUCKETS] = {
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+	25000000, 50000000, 100000000, 250000000, 1000000000
+};
+static const char *storeBoundNames[NUM_STORE_BUCKETS] = {
+	"0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01",
+	"0.025", "0.05", "0.1", "0.25", "1"
+};
+
+static const char *commandNames[MAX_COMMAND + 1] = {
+	"UNKNOWN", "CLIENT_HELLO", "SERVER_HELLO", "DATA_DELIVERY",
+	"DATA_STORE", "ERROR", "ACK", "CHUNK_LIST", "CHUNK_NEED"
+};
+static const char *stateNames[NUM_STATES] = {
+	"UNKNOWN", "INIT", "HELLO", "DELIVERY", "STORE", "CHUNKS"
+};
+static const char *errorReasonNames[NUM_ERROR_REASONS] = {
+	"invalid", "version", "sequence", "command", "no_dedup", "store"
+};
+
+/*
+ * Counters of the current thread, allocated and made visible to the
+ * listener the first time
+ */
+static ThreadMetrics *own_metrics(void)
+{
+	if(threadMetrics != NULL){
+		return threadMetrics;
+	}
+
+	ThreadMetrics *metrics;
+	if(posix_memalign((void **)(&metrics), CACHE_LINE_SIZE,
+			  sizeof(ThreadMetrics)) != 0){
+		return NULL;
+	}
+	memset(metrics, 0, sizeof(ThreadMetrics));
+
+	metrics->next = __atomic_load_n(&allMetrics, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&allMetrics, &(metrics->next),
+					   metrics, 1, __ATOMIC_RELEASE,
+					   __ATOMIC_RELAXED)){
+	}
+	threadMetrics = metrics;
+	return metrics;
+}
+
+/*
+ * Adding to a counter of the current thread: it is its only writer, so
+ * no locked instruction is needed, the listener reads whole values
+ */
+static inline void count(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+			 value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Adding the counters of a thread to the totals
+ */
+static void add_metrics(ThreadMetrics *total, ThreadMetrics *metrics)
+{
+	//The structure is only made of counters before its link
+	uint64_t *counters = (uint64_t *)(metrics);
+	uint64_t *totals = (uint64_t *)(total);
+	size_t numCounters = offsetof(ThreadMetrics, next)/sizeof(uint64_t);
+	size_t i;
+	for(i=0; i<numCounters; i++){
+		totals[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Writing the header of a metric: its help and its type
+ */
+static void write_metric_header(FILE *output, const char *name,
+				const char *help, const char *type)
+{
+	fprintf(output, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Writing a counter for each command, with the given values
+ */
+static void write_per_command(FILE *output, const char *name,
+			      const char *help, const uint64_t *values)
+{
+	unsigned int command;
+
+	write_metric_header(output, name, help, "counter");
+	for(command=1; command<=MAX_COMMAND; command++){
+		fprintf(output, "%s{command=\"%s\"} %llu\n", name,
+			commandNames[command],
+			(unsigned long long)(values[command]));
+	}
+}
+
+/*
+ * Writing the metrics of the I/O threads, if any
+ */
+static void write_io_threads(FILE *output)
+{
+	unsigned int numThreads = num_io_threads();
+	if(numThreads == 0){
+		return;
+	}
+
+	WriteQueueStats *stats = calloc(numThreads, sizeof(WriteQueueStats));
+	unsigned int i;
+	for(i=0; i<numThreads; i++){
+		write_queue_stats(i, &(stats[i]));
+	}
+
+	write_metric_header(output, "server_write_queue_depth",
+			    "Writes waiting in the queue of an I/O thread.",
+			    "gauge");
+	for(i=0; i<numThreads; i++){
+		fprintf(output, "server_write_queue_depth{queue=\"%u\"} %llu\n",
+			i, (unsigned long long)(stats[i].depth));
+	}
+	write_metric_header(output, "server_write_queue_max_depth",
+			    "Highest depth seen of the queue of an I/O thread.",
+			    "gauge");
+	for(i=0; i<numThreads; i++){
+		fprintf(output, "server_write_queue_max_depth{queue=\"%u\"} \
+%llu\n", i, (unsigned long long)(stats[i].maxDepth));
+	}
+	write_metric_header(output, "server_write_queue_full_total",
+			    "Times a write found the queue full.", "counter");
+	for(i=0; i<numThreads; i++){
+		fprintf(output, "server_write_queue_full_total{queue=\"%u\"} \
+%llu\n", i, (unsigned long long)(stats[i].numFull));
+	}
+	write_metric_header(output, "server_written_bytes_total",
+			    "Bytes written to the files by an I/O thread.",
+			    "counter");
+	for(i=0; i<numThreads; i++){
+		fprintf(output, "server_written_bytes_total{queue=\"%u\"} \
+%llu\n", i, (unsigned long long)(stats[i].numWrittenBytes));
+	}
+
+	free(stats);
+}
+
+/*
+ * Writing all the metrics in the text format of Prometheus, the counters
+ * of all the threads added up
+ *
+ * Returns the text, to be free-ed, or NULL if it can't be written
+ */
+static char *write_metrics(size_t *length)
+{
+	char *text = NULL;
+	FILE *output = open_memstream(&text, length);
+	if(output == NULL){
+		return NULL;
+	}
+
+	ThreadMetrics total;
+	memset(&total, 0, sizeof(ThreadMetrics));
+	ThreadMetrics *metrics;
+	for(metrics = __atomic_load_n(&allMetrics, __ATOMIC_ACQUIRE);
+	    metrics != NULL; metrics = metrics->next){
+		add_metrics(&total, metrics);
+	}
+
+	write_metric_header(output, "server_connections_accepted_total",
+			    "Connections accepted from the clients.",
+			    "counter");
+	fprintf(output, "server_connections_accepted_total %llu\n",
+		(unsigned long long)(total.numAccepted));
+	//Closed connections read after the accepted ones may be ahead
+	write_metric_header(output, "server_connections_active",
+			    "Connections open now.", "gauge");
+	fprintf(output, "server_connections_active %llu\n",
+		(unsigned long long)((total.numAccepted > total.numClosed) ?
+				     total.numAccepted - total.numClosed : 0));
+
+	write_per_command(output, "server_frames_received_total",
+			  "Frames received from the clients.",
+			  total.numFramesIn);
+	write_per_command(output, "server_received_bytes_total",
+			  "Bytes of the frames received, headers included.",
+			  total.numBytesIn);
+	write_per_command(output, "server_frames_sent_total",
+			  "Frames sent to the clients.", total.numFramesOut);
+	write_per_command(output, "server_sent_bytes_total",
+			  "Bytes of the frames sent, headers included.",
+			  total.numBytesOut);
+
+	int reason;
+	write_metric_header(output, "server_error_packets_sent_total",
+			    "Errors met with the clients, told by an error \
+packet when their version allows.", "counter");
+	for(reason=0; reason<NUM_ERROR_REASONS; reason++){
+		fprintf(output, "server_error_packets_sent_total\
+{reason=\"%s\"} %llu\n", errorReasonNames[reason],
+			(unsigned long long)(total.numErrors[reason]));
+	}
+
+	//Only the moves seen, most of them never happen
+	int from;
+	int to;
+	write_metric_header(output, "server_state_transitions_total",
+			    "Moves of the state machine of the connections.",
+			    "counter");
+	for(from=1; from<NUM_STATES; from++){
+		for(to=1; to<NUM_STATES; to++){
+			if(total.numTransitions[from][to] == 0){
+				continue;
+			}
+			fprintf(output, "server_state_transitions_total\
+{from=\"%s\",to=\"%s\"} %llu\n", stateNames[from], stateNames[to],
+				(unsigned long long)
+				(total.numTransitions[from][to]));
+		}
+	}
+
+	//The buckets of Prometheus count all the values below their bound
+	uint64_t numStores = 0;
+	int i;
+	write_metric_header(output, "server_store_duration_seconds",
+			    "Time from a data store to its acknowledgement.",
+			    "histogram");
+	for(i=0; i<NUM_STORE_BUCKETS; i++){
+		numStores += total.storeCounts[i];
+		fprintf(output, "server_store_duration_seconds_bucket\
+{le=\"%s\"} %llu\n", storeBoundNames[i], (unsigned long long)(numStores));
+	}
+	numStores += total.storeCounts[NUM_STORE_BUCKETS];
+	fprintf(output, "server_store_duration_seconds_bucket{le=\"+Inf\"} \
+%llu\n", (unsigned long long)(numStores));
+	fprintf(output, "server_store_duration_seconds_sum %.9f\n",
+		total.storeNanoseconds/1e9);
+	fprintf(output, "server_store_duration_seconds_count %llu\n",
+		(unsigned long long)(numStores));
+
+	write_io_threads(output);
+
+	if(fclose(output) != 0){
+		free(text);
+		return NULL;
+	}
+	return text;
+}
+
+/*
+ * Sending all the given bytes to a scraper
+ */
+static int send_all(int fd, const char *bytes, size_t numBytes)
+{
+	ssize_t numSentBytes;
+
+	while(numBytes > 0){
+		numSentBytes = send(fd, bytes, numBytes, MSG_NOSIGNAL);
+		if(numSentBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return ERR;
+		}
+		bytes += numSentBytes;
+		numBytes -= numSentBytes;
+	}
+
+	return OK;
+}
+
+/*
+ * Answering one HTTP request: the metrics for GET /metrics, not found
+ * otherwise, then the connection is closed
+ */
+static void answer_scrape(int fd)
+{
+	char request[MAX_METRICS_REQUEST_SIZE + 1];
+	size_t requestLength = 0;
+	ssize_t numReadBytes;
+
+	//Only the request line matters, read until the end of the headers
+	//(a scraper too slow is given up)
+	struct timeval timeout = {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+		   sizeof(struct timeval));
+	while(requestLength < MAX_METRICS_REQUEST_SIZE){
+		numReadBytes = recv(fd, request + requestLength,
+				    MAX_METRICS_REQUEST_SIZE - requestLength,
+				    0);
+		if(numReadBytes < 0 && errno == EINTR){
+			continue;
+		}
+		if(numReadBytes <= 0){
+			return;
+		}
+		requestLength += numReadBytes;
+		request[requestLength] = '\0';
+		if(strstr(request, "\r\n\r\n") != NULL){
+			break;
+		}
+	}
+	request[requestLength] = '\0';
+
+	char header[256];
+	int headerLength;
+	if(strncmp(request, "GET /metrics", 12) != 0 ||
+	   (request[12] != ' ' && request[12] != '?')){
+		const char *notFound = "HTTP/1.1 404 Not Found\r\n\
+Content-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\n\
+Not Found\n";
+		send_all(fd, notFound, strlen(notFound));
+		return;
+	}
+
+	size_t bodyLength;
+	char *body = write_metrics(&bodyLength);
+	if(body == NULL){
+		fprintf(stderr, "Error of writing the metrics\n");
+		return;
+	}
+	headerLength = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n\
+Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\
+Connection: close\r\n\r\n", bodyLength);
+	if(send_all(fd, header, headerLength) == OK){
+		send_all(fd, body, bodyLength);
+	}
+	free(body);
+}
+
+/*
+ * Entry point of the metrics listener, answering the scrapers one at
+ * a time for as long as the process runs
+ */
+static void *metrics_thread(void *args)
+{
+	int server_fd = (int)(intptr_t)(args);
+	int client_fd;
+
+	while(1){
+		client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(client_fd < 0){
+			if(errno != EINTR && errno != ECONNABORTED){
+				fprintf(stderr, "Error of accepting a \
+scraper. Retrying!\n");
+			}
+			continue;
+		}
+		answer_scrape(client_fd);
+		close(client_fd);
+	}
+
+	return NULL;
+}
+
+/*
+ * Starting the thread answering the scrapes of the metrics on the address
+ * and port of the given options, the counters are kept from now on
+ *
+ * Returns ERR if the listening socket can't be created
+ */
+int start_metrics_listener(const SocketOptions *options)
+{
+	int server_fd = server_listening(options, 0);
+	if(server_fd == ERR){
+		return ERR;
+	}
+
+	metricsEnabled = 1;
+	pthread_t thread;
+	Pthread_create(&thread, NULL, metrics_thread,
+		       (void *)(intptr_t)(server_fd));
+	Pthread_detach(thread);
+
+	return OK;
+}
+
+/*
+ * Current time of the monotonic clock in nanoseconds
+ */
+uint64_t metrics_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec)*1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Counting a connection accepted from a client
+ */
+void metrics_connection_opened(void)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL){
+		count(&(metrics->numAccepted), 1);
+	}
+}
+
+/*
+ * Counting a connection closed
+ */
+void metrics_connection_closed(void)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL){
+		count(&(metrics->numClosed), 1);
+	}
+}
+
+/*
+ * Counting a frame received with its command and its size
+ */
+void metrics_received(unsigned int command, unsigned int numBytes)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL){
+		command = (command <= MAX_COMMAND) ? command : 0;
+		count(&(metrics->numFramesIn[command]), 1);
+		count(&(metrics->numBytesIn[command]), numBytes);
+	}
+}
+
+/*
+ * Counting a frame sent with its command and its size
+ */
+void metrics_sent(unsigned int command, unsigned int numBytes)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL){
+		command = (command <= MAX_COMMAND) ? command : 0;
+		count(&(metrics->numFramesOut[command]), 1);
+		count(&(metrics->numBytesOut[command]), numBytes);
+	}
+}
+
+/*
+ * Counting an error met with a client for the given reason, an error
+ * packet tells it when its version allows
+ */
+void metrics_error_sent(int reason)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL){
+		count(&(metrics->numErrors[reason]), 1);
+	}
+}
+
+/*
+ * Counting a move of the state machine of a connection, to the same
+ * state included
+ */
+void metrics_transition(int fromState, int toState)
+{
+	ThreadMetrics *metrics;
+	if(metricsEnabled && (metrics = own_metrics()) != NULL &&
+	   fromState > 0 && fromState < NUM_STATES &&
+	   toState > 0 && toState < NUM_STATES){
+		count(&(metrics->numTransitions[fromState][toState]), 1);
+	}
+}
+
+/*
+ * Counting a store acknowledged (or given up) with its latency, from its
+ * data store packet on
+ */
+void metrics_store_done(uint64_t numNanoseconds)
+{
+	ThreadMetrics *metrics;
+	if(!metricsEnabled || (metrics = own_metrics()) == NULL){
+		return;
+	}
+
+	int bucket = 0;
+	while(bucket < NUM_STORE_BUCKETS &&
+	      numNanoseconds > storeBounds[bucket]){
+		bucket++;
+	}
+	count(&(metrics->storeCounts[bucket]), 1);
+	count(&(metrics->storeNanoseconds), numNanoseconds);
+}
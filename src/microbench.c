@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet_handler.h"
+#include "buffer_pool.h"
+
+#define MIN_DURATION 200000000ULL //nanoseconds each case runs at least
+#define MIN_ROUNDS 16 //rounds over the frame mix of the first run of a case
+#define NUM_FRAMES 11 //frames of the mix
+
+/*
+ * The functions below are the ones the linker gives instead of the real
+ * ones (-Wl,--wrap), so that the allocations and the copies of the codec
+ * are counted without touching it
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t numElements, size_t size);
+void *__real_buffer_alloc(size_t size);
+void *__real_buffer_calloc(size_t size);
+void *__real_memcpy(void *destination, const void *source, size_t size);
+void *__real_memmove(void *destination, const void *source, size_t size);
+
+//Counters of what the codec asked for since the beginning of a run
+static uint64_t numMallocs = 0; //blocks asked to the C library
+static uint64_t numBufferAllocs = 0; //buffers asked to the buffer pool
+static uint64_t numCopiedBytes = 0; //bytes copied by memcpy() or memmove()
+
+//Data structure of one frame of the mix, as a packet and as its bytes
+typedef struct _frame{
+	Packet *packet;
+	unsigned char *bytes;
+	unsigned int length;
+} Frame;
+
+//Data structure of one codec function measured over the frame mix
+typedef struct _codec_case{
+	const char *name;
+	void (*run)(const Frame *frame);
+} CodecCase;
+
+//Written by every case so that nothing it computes is left out
+static volatile unsigned int sink;
+
+void *__wrap_malloc(size_t size)
+{
+	numMallocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t numElements, size_t size)
+{
+	numMallocs++;
+	return __real_calloc(numElements, size);
+}
+
+void *__wrap_buffer_alloc(size_t size)
+{
+	numBufferAllocs++;
+	return __real_buffer_alloc(size);
+}
+
+void *__wrap_buffer_calloc(size_t size)
+{
+	numBufferAllocs++;
+	return __real_buffer_calloc(size);
+}
+
+void *__wrap_memcpy(void *destination, const void *source, size_t size)
+{
+	numCopiedBytes += size;
+	return __real_memcpy(destination, source, size);
+}
+
+void *__wrap_memmove(void *destination, const void *source, size_t size)
+{
+	numCopiedBytes += size;
+	return __real_memmove(destination, source, size);
+}
+
+/*
+ * Building a packet of the given header and data part (init_packet)
+ */
+static void run_init_packet(const Frame *frame)
+{
+	Header *header = frame->packet->packet_header;
+	Packet *packet = init_packet(header->version, header->sequence,
+				     header->command,
+				     frame->packet->packet_data,
+				     header->length - prefix_size(header) -
+				     trailer_size(header));
+	sink = packet->packet_header->length;
+	free_packet(packet);
+}
+
+/*
+ * Converting a packet to its bytes, data part copied (packetToBytes)
+ */
+static void run_packet_to_bytes(const Frame *frame)
+{
+	unsigned char *bytes = packetToBytes(frame->packet);
+	sink = bytes[0];
+	buffer_free(bytes);
+}
+
+/*
+ * Converting what comes around the data part of a packet to its bytes,
+ * the data part is sent in place (prefixToBytes and trailerToBytes)
+ */
+static void run_prefix_to_bytes(const Frame *frame)
+{
+	unsigned char prefixBytes[MAX_PREFIX_SIZE];
+	unsigned char trailerBytes[CHECKSUM_SIZE];
+	sink = prefixToBytes(frame->packet, prefixBytes) +
+		trailerToBytes(frame->packet, trailerBytes);
+}
+
+/*
+ * Interpreting the bytes of a header into a new header (read_header)
+ */
+static void run_read_header(const Frame *frame)
+{
+	Header *header = read_header(frame->bytes);
+	sink = header->length;
+	free_header(header);
+}
+
+/*
+ * Interpreting the bytes of a header in place (parse_header)
+ */
+static void run_parse_header(const Frame *frame)
+{
+	Header header;
+	parse_header(frame->bytes, &header);
+	sink = header.length;
+}
+
+/*
+ * Interpreting the bytes of a packet into a new packet, data part
+ * copied (read_packet)
+ */
+static void run_read_packet(const Frame *frame)
+{
+	Packet *packet = read_packet(frame->bytes, frame->length);
+	sink = packet->packet_header->length;
+	free_packet_for_read(packet);
+}
+
+/*
+ * Interpreting the bytes of a packet in place (read_packet_view)
+ */
+static void run_read_packet_view(const Frame *frame)
+{
+	PacketView view;
+	read_packet_view(frame->bytes, frame->length, &view);
+	sink = view.data_length;
+}
+
+static const CodecCase codecCases[] = {
+	{"init_packet", run_init_packet},
+	{"packetToBytes", run_packet_to_bytes},
+	{"prefixToBytes", run_prefix_to_bytes},
+	{"read_header", run_read_header},
+	{"parse_header", run_parse_header},
+	{"read_packet", run_read_packet},
+	{"read_packet_view", run_read_packet_view},
+};
+#define NUM_CASES (sizeof(codecCases)/sizeof(CodecCase))
+
+/*
+ * Building one frame of the mix and its bytes
+ */
+static void init_frame(Frame *frame, unsigned char version, int command,
+		       unsigned char *data, unsigned int dataLength,
+		       int withOffset, int withChecksum)
+{
+	frame->packet = init_packet(version, 1000, command, data, dataLength);
+	if(withOffset){
+		set_packet_offset(frame->packet, 4194304);
+	}
+	if(withChecksum){
+		set_packet_checksum(frame->packet, 0x12345678);
+	}
+	frame->bytes = packetToBytes(frame->packet);
+	frame->length = frame->packet->packet_header->length;
+}
+
+/*
+ * Current time of the monotonic clock in nanoseconds
+ */
+static uint64_t now_nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec)*1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Running a case over the frame mix until it lasted long enough, then
+ * printing what one operation costs on average
+ */
+static void measure_case(const CodecCase *codecCase, const Frame *frames)
+{
+	unsigned int i;
+
+	//One round first, so that the buffer pool is warm as in a long
+	//running program
+	for(i=0; i<NUM_FRAMES; i++){
+		codecCase->run(&(frames[i]));
+	}
+
+	uint64_t numRounds = MIN_ROUNDS;
+	uint64_t elapsed;
+	while(1){
+		numMallocs = 0;
+		numBufferAllocs = 0;
+		numCopiedBytes = 0;
+
+		uint64_t startTime = now_nanoseconds();
+		uint64_t round;
+		for(round=0; round<numRounds; round++){
+			for(i=0; i<NUM_FRAMES; i++){
+				codecCase->run(&(frames[i]));
+			}
+		}
+		elapsed = now_nanoseconds() - startTime;
+
+		if(elapsed >= MIN_DURATION){
+			break;
+		}
+		numRounds *= 2;
+	}
+
+	double numOperations = (double)(numRounds * NUM_FRAMES);
+	printf("%-18s %12llu %10.1f %12.3f %12.3f %14.1f\n", codecCase->name,
+	       (unsigned long long)(numRounds * NUM_FRAMES),
+	       elapsed / numOperations, numBufferAllocs / numOperations,
+	       numMallocs / numOperations, numCopiedBytes / numOperations);
+}
+
+int main(int argc, char **argv)
+{
+	//Data parts as big as the ones of an upload
+	unsigned char *data = calloc(MAX_DATA_SIZE_EXTENDED, 1);
+	unsigned char helloBytes[MAX_HELLO_SIZE];
+	HelloParams hello;
+	memset(&hello, 0, sizeof(HelloParams));
+	hello.version = VERSION_EXTENDED;
+	hello.compression = COMPRESSION_LZ4;
+	hello.checksum = CHECKSUM_CRC32C;
+	unsigned int helloLength = helloToBytes(&hello, helloBytes);
+
+	//Mix of the frames of uploads: a few hellos and stores, mostly
+	//data deliveries and acknowledgements
+	Frame frames[NUM_FRAMES];
+	init_frame(&(frames[0]), VERSION, CLIENT_HELLO, NULL, 0, 0, 0);
+	init_frame(&(frames[1]), VERSION, DATA_DELIVERY, data, 21880, 0, 0);
+	init_frame(&(frames[2]), VERSION, CLIENT_HELLO, helloBytes,
+		   helloLength, 0, 0);
+	init_frame(&(frames[3]), VERSION_EXTENDED, ACK, NULL, 0, 0, 0);
+	init_frame(&(frames[4]), VERSION_EXTENDED, ACK, NULL, 0, 0, 0);
+	init_frame(&(frames[5]), VERSION_EXTENDED, ACK, NULL, 0, 0, 0);
+	init_frame(&(frames[6]), VERSION_EXTENDED, ACK, NULL, 0, 0, 0);
+	init_frame(&(frames[7]), VERSION_EXTENDED, DATA_DELIVERY, data,
+		   65536, 0, 0);
+	init_frame(&(frames[8]), VERSION_EXTENDED, DATA_DELIVERY, data,
+		   65536, 0, 1);
+	init_frame(&(frames[9]), VERSION_EXTENDED, DATA_DELIVERY, data,
+		   MAX_DATA_SIZE_EXTENDED/4, 1, 1);
+	init_frame(&(frames[10]), VERSION_EXTENDED, DATA_STORE, NULL, 0, 0, 1);
+
+	printf("%-18s %12s %10s %12s %12s %14s\n", "CASE", "OPS", "NS/OP",
+	       "POOL/OP", "MALLOC/OP", "COPIED B/OP");
+
+	//Only the cases named on the command line, if any
+	unsigned int i;
+	for(i=0; i<NUM_CASES; i++){
+		int selected = (argc < 2);
+		int j;
+		for(j=1; j<argc; j++){
+			if(strcmp(argv[j], codecCases[i].name) == 0){
+				selected = 1;
+			}
+		}
+		if(selected){
+			measure_case(&(codecCases[i]), frames);
+		}
+	}
+
+	for(i=0; i<NUM_FRAMES; i++){
+		buffer_free(frames[i].bytes);
+		free_packet(frames[i].packet);
+	}
+	free(data);
+	return OK;
+}
@@ -1,4 +1,52 @@
+#include <endian.h>
+
 #include "packet_handler.h"
+#include "buffer_pool.h"
+
+//Words of a header read or written at once, at any position in the bytes
+typedef uint64_t unaligned_uint64 __attribute__((aligned(1), may_alias));
+typedef uint32_t unaligned_uint32 __attribute__((aligned(1), may_alias));
+
+//Bits of the first word of a header (most significant first) checked at
+//once: version and user ID, and for VERSION_EXTENDED the unknown flags
+#define HEADER_WORD_MASK 0xFFFF000000000000ULL
+#define HEADER_WORD ((uint64_t)(VERSION) << 56 | (uint64_t)(USER_ID) << 48)
+#define HEADER_WORD_MASK_EXTENDED (HEADER_WORD_MASK | \
+				   (uint64_t)(0xFFFF & ~KNOWN_FLAGS) << 32)
+#define HEADER_WORD_EXTENDED ((uint64_t)(VERSION_EXTENDED) << 56 | \
+			      (uint64_t)(USER_ID) << 48)
+
+/*
+ * Reading 8 bytes, most significant first, as one word
+ */
+static inline uint64_t load_be64(const unsigned char *readBytes)
+{
+	return be64toh(*(const unaligned_uint64 *)(readBytes));
+}
+
+/*
+ * Reading 4 bytes, most significant first, as one word
+ */
+static inline uint32_t load_be32(const unsigned char *readBytes)
+{
+	return be32toh(*(const unaligned_uint32 *)(readBytes));
+}
+
+/*
+ * Writing a word as 8 bytes, most significant first
+ */
+static inline void store_be64(unsigned char *writtenBytes, uint64_t value)
+{
+	*(unaligned_uint64 *)(writtenBytes) = htobe64(value);
+}
+
+/*
+ * Writing a word as 4 bytes, most significant first
+ */
+static inline void store_be32(unsigned char *writtenBytes, uint32_t value)
+{
+	*(unaligned_uint32 *)(writtenBytes) = htobe32(value);
+}
 
 /*
  * Converting some bytes in an array of char to a value in integer
@@ -14,7 +62,7 @@ too large\n");
 		return ERR;
 	}
 
-	int currentInt = 0;
+	unsigned int currentInt = 0;
 	unsigned int i;
 	//we read one by one byte to produce a final value of int
 	for(i=0; i<numBytes; i++){
@@ -25,92 +73,184 @@ too large\n");
 	return currentInt;
 }
 
+/*
+ * Converting 8 bytes in an array of char to a position in a file
+ */
+static uint64_t bytesToOffset(const unsigned char *readBytes)
+{
+	return load_be64(readBytes);
+}
+
+/*
+ * Size of the header starting with the given version, 0 if the version
+ * is unknown
+ */
+unsigned int header_size(unsigned char version)
+{
+	switch (version) {
+	case VERSION:
+		return HEADER_SIZE;
+	case VERSION_EXTENDED:
+		return HEADER_SIZE_EXTENDED;
+	default:
+		return 0;
+	}
+}
+
 /*
  * Initialization of a new header data structure
- * based on sequence number and command number
+ * based on version, sequence number and command number
  */
-static Header * init_header(int sequence, int command)
+static Header * init_header(unsigned char version, unsigned int sequence, 
+			    int command)
 {
+	//if the version is unknown, we return a null pointer
+	if(header_size(version) == 0){
+		fprintf(stderr, "Version number is invalid\n");
+		return NULL;
+	}
 
-	//if the sequence number is invalid (negative seq. num. 
-	//or seq. num. too big), we return a null pointer
-	if(sequence < 0 || sequence > 65535){ //maximum seq number is 65535
+	//if the sequence number is invalid (seq. num. too big),
+	//we return a null pointer
+	if(version == VERSION && sequence > 65535){ //maximum seq number is 65535
 		fprintf(stderr, "Sequence number is invalid\n");
 		return NULL;
 	}
 
 	//if the command number is incorrect,  we return a null pointer
-	if(command < 1 || command > 5){
+	if(command < 1 || command > MAX_COMMAND){
 		fprintf(stderr, "Command number is invalid\n");
 		return NULL;
 	}
 
-	Header *new_header = calloc(1, sizeof(Header));
+	Header *new_header = buffer_calloc(sizeof(Header));
 	
-        new_header->version = VERSION;
+        new_header->version = version;
         new_header->userId = USER_ID;
+        new_header->flags = 0;
         new_header->sequence = sequence;
 
-	//by default, the minimum size packet is 8bytes (size of header)
-        new_header->length = 8;
+	//by default, the minimum size packet is the size of header
+        new_header->length = header_size(version);
         new_header->command = command;
 	
 	return new_header;
 }
 
 /*
- * Initialization of a header data structure from the read bytes
+ * Telling why the read bytes are not a valid header, only once the fast
+ * checks of parse_header failed
  */
-Header * read_header(const unsigned char *readHeader)
+static void report_invalid_header(const unsigned char *readHeader)
 {
-	//if we dont have any bytes from the input,  we return a null pointer
-	if(readHeader == NULL){
-		fprintf(stderr, "No byte can be read\n");
-		return NULL;
-	}
-
-	//if the version is incompatible, we return a null pointer
-	if(readHeader[0]!=VERSION){
+	//if the version is incompatible
+	if(readHeader[0]!=VERSION && readHeader[0]!=VERSION_EXTENDED){
 		fprintf(stderr, "Version number is invalid\n");
-		return NULL;
+		return;
 	}
-	
-	//if the user id is incorrect, we return a null pointer
+
+	//if the user id is incorrect
 	if(readHeader[1]!=USER_ID){
 		fprintf(stderr, "User Id is invalid\n");
-		return NULL;
+		return;
 	}
 
-	//if the sequence number is invalid (negative seq. num. or seq. num. too big), 
-	//we return a null pointer
-	int sequence = bytesToInt(readHeader,2,2);
-	if(sequence < 0 || sequence > 65535){ //maximum seq number is 65535 because 2bytes
-		fprintf(stderr, "Sequence number is invalid\n");
-		return NULL;
+	unsigned int command = bytesToInt(readHeader,6,2);
+	if(readHeader[0] == VERSION_EXTENDED){
+		//if flags or reserved bytes are unknown
+		if((bytesToInt(readHeader,2,2) & ~KNOWN_FLAGS) != 0 || 
+		   bytesToInt(readHeader,14,2) != 0){
+			fprintf(stderr, "Flags are invalid\n");
+			return;
+		}
+
+		//if the length is invalid (length too big)
+		if(bytesToInt(readHeader,8,4) > MAX_LENGTH_EXTENDED){
+			fprintf(stderr, "Length is invalid\n");
+			return;
+		}
+		command = bytesToInt(readHeader,12,2);
 	}
 
-	//if the length is invalid (negative length or length too big), 
-	//we return a null pointer
-	int length = bytesToInt(readHeader,4,2);
-	if(length < 0 || length > 65535){ //maximum length is 65535 because 2bytes
-		fprintf(stderr, "Length is invalid\n");
-		return NULL;
+	//if the command number is incorrect
+	if(command < 1 || command > MAX_COMMAND){
+		fprintf(stderr, "Command number is invalid\n");
 	}
+}
 
-	//if the command number is incorrect,  we return a null pointer
-	int command = bytesToInt(readHeader,6,2);
-	if(command < 1 || command > 5){
-		fprintf(stderr, "Command number is invalid\n");
-		return NULL;
+/*
+ * Interpretation of the read bytes into a header data structure given
+ * by the caller
+ *
+ * The header is read as words (one or two), whose fields are checked
+ * together without a branch per field
+ */
+int parse_header(const unsigned char *readHeader, Header *header)
+{
+	//if we dont have any bytes from the input,  we return an error code
+	if(readHeader == NULL){
+		fprintf(stderr, "No byte can be read\n");
+		return ERR;
 	}
 
-	Header *new_header = calloc(1,sizeof(Header));
+	uint64_t word = load_be64(readHeader);
+	unsigned int flags = 0;
+	unsigned int sequence;
+	unsigned int length;
+	unsigned int command;
+	int invalid;
+	if(readHeader[0] == VERSION_EXTENDED){
+		//version, user ID, flags and sequence number, then length,
+		//command and reserved bytes
+		uint64_t secondWord = load_be64(readHeader + 8);
+		flags = (unsigned int)(word >> 32) & 0xFFFF;
+		sequence = (unsigned int)(word);
+		length = (unsigned int)(secondWord >> 32);
+		command = (unsigned int)(secondWord >> 16) & 0xFFFF;
+		invalid = ((word & HEADER_WORD_MASK_EXTENDED) != 
+			   HEADER_WORD_EXTENDED) |
+			((secondWord & 0xFFFF) != 0) |
+			(length > MAX_LENGTH_EXTENDED);
+	}else{
+		//maximum seq number and length are 65535 because 2bytes
+		sequence = (unsigned int)(word >> 32) & 0xFFFF;
+		length = (unsigned int)(word >> 16) & 0xFFFF;
+		command = (unsigned int)(word) & 0xFFFF;
+		invalid = ((word & HEADER_WORD_MASK) != HEADER_WORD);
+	}
+
+	//A command of 0 wraps around and is out of range as well
+	invalid |= (command - 1 >= MAX_COMMAND);
+	if(invalid){
+		report_invalid_header(readHeader);
+		return ERR;
+	}
+
+        header->version = readHeader[0];
+        header->userId = USER_ID;
+        header->flags = flags;
+        header->sequence = sequence;
+        header->length = length;
+        header->command = command;
 	
-        new_header->version = readHeader[0];
-        new_header->userId = readHeader[1];
-        new_header->sequence = sequence;
-        new_header->length = length;
-        new_header->command = command;
+	return OK;
+}
+
+/*
+ * Initialization of a header data structure from the read bytes,
+ * as many as the size of header of their version
+ */
+Header * read_header(const unsigned char *readHeader)
+{
+	Header parsedHeader;
+
+	//if the read bytes are not a valid header, we return a null pointer
+	if(parse_header(readHeader, &parsedHeader) == ERR){
+		return NULL;
+	}
+
+	Header *new_header = buffer_alloc(sizeof(Header));
+	*new_header = parsedHeader;
 	
 	return new_header;
 }
@@ -120,33 +260,128 @@ Header * read_header(const unsigned char *readHeader)
  */
 void free_header(Header *headerToFree)
 {
-	free(headerToFree);
+	buffer_free(headerToFree);
 }
 
 /*
  * Initialization of a new packet data structure with data and 
  * a header based on sequence number and command number
  */
-Packet * init_packet(int sequence, int command, unsigned char *packetData, 
-		     int packetDataLength)
+Packet * init_packet(unsigned char version, unsigned int sequence, 
+		     int command, unsigned char *packetData, 
+		     unsigned int packetDataLength)
 {
-	Header *new_header = init_header(sequence, command);
+	Header *new_header = init_header(version, sequence, command);
 	//If the creation of header is already failed, we return a null pointer
 	if(new_header == NULL){
 		fprintf(stderr, "Creation of header failed\n");
 		return NULL;
 	}
 
-	Packet *new_packet = calloc(1,sizeof(Packet));
+	Packet *new_packet = buffer_calloc(sizeof(Packet));
 
 	new_packet->packet_header = new_header;
 	new_packet->packet_header->length += packetDataLength;
 
 	new_packet->packet_data = packetData;
+	new_packet->data_offset = 0;
+	new_packet->raw_length = 0;
+	new_packet->checksum = 0;
 
 	return new_packet;
 }
 
+/*
+ * Giving to the data part of a packet its position in the file,
+ * written before it (VERSION_EXTENDED only)
+ */
+int set_packet_offset(Packet *packet, uint64_t dataOffset)
+{
+	Header *packetHeader = packet->packet_header;
+	if(packetHeader->version != VERSION_EXTENDED){
+		fprintf(stderr, "Version number is invalid\n");
+		return ERR;
+	}
+
+	if(!(packetHeader->flags & FLAG_OFFSET)){
+		packetHeader->flags |= FLAG_OFFSET;
+		packetHeader->length += OFFSET_SIZE;
+	}
+	packet->data_offset = dataOffset;
+
+	return OK;
+}
+
+/*
+ * Replacing the data part of a packet by its compressed bytes, its size
+ * once decompressed is written before them (VERSION_EXTENDED only)
+ */
+int set_packet_compressed(Packet *packet, unsigned char *compressedData,
+			  unsigned int compressedLength)
+{
+	Header *packetHeader = packet->packet_header;
+	if(packetHeader->version != VERSION_EXTENDED ||
+	   (packetHeader->flags & FLAG_COMPRESSED)){
+		fprintf(stderr, "Packet can't be compressed\n");
+		return ERR;
+	}
+
+	unsigned int prefixSize = prefix_size(packetHeader);
+	packet->raw_length = packetHeader->length - prefixSize - 
+		trailer_size(packetHeader);
+
+	packetHeader->flags |= FLAG_COMPRESSED;
+	packetHeader->length = prefixSize + RAW_LENGTH_SIZE + compressedLength +
+		trailer_size(packetHeader);
+	packet->packet_data = compressedData;
+
+	return OK;
+}
+
+/*
+ * Giving to a packet the checksum written after its data part
+ * (VERSION_EXTENDED only)
+ */
+int set_packet_checksum(Packet *packet, uint32_t checksum)
+{
+	Header *packetHeader = packet->packet_header;
+	if(packetHeader->version != VERSION_EXTENDED){
+		fprintf(stderr, "Version number is invalid\n");
+		return ERR;
+	}
+
+	if(!(packetHeader->flags & FLAG_CHECKSUM)){
+		packetHeader->flags |= FLAG_CHECKSUM;
+		packetHeader->length += CHECKSUM_SIZE;
+	}
+	packet->checksum = checksum;
+
+	return OK;
+}
+
+/*
+ * Size of the header and of what comes before the data part
+ */
+unsigned int prefix_size(const Header *header)
+{
+	unsigned int prefixSize = header_size(header->version);
+	if(header->flags & FLAG_OFFSET){
+		prefixSize += OFFSET_SIZE;
+	}
+	if(header->flags & FLAG_COMPRESSED){
+		prefixSize += RAW_LENGTH_SIZE;
+	}
+	return prefixSize;
+}
+
+/*
+ * Size of what comes after the data part
+ */
+unsigned int trailer_size(const Header *header)
+{
+	return (header->flags & FLAG_CHECKSUM) ? CHECKSUM_SIZE : 0;
+}
+
 /*
  * Initialization of a packet data structure including header data structure 
  * and data part from the bytes read
@@ -165,7 +400,8 @@ Packet * read_packet(unsigned char *readPacket, unsigned int packetLength)
 	}
 
 	//if we dont have min 8 bytes from the input,  we return a null pointer
-	if(packetLength < 8)
+	if(packetLength < HEADER_SIZE || 
+	   packetLength < header_size(readPacket[0]))
 	{
 		fprintf(stderr, "No enough bytes to be read; Minimum 8bytes\n");
 		return NULL;
@@ -179,30 +415,132 @@ Packet * read_packet(unsigned char *readPacket, unsigned int packetLength)
 	}
 
 	//If the read packet length is invalid, we return a null pointer
-	if(packetLength != new_header->length){
+	unsigned int headerSize = prefix_size(new_header);
+	unsigned int trailerSize = trailer_size(new_header);
+	if(packetLength != new_header->length || 
+	   packetLength < headerSize + trailerSize){
 		fprintf(stderr, "Error of read packet length\n");
 		free_header(new_header);
 		return NULL;
 	}
 
-	Packet *new_packet = calloc(1,sizeof(Packet));
+	Packet *new_packet = buffer_calloc(sizeof(Packet));
 
 	new_packet->packet_header = new_header;
 	new_packet->packet_data = NULL;
+	new_packet->data_offset = 0;
+	if(new_header->flags & FLAG_OFFSET){
+		new_packet->data_offset = bytesToOffset(readPacket + 
+				header_size(new_header->version));
+	}
+	new_packet->raw_length = 0;
+	if(new_header->flags & FLAG_COMPRESSED){
+		new_packet->raw_length = load_be32(readPacket + headerSize - 
+						   RAW_LENGTH_SIZE);
+	}
+	new_packet->checksum = 0;
+	if(trailerSize > 0){
+		new_packet->checksum = load_be32(readPacket + packetLength - 
+						 trailerSize);
+	}
 
 	//Make a new copy of packet data and store them in the
 	//structure
-	if(packetLength > 8)
+	unsigned int dataLength = packetLength - headerSize - trailerSize;
+	if(dataLength > 0)
 	{
-		unsigned char *new_packet_data = calloc(packetLength-8,
-							sizeof(unsigned char));
-		memcpy(new_packet_data, readPacket+8, packetLength-8);
+		unsigned char *new_packet_data = buffer_alloc(dataLength);
+		memcpy(new_packet_data, readPacket+headerSize, dataLength);
 		new_packet->packet_data = new_packet_data;
 	}
 
 	return new_packet;
 }
 
+/*
+ * Interpretation of the beginning of a packet (header and position of the
+ * data part if any) into a packet view given by the caller, its data part
+ * is only the one among the read bytes
+ */
+int read_packet_prefix(const unsigned char *readPacket, 
+		       unsigned int numReadBytes, PacketView *view)
+{
+	//if we dont have min 8 bytes from the input,  we return an error code
+	if(readPacket == NULL || numReadBytes < HEADER_SIZE ||
+	   numReadBytes < header_size(readPacket[0]))
+	{
+		fprintf(stderr, "No enough bytes to be read; Minimum 8bytes\n");
+		return ERR;
+	}
+
+	if(parse_header(readPacket, &(view->packet_header)) == ERR){
+		fprintf(stderr, "Creation of header failed\n");
+		return ERR;
+	}
+
+	//The position of the data part is needed as well
+	unsigned int prefixSize = prefix_size(&(view->packet_header));
+	if(numReadBytes < prefixSize || 
+	   view->packet_header.length < prefixSize){
+		fprintf(stderr, "Error of read packet length\n");
+		return ERR;
+	}
+	view->data_offset = 0;
+	if(view->packet_header.flags & FLAG_OFFSET){
+		view->data_offset = bytesToOffset(readPacket + 
+				header_size(view->packet_header.version));
+	}
+	view->raw_length = 0;
+	if(view->packet_header.flags & FLAG_COMPRESSED){
+		view->raw_length = load_be32(readPacket + prefixSize - 
+					     RAW_LENGTH_SIZE);
+	}
+
+	view->data_length = numReadBytes - prefixSize;
+	view->packet_data = NULL;
+	if(view->data_length > 0){
+		view->packet_data = readPacket + prefixSize;
+	}
+
+	return OK;
+}
+
+/*
+ * Interpretation of the read bytes into a packet view given by the caller,
+ * its data part stays valid as long as the read bytes
+ *
+ * Same checks as read_packet, but the header is filled in place and
+ * the data part is not copied
+ */
+int read_packet_view(const unsigned char *readPacket, 
+		     unsigned int packetLength, PacketView *view)
+{
+	if(read_packet_prefix(readPacket, packetLength, view) == ERR){
+		return ERR;
+	}
+
+	//If the read packet length is invalid, we return an error code
+	unsigned int trailerSize = trailer_size(&(view->packet_header));
+	if(packetLength != view->packet_header.length ||
+	   view->data_length < trailerSize){
+		fprintf(stderr, "Error of read packet length\n");
+		return ERR;
+	}
+
+	//The checksum is not part of the data
+	view->checksum = 0;
+	if(trailerSize > 0){
+		view->data_length -= trailerSize;
+		view->checksum = load_be32(readPacket + packetLength - 
+					   trailerSize);
+		if(view->data_length == 0){
+			view->packet_data = NULL;
+		}
+	}
+
+	return OK;
+}
+
 /*
  * Free-ing packet data structure including header
  * we won't free the packet data here because it is a reference to data
@@ -211,7 +549,7 @@ Packet * read_packet(unsigned char *readPacket, unsigned int packetLength)
 void free_packet(Packet *packetToFree)
 {
 	free_header(packetToFree->packet_header);
-	free(packetToFree);
+	buffer_free(packetToFree);
 }
 
 /*
@@ -221,13 +559,238 @@ void free_packet_for_read(Packet *packetToFree)
 {
 	free_header(packetToFree->packet_header);
 	if(packetToFree->packet_data != NULL){
-		free(packetToFree->packet_data);
+		buffer_free(packetToFree->packet_data);
 	}
-	free(packetToFree);
+	buffer_free(packetToFree);
 }
 
 /*
- * Converting a packet data structure to bytes in order to send them over socket
+ * Writing a value to some bytes in an array of char, most significant first
+ */
+static void intToBytes(unsigned int value, unsigned char *writtenBytes,
+		       int positionStartByte, unsigned int numBytes)
+{
+	unsigned int i;
+	for(i=0; i<numBytes; i++){
+		writtenBytes[positionStartByte+numBytes-1-i] = 
+			(unsigned char)(value & (0xFF));
+		value >>= 8;
+	}
+}
+
+/*
+ * Converting only a header data structure to its bytes (8 or 16), written 
+ * to a buffer given by the caller (stack), the size of header is returned
+ */
+unsigned int headerToBytes(const Header *ptrHeader, unsigned char *headerBytes)
+{
+	//The fields are put together in words, written at once
+	uint64_t word = (uint64_t)(ptrHeader->version) << 56 | 
+		(uint64_t)(ptrHeader->userId) << 48;
+	if(ptrHeader->version == VERSION){
+		word |= (uint64_t)(ptrHeader->sequence & 0xFFFF) << 32 |
+			(uint64_t)(ptrHeader->length & 0xFFFF) << 16 |
+			(ptrHeader->command & 0xFFFF);
+		store_be64(headerBytes, word);
+		return HEADER_SIZE;
+	}
+
+	word |= (uint64_t)(ptrHeader->flags & 0xFFFF) << 32 | 
+		ptrHeader->sequence;
+	store_be64(headerBytes, word);
+	store_be64(headerBytes + 8, (uint64_t)(ptrHeader->length) << 32 |
+		   (uint64_t)(ptrHeader->command & 0xFFFF) << 16);
+	return HEADER_SIZE_EXTENDED;
+}
+
+/*
+ * Converting a header and the position of the data part if any to 
+ * their bytes, written to a buffer given by the caller (stack), 
+ * their size is returned
+ */
+unsigned int prefixToBytes(const Packet *ptrPacket, unsigned char *prefixBytes)
+{
+	const Header *ptrHeader = ptrPacket->packet_header;
+	unsigned int prefixSize = headerToBytes(ptrHeader, prefixBytes);
+
+	if(ptrHeader->flags & FLAG_OFFSET){
+		store_be64(prefixBytes + prefixSize, ptrPacket->data_offset);
+		prefixSize += OFFSET_SIZE;
+	}
+	if(ptrHeader->flags & FLAG_COMPRESSED){
+		store_be32(prefixBytes + prefixSize, ptrPacket->raw_length);
+		prefixSize += RAW_LENGTH_SIZE;
+	}
+
+	return prefixSize;
+}
+
+/*
+ * Converting what comes after the data part (checksum) to its bytes,
+ * written to a buffer given by the caller (stack), its size is returned
+ */
+unsigned int trailerToBytes(const Packet *ptrPacket, 
+			    unsigned char *trailerBytes)
+{
+	unsigned int trailerSize = trailer_size(ptrPacket->packet_header);
+	if(trailerSize > 0){
+		store_be32(trailerBytes, ptrPacket->checksum);
+	}
+	return trailerSize;
+}
+
+/*
+ * Converting hello parameters to the data part of a hello command,
+ * the number of bytes written is returned
+ */
+unsigned int helloToBytes(const HelloParams *params, unsigned char *helloBytes)
+{
+	unsigned int numBytes = 0;
+
+	helloBytes[numBytes++] = HELLO_TAG_VERSION;
+	helloBytes[numBytes++] = 1;
+	helloBytes[numBytes++] = params->version;
+
+	//Only a connection of a shared transfer tells about it
+	if(params->transferId != 0){
+		helloBytes[numBytes++] = HELLO_TAG_TRANSFER;
+		helloBytes[numBytes++] = 8;
+		intToBytes((unsigned int)(params->transferId >> 32), 
+			   helloBytes, numBytes, 4);
+		intToBytes((unsigned int)(params->transferId), 
+			   helloBytes, numBytes + 4, 4);
+		numBytes += 8;
+
+		helloBytes[numBytes++] = HELLO_TAG_STREAMS;
+		helloBytes[numBytes++] = 2;
+		intToBytes(params->numStreams, helloBytes, numBytes, 2);
+		numBytes += 2;
+	}
+
+	if(params->dedup){
+		helloBytes[numBytes++] = HELLO_TAG_DEDUP;
+		helloBytes[numBytes++] = 0;
+	}
+
+	if(params->compression != COMPRESSION_NONE){
+		helloBytes[numBytes++] = HELLO_TAG_COMPRESSION;
+		helloBytes[numBytes++] = 1;
+		helloBytes[numBytes++] = params->compression;
+	}
+
+	if(params->checksum != CHECKSUM_NONE){
+		helloBytes[numBytes++] = HELLO_TAG_CHECKSUM;
+		helloBytes[numBytes++] = 1;
+		helloBytes[numBytes++] = params->checksum;
+	}
+
+	if(params->resume){
+		helloBytes[numBytes++] = HELLO_TAG_RESUME;
+		helloBytes[numBytes++] = 8;
+		intToBytes((unsigned int)(params->resumeOffset >> 32), 
+			   helloBytes, numBytes, 4);
+		intToBytes((unsigned int)(params->resumeOffset), 
+			   helloBytes, numBytes + 4, 4);
+		numBytes += 8;
+	}
+
+	return numBytes;
+}
+
+/*
+ * Interpretation of the data part of a hello command, the parameters
+ * not given keep their default value and the unknown ones are skipped
+ */
+int read_hello(const unsigned char *helloBytes, unsigned int helloLength,
+	       HelloParams *params)
+{
+	//Values by default, the first version without hello parameters
+	params->version = VERSION;
+	params->transferId = 0;
+	params->numStreams = 1;
+	params->resume = 0;
+	params->resumeOffset = 0;
+	params->dedup = 0;
+	params->compression = COMPRESSION_NONE;
+	params->checksum = CHECKSUM_NONE;
+
+	unsigned int position = 0;
+	while(position + 2 <= helloLength){
+		unsigned char tag = helloBytes[position];
+		unsigned char valueLength = helloBytes[position+1];
+		const unsigned char *value = helloBytes + position + 2;
+		if(position + 2 + valueLength > helloLength){
+			fprintf(stderr, "Hello parameters are invalid\n");
+			return ERR;
+		}
+
+		switch (tag) {
+		case HELLO_TAG_VERSION:
+			if(valueLength == 1){
+				params->version = value[0];
+			}
+			break;
+		case HELLO_TAG_TRANSFER:
+			if(valueLength == 8){
+				params->transferId = bytesToOffset(value);
+			}
+			break;
+		case HELLO_TAG_STREAMS:
+			if(valueLength == 2){
+				params->numStreams = bytesToInt(value,0,2);
+			}
+			break;
+		case HELLO_TAG_RESUME:
+			if(valueLength == 8){
+				params->resume = 1;
+				params->resumeOffset = bytesToOffset(value);
+			}
+			break;
+		case HELLO_TAG_DEDUP:
+			params->dedup = 1;
+			break;
+		case HELLO_TAG_COMPRESSION:
+			if(valueLength == 1){
+				params->compression = value[0];
+			}
+			break;
+		case HELLO_TAG_CHECKSUM:
+			if(valueLength == 1){
+				params->checksum = value[0];
+			}
+			break;
+		default:
+			//left for newer versions
+			break;
+		}
+		position += 2 + valueLength;
+	}
+
+	return OK;
+}
+
+/*
+ * Converting a chunk of a list to its bytes (digest then length), written
+ * to a buffer given by the caller
+ */
+void chunkEntryToBytes(const ChunkEntry *entry, unsigned char *entryBytes)
+{
+	memcpy(entryBytes, entry->digest, DIGEST_SIZE);
+	intToBytes(entry->length, entryBytes, DIGEST_SIZE, 4);
+}
+
+/*
+ * Interpretation of the bytes of a chunk of a list
+ */
+void read_chunk_entry(const unsigned char *entryBytes, ChunkEntry *entry)
+{
+	memcpy(entry->digest, entryBytes, DIGEST_SIZE);
+	entry->length = bytesToInt(entryBytes, DIGEST_SIZE, 4);
+}
+
+/*
+ * Converting a packet data structure to bytes in order to send them over socket,
+ * the bytes are taken from the buffer pool and given back with buffer_free
  */
 unsigned char * packetToBytes(Packet *ptrPacket)
 {
@@ -238,18 +801,16 @@ unsigned char * packetToBytes(Packet *ptrPacket)
 
 	Header *ptrHeader = ptrPacket->packet_header;
 		
-	unsigned char *new_bytes = calloc(ptrHeader->length, 
-					  sizeof(unsigned char));
-	new_bytes[0] = ptrHeader->version;
-	new_bytes[1] = ptrHeader->userId;
-	new_bytes[2] = (unsigned char)((ptrHeader->sequence >> 8) & (0xFF));
-	new_bytes[3] = (unsigned char)((ptrHeader->sequence) & (0xFF));
-	new_bytes[4] = (unsigned char)((ptrHeader->length >> 8) & (0xFF));
-	new_bytes[5] = (unsigned char)((ptrHeader->length) & (0xFF));
-	new_bytes[6] = (unsigned char)((ptrHeader->command >> 8) & (0xFF));
-	new_bytes[7] = (unsigned char)((ptrHeader->command) & (0xFF));
-
-	memcpy(new_bytes + 8, ptrPacket->packet_data, ptrHeader->length - 8);
+	unsigned char *new_bytes = buffer_alloc(ptrHeader->length);
+	unsigned int headerSize = prefixToBytes(ptrPacket, new_bytes);
+	unsigned int trailerSize = trailer_size(ptrHeader);
+
+	memcpy(new_bytes + headerSize, ptrPacket->packet_data, 
+	       ptrHeader->length - headerSize - trailerSize);
+	if(trailerSize > 0){
+		store_be32(new_bytes + ptrHeader->length - trailerSize, 
+			   ptrPacket->checksum);
+	}
 	return new_bytes;
 }
 
@@ -260,10 +821,10 @@ unsigned char * packetToBytes(Packet *ptrPacket)
  * 
  * Server goes back to initial state
  */
-Packet *send_error_packet(unsigned int seq_num, int **current_state, 
-			  int init_code)
+Packet *send_error_packet(unsigned char version, unsigned int seq_num, 
+			  int **current_state, int init_code)
 {
-	Packet *error_packet = init_packet(seq_num, ERROR, NULL, 0);
+	Packet *error_packet = init_packet(version, seq_num, ERROR, NULL, 0);
 	**current_state = init_code;
 	fprintf(stderr, "ERROR PACKET SENT, RESTART CLIENT\n");
 	return error_packet;
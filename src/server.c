@@ -3,131 +3,1315 @@
 #include <stdlib.h>
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
 
 #include "packet_handler.h"
 #include "socket_helper.h"
+#include "connection.h"
+#include "storage.h"
+#include "io_ring.h"
+#include "write_queue.h"
+#include "group_commit.h"
+#include "metrics.h"
 
-#define STATE_INIT 1 //initial state before connection setup or
-                     //end of the current connection
-#define STATE_HELLO 2 //state after receiving a Hello command
-#define STATE_DELIVERY 3 //state after receiving a Data Delivery command
-#define STATE_STORE 4 //state after receiving a Data Store command
+#define MAX_EVENTS 64 //maximum number of events handled per wake-up
+#define MAX_WORKERS 256 //maximum number of threads with their own event loop
+#define DONE 1 //job of a client finished, its connection can be closed
+
+#define RING_BUFFERS 64 //buffers given to the kernel for the receptions
+//Requests of the io_uring backend, the user data being the address of
+//the connection context (aligned on 16 bytes by malloc) tagged with the
+//operation in its lowest bits (the lowest one is IO_RING_INLINE, never
+//set by the server)
+#define RING_RECEIVE 0x0
+#define RING_SEND_POLL 0x2
+#define RING_CANCEL 0x4
+#define RING_ACCEPT 0x6
+#define RING_COMMITS 0x8
+#define RING_OPERATION_MASK 0xf
+
+//Bytes of an upload kept in memory before being written to its file,
+//set once at startup
+static unsigned int uploadWindowSize = DEFAULT_WINDOW_SIZE;
+
+//Directory where the uploads are stored, with their temporary files,
+//set once at startup
+static const char *storageDirectory = ".";
+
+//Data parts moved by the kernel from the sockets to the uploads (splice), 
+//set once at startup
+static int useSplice = 0;
+
+//Address the clients connect to and tuning of the sockets, set once
+//at startup
+static SocketOptions socketOptions;
+
+//Sockets and uploads served through io_uring instead of epoll and
+//blocking writes, set once at startup
+static int useRing = 0;
+
+//Ring of the event loop of the current thread, NULL if it is an
+//epoll one
+static __thread IoRing *workerRing = NULL;
+
+//How surely the stored files are on the disk before their store is
+//acknowledged, set once at startup
+static int durability = DURABILITY_NONE;
+
+//Commits of the stores of the event loop of the current thread done by
+//the committing thread (group commit only, NULL otherwise)
+static __thread CommitWaiter *commitWaiter = NULL;
+
+//Writes of the uploads of the event loop of the current thread done by
+//the I/O threads, and the connections which stopped reading until then
+//(I/O threads only, NULL otherwise)
+static __thread WriteWaiter *writeWaiter = NULL;
+static __thread Connection *stalledConnections = NULL;
+
+/*
+ * Entry point of a worker thread running its own event loop
+ */
+void *worker_thread(void *args);
+
+/*
+ * Running an event loop, on a new listening socket, which serves all
+ * its clients at the same time
+ */
+int run_event_loop(int reusePort);
+
+/*
+ * Running an event loop with io_uring, on a new listening socket, which
+ * serves all its clients at the same time, the epoll one is run instead
+ * if the kernel doesn't have what is needed
+ */
+int run_ring_loop(int reusePort);
+
+/*
+ * Handling the completion of one request of the io_uring event loop
+ */
+void handle_ring_completion(IoRing *ring, int server_fd, 
+			    IoRingCompletion *completion);
+
+/*
+ * Waiting for the socket of a connection of the io_uring event loop to be
+ * writable if bytes are left to send, or free-ing it once it is closed and
+ * nothing is left of it
+ */
+void settle_ring_connection(IoRing *ring, Connection *conn);
+
+/*
+ * Moving forward the job of one client with bytes received through
+ * io_uring
+ *
+ * Returns DONE once the job of the client is finished, ERR if the packets
+ * are invalid, OK otherwise
+ */
+int serve_ring_bytes(Connection *conn, const unsigned char *bytes,
+		     unsigned int numBytes);
+
+/*
+ * Closing a connection of the io_uring event loop, its reception still
+ * armed is cancelled and its context is free-ed after its last request,
+ * once the bytes queued for its client are sent
+ */
+void close_ring_connection(IoRing *ring, Connection *conn);
+
+/*
+ * Accepting all the pending requests from the clients and registering them
+ * to the event loop
+ */
+void accept_clients(int epoll_fd, int server_fd);
+
+/*
+ * Closing a connection of the epoll event loop once the bytes queued for
+ * its client are sent, it stays registered for its socket to be writable
+ * until then, and until its store is acknowledged if it is still being
+ * committed
+ */
+void finish_connection(int epoll_fd, Connection *conn);
+
+/*
+ * Acknowledging a store whose file is now on the disk (group commit), the
+ * connection waiting for it is closed once the acknowledgement is sent
+ *
+ * Returns the connection of the store
+ */
+Connection * store_committed(CommitRequest *request);
+
+/*
+ * Stopping reading a connection whose upload has too many windows not
+ * written yet, only its replies are sent until the I/O threads catch up
+ */
+void stall_connection(int epoll_fd, Connection *conn);
+
+/*
+ * Reading again the stalled connections whose uploads can take more data,
+ * once the I/O threads told the event loop that writes are done
+ */
+void resume_connections(int epoll_fd);
+
+/*
+ * Taking a stalled connection out of the list, before it is free-ed
+ */
+void unstall_connection(Connection *conn);
+
+/*
+ * Moving forward the job of one client with all the bytes available
+ * on its socket
+ */
+int serve_client(Connection *conn);
+
+/*
+ * Handling all the whole packets received from the client, then the
+ * beginning of a big data part to be moved to the upload if any, and
+ * acknowledging them at once
+ *
+ * Returns DONE once the job of the client is finished, ERR if the packets
+ * are invalid, OK otherwise
+ */
+int serve_received(Connection *conn);
+
+/*
+ * Handling one whole packet (or the beginning of one to be moved)
+ * received from the client: reply, data and acknowledgement
+ *
+ * Returns DONE once the job of the client is finished, OK otherwise
+ */
+int handle_packet(Connection *conn, PacketView *readPacket);
+
+/*
+ * Acknowledging a data delivery whose rest has been moved to the upload
+ * straight from the socket
+ */
+void delivery_moved(Connection *conn);
+
+/*
+ * Queuing a packet to be sent to the client, header converted on the stack
+ * then data part if any
+ */
+void send_to_client(Connection *conn, Packet *packetToSend);
+
+/*
+ * Sending an acknowledgement, or an error, for the given sequence number
+ */
+void acknowledge(Connection *conn, int command, unsigned int sequence);
+
+/*
+ * Acknowledging at once all the data deliveries handled since the last
+ * acknowledgement
+ */
+void acknowledge_deliveries(Connection *conn);
+
+/*
+ * Creating packets to be sent back to client according to actual state of
+ * the server
+ */
+void reply_from_server(Connection *conn, int status_read, 
+		       PacketView *readPacket);
+
+/*
+ * Error packet sent for the given reason, the connection going back to its
+ * initial state
+ */
+Packet * error_reply(Connection *conn, unsigned int sequence, int reason);
+
+/*
+ * Telling the client that the bytes received don't make a valid packet,
+ * the error is sent before the connection is closed
+ */
+void invalid_received(Connection *conn);
+
+/*
+ * Agreeing with the client on the parameters it offered in its hello,
+ * the parameters of the server hello are written and their size returned
+ */
+unsigned int agree_on_hello(Connection *conn, PacketView *readPacket,
+			    unsigned char *helloBytes);
+
+/*
+ * Handling the received data, (DELIVERY and STORE)
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
+ */
+int data_handler(Connection *conn, PacketView *readPacket);
+
+/*
+ * Handling the received data of a transfer shared with other connections,
+ * each data part is written at its position
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
+ */
+int transfer_data_handler(Connection *conn, PacketView *readPacket);
+
+/*
+ * Giving its final name to a received file, already checked, synced with
+ * other files in the background under group commit: the store is then
+ * acknowledged once it is done, the upload is free-ed
+ *
+ * Returns ERR if the file can't be stored, OK otherwise
+ */
+int store_upload(Connection *conn, Upload *upload, const char *targetName);
+
+/*
+ * Handling the received data of a file sent as a list of chunks, the
+ * chunks missing in the store are asked to the client then received
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
+ */
+int dedup_data_handler(Connection *conn, PacketView *readPacket);
+
+/*
+ * CRC32C of the whole file carried by a store, NULL if the client doesn't
+ * check the file
+ */
+const uint32_t * file_checksum(Connection *conn, PacketView *readPacket);
+
+/*
+ * Path of a file of the storage directory
+ */
+void storage_path(const char *name, char *path);
+
+/*
+ * Path the stored file takes: the name carried by the store if any, else
+ * the one of its transfer, else the default one
+ *
+ * Returns ERR if the name carried is not a plain file name
+ */
+int target_name(Connection *conn, PacketView *readPacket, char *targetName);
+
+/*
+ * CRC32C of a data part as it is stored, the one already checked unless
+ * the data part was decompressed
+ */
+uint32_t data_checksum(PacketView *readPacket);
+
+int main(int argc, char **argv)
+{
+	int numWorkers = 1;
+	int numIoThreads = 0;
+	const char *metricsPort = NULL;
+	int option;
+
+	init_socket_options(&socketOptions);
+	while((option = getopt(argc, argv, "a:b:D:M:no:P:qR:sS:t:uw:W:"))
+	      != -1){
+		switch (option) {
+		case 'a':
+			socketOptions.host = optarg;
+			break;
+		case 'b':
+			socketOptions.backlog = atoi(optarg);
+			break;
+		case 'D':
+			if(strcmp(optarg, "none") == 0){
+				durability = DURABILITY_NONE;
+			}else if(strcmp(optarg, "fdatasync") == 0){
+				durability = DURABILITY_FDATASYNC;
+			}else if(strcmp(optarg, "dsync") == 0){
+				durability = DURABILITY_DSYNC;
+			}else if(strcmp(optarg, "group") == 0){
+				durability = DURABILITY_GROUP;
+			}else{
+				fprintf(stderr, "#Error: durability must be \
+none, fdatasync, dsync or group\n");
+				return ERR;
+			}
+			break;
+		case 'M':
+			metricsPort = optarg;
+			break;
+		case 'n':
+			socketOptions.noDelay = 1;
+			break;
+		case 'o':
+			storageDirectory = optarg;
+			break;
+		case 'P':
+			socketOptions.port = optarg;
+			break;
+		case 'q':
+			socketOptions.quickAck = 1;
+			break;
+		case 'R':
+			socketOptions.receiveBuffer = atoi(optarg);
+			break;
+		case 'S':
+			socketOptions.sendBuffer = atoi(optarg);
+			break;
+		case 't':
+			numWorkers = atoi(optarg);
+			break;
+		case 'w':
+			uploadWindowSize = (unsigned int)(atoi(optarg));
+			break;
+		case 'W':
+			numIoThreads = atoi(optarg);
+			break;
+		case 's':
+			useSplice = 1;
+			break;
+		case 'u':
+			useRing = 1;
+			break;
+		default:
+			fprintf(stderr, "#Usage: %s [-a address] [-b backlog] \
+[-D none|fdatasync|dsync|group] [-M metrics_port] [-n] [-o storage_directory] \
+[-P port] [-q] [-R receive_buffer_size] [-s] [-S send_buffer_size] \
+[-t number_of_threads] [-u] [-w window_size_in_bytes] \
+[-W number_of_io_threads]\n", argv[0]);
+			return ERR;
+		}
+	}
+	if(socketOptions.backlog < 1){
+		fprintf(stderr, "#Error: backlog must be positive\n");
+		return ERR;
+	}
+	if(socketOptions.receiveBuffer < 0 || socketOptions.sendBuffer < 0){
+		fprintf(stderr, "#Error: socket buffer sizes can't be \
+negative\n");
+		return ERR;
+	}
+	if(numWorkers < 1 || numWorkers > MAX_WORKERS){
+		fprintf(stderr, "#Error: number of threads must be between \
+1 and %d\n", MAX_WORKERS);
+		return ERR;
+	}
+	if(uploadWindowSize < 1){
+		fprintf(stderr, "#Error: window size must be positive\n");
+		return ERR;
+	}
+	if(numIoThreads < 0){
+		fprintf(stderr, "#Error: number of I/O threads can't be \
+negative\n");
+		return ERR;
+	}
+
+	//The bytes received through io_uring are already out of the socket
+	if(useRing && useSplice){
+		fprintf(stderr, "#Warning: no splice with io_uring, data parts \
+are copied\n");
+		useSplice = 0;
+	}
+
+	//The ring writes the uploads itself, the I/O threads would never be
+	//given a window
+	if(useRing && numIoThreads > 0){
+		fprintf(stderr, "#Error: no I/O threads with io_uring, the \
+uploads are written by the ring\n");
+		return ERR;
+	}
+
+	//A data delivery bigger than a window is not buffered whole
+	set_frame_limit(uploadWindowSize);
+
+	//The chunks of the deduplicated files are stored next to them, so
+	//that the files are built and renamed on the same file system
+	set_chunk_store_directory(storageDirectory);
+
+	//The uploads are written by their own threads, so that a slow disk
+	//doesn't stop the reception
+	if(numIoThreads > 0 && start_io_threads(numIoThreads) == ERR){
+		return ERR;
+	}
+
+	//The stored files are synced by batches in the background
+	set_durability(durability);
+	if(durability == DURABILITY_GROUP){
+		start_group_commit();
+	}
+
+	//The counters are scraped on their own port, same address as the
+	//clients
+	if(metricsPort != NULL){
+		SocketOptions metricsOptions = socketOptions;
+		metricsOptions.port = metricsPort;
+		if(start_metrics_listener(&metricsOptions) == ERR){
+			return ERR;
+		}
+	}
+
+	//A client leaving before reading our reply must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	//Only one event loop, served by the main thread
+	if(numWorkers == 1){
+		return useRing ? run_ring_loop(0) : run_event_loop(0);
+	}
+
+	//Each worker has its own listening socket on the same port and
+	//its own event loop, the kernel spreads the new clients among them
+	pthread_t workers[MAX_WORKERS];
+	int i;
+	for(i=0; i<numWorkers; i++){
+		Pthread_create(&workers[i], NULL, worker_thread, NULL);
+	}
+	for(i=0; i<numWorkers; i++){
+		Pthread_join(workers[i], NULL);
+	}
+
+	return OK;
+}
+
+/*
+ * Entry point of a worker thread running its own event loop
+ */
+void *worker_thread(void *args)
+{
+	(void)(args);
+	int status = useRing ? run_ring_loop(1) : run_event_loop(1);
+	if(status == ERR){
+		fprintf(stderr, "Worker stopped\n");
+	}
+	return NULL;
+}
+
+/*
+ * Running an event loop, on a new listening socket, which serves all
+ * its clients at the same time
+ */
+int run_event_loop(int reusePort)
+{
+	//Preparing the server
+	int server_fd = server_listening(&socketOptions, reusePort);
+	if(server_fd == ERR){
+		fprintf(stderr, "Error of establishing a server socket\n");
+		return ERR;
+	}
+	if(set_nonblocking(server_fd) == ERR){
+		fprintf(stderr, "Error of establishing a server socket\n");
+		return ERR;
+	}
+
+	//Preparing the event loop, the listening socket is the only
+	//one registered without a connection context
+	int epoll_fd = epoll_create1(0);
+	if(epoll_fd < 0){
+		fprintf(stderr, "Error of creating the event loop\n");
+		return ERR;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event) < 0){
+		fprintf(stderr, "Error of creating the event loop\n");
+		return ERR;
+	}
+
+	//The commits done are told by their event file
+	if(durability == DURABILITY_GROUP){
+		commitWaiter = init_commit_waiter();
+		event.events = EPOLLIN;
+		event.data.ptr = commitWaiter;
+		if(commitWaiter == NULL ||
+		   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, commitWaiter->eventFd,
+			     &event) < 0){
+			fprintf(stderr, "Error of creating the event loop\n");
+			return ERR;
+		}
+	}
+
+	//The writes done by the I/O threads are told by its event file
+	if(num_io_threads() > 0){
+		writeWaiter = init_write_waiter();
+		event.events = EPOLLIN;
+		event.data.ptr = writeWaiter;
+		if(writeWaiter == NULL ||
+		   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, writeWaiter->eventFd,
+			     &event) < 0){
+			fprintf(stderr, "Error of creating the event loop\n");
+			return ERR;
+		}
+	}
+
+	struct epoll_event readyEvents[MAX_EVENTS];
+	int numReadyEvents;
+	int i;
+
+        while(1){
+		numReadyEvents = epoll_wait(epoll_fd, readyEvents, MAX_EVENTS, 
+					    -1);
+		if(numReadyEvents < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Error of waiting for events\n");
+			break;
+		}
+
+		for(i=0; i<numReadyEvents; i++){
+			Connection *conn = readyEvents[i].data.ptr;
+
+			//New requests from the clients
+			if(conn == NULL){
+				accept_clients(epoll_fd, server_fd);
+				continue;
+			}
+
+			//Stores whose files are on the disk, their
+			//connections were only waiting for them
+			if(readyEvents[i].data.ptr == commitWaiter){
+				CommitRequest *request = 
+					take_done_commits(commitWaiter);
+				while(request != NULL){
+					CommitRequest *next = request->next;
+					conn = store_committed(request);
+					finish_connection(epoll_fd, conn);
+					request = next;
+				}
+				continue;
+			}
+
+			//Uploads whose windows are written, their
+			//connections may read again
+			if(readyEvents[i].data.ptr == writeWaiter){
+				resume_connections(epoll_fd);
+				continue;
+			}
+
+			//A closing connection is only sending its last
+			//replies
+			if(conn->closing){
+				finish_connection(epoll_fd, conn);
+				continue;
+			}
+
+			//A stalled one too, until its writes catch up
+			if(conn->stalled){
+				if(connection_flush(conn) == ERR){
+					unstall_connection(conn);
+					finish_connection(epoll_fd, conn);
+				}
+				continue;
+			}
+
+			//Close the current connection after finishing
+			//the job for one client or if there is any error
+			if(serve_client(conn) != OK){
+				finish_connection(epoll_fd, conn);
+			}else if(conn->stalled){
+				stall_connection(epoll_fd, conn);
+			}
+		}
+	}
+
+	close(epoll_fd);
+	close(server_fd);
+	return OK;
+}
+
+/*
+ * Running an event loop with io_uring, on a new listening socket, which
+ * serves all its clients at the same time, the epoll one is run instead
+ * if the kernel doesn't have what is needed
+ */
+int run_ring_loop(int reusePort)
+{
+	//Preparing the ring first, the listening socket of the epoll loop
+	//is its own, the receptions are tried once before being relied on
+	IoRing *ring = init_io_ring(IO_RING_ENTRIES);
+	if(ring == NULL || 
+	   io_ring_provide_buffers(ring, RING_BUFFERS, READ_CHUNK_SIZE) 
+	   == ERR || io_ring_probe_receive(ring) == ERR){
+		fprintf(stderr, "#Warning: io_uring not available, back to \
+epoll\n");
+		if(ring != NULL){
+			free_io_ring(ring);
+		}
+		return run_event_loop(reusePort);
+	}
+
+	//Preparing the server
+	int server_fd = server_listening(&socketOptions, reusePort);
+	if(server_fd == ERR){
+		fprintf(stderr, "Error of establishing a server socket\n");
+		free_io_ring(ring);
+		return ERR;
+	}
+
+	//All the clients are accepted with one request, then each one
+	//is received from with one request of its own
+	workerRing = ring;
+	io_ring_accept(ring, server_fd, RING_ACCEPT);
+
+	//The commits done are told by their event file
+	if(durability == DURABILITY_GROUP){
+		commitWaiter = init_commit_waiter();
+		if(commitWaiter == NULL){
+			free_io_ring(ring);
+			close(server_fd);
+			return ERR;
+		}
+		io_ring_poll(ring, commitWaiter->eventFd, POLLIN, RING_COMMITS);
+	}
+
+	IoRingCompletion completion;
+	while(1){
+		if(io_ring_submit(ring, 1) == ERR){
+			fprintf(stderr, "Error of waiting for completions\n");
+			break;
+		}
+		while(io_ring_next_completion(ring, &completion)){
+			handle_ring_completion(ring, server_fd, &completion);
+		}
+	}
+
+	workerRing = NULL;
+	free_io_ring(ring);
+	close(server_fd);
+	return ERR;
+}
+
+/*
+ * Handling the completion of one request of the io_uring event loop
+ */
+void handle_ring_completion(IoRing *ring, int server_fd, 
+			    IoRingCompletion *completion)
+{
+	int operation = (int)(completion->userData & RING_OPERATION_MASK);
+	Connection *conn = (Connection *)(uintptr_t)(completion->userData & 
+						     ~(uint64_t)
+						     (RING_OPERATION_MASK));
+	int lastOne = !(completion->flags & IORING_CQE_F_MORE);
+	CommitRequest *request;
+	CommitRequest *nextRequest;
+
+	switch(operation){
+	case RING_ACCEPT:
+		if(completion->result >= 0){
+			conn = init_connection(completion->result, 
+					       STATE_INIT);
+			if(socketOptions.quickAck){
+				conn->quickAck = 1;
+				set_quickack(conn->fd);
+			}
+			conn->receiving = 1;
+			conn->numRingRequests = 1;
+			io_ring_receive(ring, conn->fd, 
+					(uint64_t)(uintptr_t)(conn) | 
+					RING_RECEIVE);
+		}else if(completion->result != -EINTR && 
+			 completion->result != -ECONNABORTED){
+			fprintf(stderr, "Error of accepting a new \
+connection request. Retrying!\n");
+		}
+		//The kernel stopped accepting for us (no more room for
+		//its completions), it is asked again
+		if(lastOne){
+			io_ring_accept(ring, server_fd, RING_ACCEPT);
+		}
+		return;
+
+	case RING_COMMITS:
+		//Stores whose files are on the disk, their connections
+		//were only waiting for them
+		request = take_done_commits(commitWaiter);
+		while(request != NULL){
+			nextRequest = request->next;
+			conn = store_committed(request);
+			close_ring_connection(ring, conn);
+			settle_ring_connection(ring, conn);
+			request = nextRequest;
+		}
+		io_ring_poll(ring, commitWaiter->eventFd, POLLIN, RING_COMMITS);
+		return;
+
+	case RING_RECEIVE:
+		if(lastOne){
+			conn->receiving = 0;
+			conn->numRingRequests--;
+		}
+		if(completion->result > 0){
+			int status = OK;
+			if(!conn->closing){
+				status = serve_ring_bytes(conn, 
+					io_ring_buffer(ring, completion->flags),
+					(unsigned int)(completion->result));
+			}
+			io_ring_recycle_buffer(ring, completion->flags);
+			if(status != OK){
+				close_ring_connection(ring, conn);
+			}
+		}else if(completion->result != -ENOBUFS){
+			//Client closed the connection, or error
+			if(completion->result < 0 && 
+			   completion->result != -ECANCELED){
+				fprintf(stderr, "Error of reading from a \
+client\n");
+			}
+			close_ring_connection(ring, conn);
+		}
+
+		//Out of buffers for a while, the reception is asked again
+		if(!conn->closing && !conn->receiving){
+			conn->receiving = 1;
+			conn->numRingRequests++;
+			io_ring_receive(ring, conn->fd, 
+					(uint64_t)(uintptr_t)(conn) | 
+					RING_RECEIVE);
+		}
+		break;
+
+	case RING_SEND_POLL:
+		conn->pollingSend = 0;
+		conn->numRingRequests--;
+		//A closing connection is still sending its last replies,
+		//unless the client is gone
+		if(connection_flush(conn) == ERR){
+			conn->sendLength = 0;
+			close_ring_connection(ring, conn);
+		}
+		break;
+
+	case RING_CANCEL:
+		conn->numRingRequests--;
+		break;
+	}
+
+	settle_ring_connection(ring, conn);
+}
+
+/*
+ * Waiting for the socket of a connection of the io_uring event loop to be
+ * writable if bytes are left to send, or free-ing it once it is closed and
+ * nothing is left of it
+ */
+void settle_ring_connection(IoRing *ring, Connection *conn)
+{
+	//What the socket didn't accept is sent once it is writable, the
+	//context of a closing connection is kept until then
+	if(conn->sendLength > 0 && !conn->pollingSend){
+		conn->pollingSend = 1;
+		conn->numRingRequests++;
+		io_ring_poll(ring, conn->fd, POLLOUT, 
+			     (uint64_t)(uintptr_t)(conn) | RING_SEND_POLL);
+	}
+
+	if(conn->closing && conn->numRingRequests == 0 && 
+	   !conn->commitPending){
+		free_connection(conn);
+	}
+}
+
+/*
+ * Moving forward the job of one client with bytes received through
+ * io_uring
+ *
+ * Returns DONE once the job of the client is finished, ERR if the packets
+ * are invalid, OK otherwise
+ */
+int serve_ring_bytes(Connection *conn, const unsigned char *bytes,
+		     unsigned int numBytes)
+{
+	PacketView readPacket;
+	unsigned int numTakenBytes;
+	int status;
+
+	if(conn->quickAck){
+		set_quickack(conn->fd);
+	}
+
+	//The packets are handled as the bytes fill the receive buffer,
+	//whatever is left is taken once they made room for it
+	while(numBytes > 0){
+		//The rest of a data part too big to be buffered is copied
+		//to the upload from the buffer of the ring
+		if(conn->spliceRemaining > 0){
+			int numMovedBytes = connection_stream_bytes(conn, bytes,
+								    numBytes);
+			if(numMovedBytes == ERR){
+				return ERR;
+			}
+			bytes += numMovedBytes;
+			numBytes -= numMovedBytes;
+			if(conn->spliceRemaining == 0){
+				delivery_moved(conn);
+			}
+			continue;
+		}
+
+		//The whole packets are handled in place in the buffer of the
+		//ring as long as nothing is buffered before them
+		status = connection_packet_in(conn, bytes, numBytes, 
+					      &readPacket, &numTakenBytes);
+		if(status == ERR){
+			invalid_received(conn);
+			return ERR;
+		}
+		if(status == OK){
+			bytes += numTakenBytes;
+			numBytes -= numTakenBytes;
+			if(handle_packet(conn, &readPacket) == DONE){
+				return DONE;
+			}
+			continue;
+		}
+
+		numTakenBytes = connection_receive_bytes(conn, bytes, 
+							 numBytes);
+		bytes += numTakenBytes;
+		numBytes -= numTakenBytes;
+
+		status = serve_received(conn);
+		if(status != OK){
+			return status;
+		}
+		if(numTakenBytes == 0){
+			fprintf(stderr, "Error of receiving from a client: \
+packet too big\n");
+			return ERR;
+		}
+	}
+
+	//One acknowledgement for the packets handled in place as well
+	acknowledge_deliveries(conn);
+	return OK;
+}
+
+/*
+ * Closing a connection of the io_uring event loop, its reception still
+ * armed is cancelled and its context is free-ed after its last request,
+ * once the bytes queued for its client are sent
+ */
+void close_ring_connection(IoRing *ring, Connection *conn)
+{
+	if(conn->closing){
+		return;
+	}
+	conn->closing = 1;
+
+	if(conn->receiving){
+		conn->numRingRequests++;
+		io_ring_cancel(ring, (uint64_t)(uintptr_t)(conn) | RING_RECEIVE,
+			       (uint64_t)(uintptr_t)(conn) | RING_CANCEL);
+	}
+}
+
+/*
+ * Acknowledging a store whose file is now on the disk (group commit), the
+ * connection waiting for it is closed once the acknowledgement is sent
+ *
+ * Returns the connection of the store
+ */
+Connection * store_committed(CommitRequest *request)
+{
+	Connection *conn = request->context;
+	conn->commitPending = 0;
+	metrics_store_done(metrics_now() - conn->storeStart);
+
+	if(request->status == OK){
+		fprintf(stderr, "SAVING DATA DONE into %s\n", 
+			request->targetName);
+	}else{
+		metrics_error_sent(ERROR_REASON_STORE);
+	}
+	//What the socket doesn't take now is sent once it is writable,
+	//the connection is kept until then
+	if(conn->version == VERSION_EXTENDED){
+		acknowledge(conn, (request->status == OK) ? ACK : ERROR,
+			    conn->storeSequence);
+		connection_flush(conn);
+	}
+
+	free(request);
+	return conn;
+}
+
+/*
+ * Accepting all the pending requests from the clients and registering them
+ * to the event loop
+ */
+void accept_clients(int epoll_fd, int server_fd)
+{
+	int client_fd;
+	struct sockaddr_storage clientAddress; //IPv4 or IPv6
+	socklen_t addLength;
+	struct epoll_event event;
+
+	while(1){
+		addLength = (socklen_t)(sizeof(struct sockaddr_storage));
+		client_fd = accept4(server_fd, 
+				    (struct sockaddr *)(&clientAddress), 
+				    &addLength, SOCK_NONBLOCK);
+		if(client_fd < 0){
+			//No more pending request for now
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return;
+			}
+			if(errno == EINTR || errno == ECONNABORTED){
+				continue;
+			}
+			fprintf(stderr, "Error of accepting a new \
+connection request. Retrying!\n");
+			return;
+		}
+
+		//Edge-triggered, so a client is served until its socket
+		//has nothing more for us
+		Connection *conn = init_connection(client_fd, STATE_INIT);
+		if(socketOptions.quickAck){
+			conn->quickAck = 1;
+			set_quickack(client_fd);
+		}
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = conn;
+		if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0){
+			fprintf(stderr, "Error of registering a new \
+connection\n");
+			free_connection(conn);
+		}
+	}
+}
+
+/*
+ * Closing a connection of the epoll event loop once the bytes queued for
+ * its client are sent, it stays registered for its socket to be writable
+ * until then, and until its store is acknowledged if it is still being
+ * committed
+ */
+void finish_connection(int epoll_fd, Connection *conn)
+{
+	conn->closing = 1;
+
+	//Its store is acknowledged first, it is finished again then
+	if(conn->commitPending){
+		return;
+	}
+
+	//The last replies are sent at the next writable events, unless
+	//the client is gone
+	if(connection_flush(conn) == OK && conn->sendLength > 0){
+		return;
+	}
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	free_connection(conn);
+}
 
 /*
- * Creating packets to be sent back to client according to actual state of
- * the server
+ * Stopping reading a connection whose upload has too many windows not
+ * written yet, only its replies are sent until the I/O threads catch up
  */
-void reply_from_server(int client_fd, int status_read, int *current_state, 
-		       Packet *readPacket);
+void stall_connection(int epoll_fd, Connection *conn)
+{
+	struct epoll_event event;
+	event.events = EPOLLOUT|EPOLLRDHUP|EPOLLET;
+	event.data.ptr = conn;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+
+	conn->nextStalled = stalledConnections;
+	stalledConnections = conn;
+}
 
 /*
- * Handling the received data, (DELIVERY and STORE)
+ * Reading again the stalled connections whose uploads can take more data,
+ * once the I/O threads told the event loop that writes are done
  */
-void data_handler(int *current_state, Packet *readPacket, 
-		  unsigned char **bytesToSave, int *sizeBytesToSave);
+void resume_connections(int epoll_fd)
+{
+	take_write_notice(writeWaiter);
+
+	//The ones still stalled are put back in the list
+	Connection *conn = stalledConnections;
+	stalledConnections = NULL;
+	while(conn != NULL){
+		Connection *next = conn->nextStalled;
+		if(upload_writes_stalled(conn->upload)){
+			conn->nextStalled = stalledConnections;
+			stalledConnections = conn;
+			conn = next;
+			continue;
+		}
+
+		conn->stalled = 0;
+		struct epoll_event event;
+		event.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		event.data.ptr = conn;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+
+		//The bytes arrived meanwhile are read now, not at an event
+		if(serve_client(conn) != OK){
+			finish_connection(epoll_fd, conn);
+		}else if(conn->stalled){
+			stall_connection(epoll_fd, conn);
+		}
+		conn = next;
+	}
+}
 
 /*
- * Writing the whole contents into a file
+ * Taking a stalled connection out of the list, before it is free-ed
  */
-void write_whole_file(const char *filename, char *file_contents, 
-		      int filesize);
+void unstall_connection(Connection *conn)
+{
+	Connection **link = &stalledConnections;
+	while(*link != conn){
+		link = &((*link)->nextStalled);
+	}
+	*link = conn->nextStalled;
+	conn->stalled = 0;
+}
 
-int main()
+/*
+ * Moving forward the job of one client with all the bytes available
+ * on its socket
+ */
+int serve_client(Connection *conn)
 {
-	//Preparing the server
-	int server_fd = server_listening();
-	if(server_fd == ERR){
-		fprintf(stderr, "Error of establishing a server socket\n");
+	int status_read;
+	int numReadBytes;
+
+	//Sending first what has been left from the previous time
+	if(connection_flush(conn) == ERR){
 		return ERR;
 	}
 
-	int client_fd;
-	struct sockaddr_in clientAddress;
-	socklen_t addLength = (socklen_t)(sizeof(struct sockaddr_in));
-	Packet *readPacket = NULL;
-	int current_state = STATE_INIT;
-	int status_read = ERR;
-
-	//Information regarding file to store
-	unsigned char *bytesToSave = NULL;
-	int sizeBytesToSave = 0;
-	
-        while(1){
-		//Renew the acceptation of connection
-		if(current_state == STATE_INIT)
-		{
-			status_read = ERR;
-			bytesToSave = NULL;
-
-			//Accepting a new request from the client
-			client_fd = accept(server_fd, 
-					   (struct sockaddr *)(&clientAddress), 
-					   &addLength);
-			if(client_fd < 0){
-				fprintf(stderr, "Error of accepting a new \
-connection request. Retrying!\n");
-				break;
-			}
+	while(1){
+		//Nothing more is read while the windows of the upload are
+		//not written as fast as they come
+		if(conn->upload != NULL && upload_writes_stalled(conn->upload)){
+			conn->stalled = 1;
+			return OK;
 		}
 
-		//At each iteration, we ensure the server
-		//to receive a packet from the client, but we may not
-		//get any packet or incurate packet
-		status_read = read_check_packet(client_fd, 
-						&readPacket);
-		
-		//We sent packets to client, or we skip it incase of
-		//no packet received before this sending process
-		reply_from_server(client_fd, status_read, &current_state, 
-				  readPacket);
-
-		//Handling the data if the reading process passed
-		if(status_read == OK)
-		{
-			data_handler(&current_state, readPacket, 
-				     &bytesToSave, &sizeBytesToSave);
-			if(readPacket != NULL)
-			{
-				free_packet_for_read(readPacket);
+		//The rest of a data part goes straight to the upload,
+		//spliced or copied as it is read
+		if(conn->spliceRemaining > 0){
+			numReadBytes = useSplice ? connection_splice(conn) :
+				connection_stream(conn);
+			if(numReadBytes == ERR){
+				return ERR;
+			}
+			if(numReadBytes == 0){
+				return OK;
 			}
+			if(conn->spliceRemaining == 0){
+				delivery_moved(conn);
+			}
+			continue;
+		}
+
+		numReadBytes = connection_receive(conn);
+		if(numReadBytes == ERR){
+			return ERR;
+		}
+		//Nothing more to read until the next event
+		if(numReadBytes == 0){
+			return OK;
+		}
+
+		status_read = serve_received(conn);
+		if(status_read != OK){
+			return status_read;
+		}
+	}
+}
+
+/*
+ * Handling all the whole packets received from the client, then the
+ * beginning of a big data part to be moved to the upload if any, and
+ * acknowledging them at once
+ *
+ * Returns DONE once the job of the client is finished, ERR if the packets
+ * are invalid, OK otherwise
+ */
+int serve_received(Connection *conn)
+{
+	PacketView readPacket;
+	int status_read;
+
+	//We handle all the whole packets received, an incomplete packet
+	//stays in the buffer for later
+	while((status_read = connection_next_packet(conn, &readPacket)) 
+	      == OK){
+		//End of the job for this client or error
+		if(handle_packet(conn, &readPacket) == DONE){
+			return DONE;
+		}
+	}
+	if(status_read == ERR){
+		invalid_received(conn);
+		return ERR;
+	}
+
+	//The beginning of a big data part is handled now, its rest will
+	//be moved by the kernel without being read, or copied as it is
+	//read if too big to be buffered, a chunk is checked against its
+	//digest so it is read whole
+	if(conn->dedup == NULL &&
+	   connection_take_partial_packet(conn, &readPacket, useSplice) 
+	   == OK){
+		if(handle_packet(conn, &readPacket) == DONE){
+			return DONE;
 		}
+	}
+
+	//One acknowledgement for all the packets of this read
+	acknowledge_deliveries(conn);
+	return OK;
+}
+
+/*
+ * Acknowledging a data delivery whose rest has been moved to the upload
+ * straight from the socket
+ */
+void delivery_moved(Connection *conn)
+{
+	if(conn->version == VERSION_EXTENDED){
+		conn->storedSequence = conn->lastSequence;
+		conn->ackPending = 1;
+		acknowledge_deliveries(conn);
+	}
+}
+
+/*
+ * Handling one whole packet (or the beginning of one to be moved)
+ * received from the client: reply, data and acknowledgement
+ *
+ * Returns DONE once the job of the client is finished, OK otherwise
+ */
+int handle_packet(Connection *conn, PacketView *readPacket)
+{
+	//Nothing is expected once the store is being committed
+	if(conn->commitPending){
+		return DONE;
+	}
+
+	metrics_received(readPacket->packet_header.command,
+			 readPacket->packet_header.length);
+
+	//We sent packets to client, or we skip it
+	reply_from_server(conn, OK, readPacket);
+
+	//Handling the data
+	int storing = (conn->current_state == STATE_STORE);
+	if(storing){
+		conn->storeStart = metrics_now();
+	}
+	int status_data = data_handler(conn, readPacket);
+
+	//Data which couldn't be written, or a file which couldn't take its
+	//name, is counted whether or not the client is told
+	if(status_data == ERR){
+		metrics_error_sent(ERROR_REASON_STORE);
+	}
+
+	//A store committed in the background is counted once acknowledged
+	if(storing && !conn->commitPending){
+		metrics_store_done(metrics_now() - conn->storeStart);
+	}
 
-		//Close the current connection after finishing
-		//the job for one client or if there is any error
-		if(current_state == STATE_INIT)
-		{
-			status_read = ERR;
-			bytesToSave = NULL;
-			close(client_fd);
+	//A client of extended version waits for its deliveries and its
+	//store to be acknowledged, a spliced delivery is acknowledged
+	//once its rest is moved
+	if(conn->version == VERSION_EXTENDED){
+		if(storing && conn->commitPending){
+			//Acknowledged once its file is on the disk
+			conn->storeSequence = readPacket->packet_header.sequence;
+		}else if(storing){
+			acknowledge(conn, (status_data == OK) ? ACK : ERROR,
+				    readPacket->packet_header.sequence);
+		}else if(conn->current_state == STATE_DELIVERY && 
+			 conn->spliceRemaining == 0){
+			conn->storedSequence = 
+				readPacket->packet_header.sequence;
+			conn->ackPending = 1;
 		}
 	}
 
+	if(conn->current_state == STATE_INIT){
+		connection_flush(conn);
+		return DONE;
+	}
 	return OK;
 }
 
+/*
+ * Sending an acknowledgement, or an error, for the given sequence number
+ */
+void acknowledge(Connection *conn, int command, unsigned int sequence)
+{
+	Packet *packetToSend = init_packet(conn->version, sequence, command, 
+					   NULL, 0);
+	if(packetToSend == NULL){
+		return;
+	}
+
+	send_to_client(conn, packetToSend);
+	free_packet(packetToSend);
+}
+
+/*
+ * Queuing a packet to be sent to the client, header converted on the stack
+ * then data part if any
+ */
+void send_to_client(Connection *conn, Packet *packetToSend)
+{
+	unsigned char bytesToSend[HEADER_SIZE_EXTENDED];
+	Header *packetHeader = packetToSend->packet_header;
+	unsigned int headerSize = headerToBytes(packetHeader, bytesToSend);
+	metrics_sent(packetHeader->command, packetHeader->length);
+	connection_send(conn, bytesToSend, headerSize);
+	if(packetHeader->length > headerSize){
+		connection_send(conn, packetToSend->packet_data,
+				packetHeader->length - headerSize);
+	}
+}
+
+/*
+ * Acknowledging at once all the data deliveries handled since the last
+ * acknowledgement
+ */
+void acknowledge_deliveries(Connection *conn)
+{
+	if(conn->ackPending){
+		acknowledge(conn, ACK, conn->storedSequence);
+		conn->ackPending = 0;
+	}
+}
+
 /*
  * ACTIONS ACCORDING TO STATE OF SERVER
  *
  * Creating packets to be sent back to client according to actual state of
  * the server
  */
-void reply_from_server(int client_fd, int status_read, int *current_state, 
-		       Packet *readPacket)
+void reply_from_server(Connection *conn, int status_read, 
+		       PacketView *readPacket)
 {
+	int *current_state = &(conn->current_state);
+
 	if(readPacket == NULL){
 		return;
 	}
 
-	Header *readPacketHeader = readPacket->packet_header;
+	Header *readPacketHeader = &(readPacket->packet_header);
+	int previousState = *current_state;
 
 	Packet *packetToSend;
+	unsigned char helloBytes[MAX_HELLO_SIZE];
+	unsigned int helloLength;
 
-	//if process of reading bytes from the client failed
+	//if process of reading bytes from the client failed, or if the
+	//client doesn't use the version of header agreed in hello, or if
+	//a packet of extended version is missing
 	if(status_read == ERR){
-		packetToSend = send_error_packet(
-			readPacketHeader->sequence, &current_state,
-			(int)(STATE_INIT));
+		packetToSend = error_reply(conn, readPacketHeader->sequence,
+					   ERROR_REASON_INVALID);
+	}
+	else if(*current_state != STATE_INIT && 
+		readPacketHeader->version != conn->version){
+		packetToSend = error_reply(conn, readPacketHeader->sequence,
+					   ERROR_REASON_VERSION);
+	}
+	else if(*current_state != STATE_INIT && 
+		conn->version == VERSION_EXTENDED &&
+		readPacketHeader->sequence != conn->lastSequence + 1){
+		packetToSend = error_reply(conn, readPacketHeader->sequence,
+					   ERROR_REASON_SEQUENCE);
 	}
 	//if process of reading bytes from the client passed
 	else{
@@ -138,15 +1322,18 @@ void reply_from_server(int client_fd, int status_read, int *current_state,
 			//INITIAL STATE
 			switch (readPacketHeader->command) {
 			case CLIENT_HELLO:
+				helloLength = agree_on_hello(conn, readPacket,
+							     helloBytes);
 				packetToSend = init_packet(
+					readPacketHeader->version,
 					readPacketHeader->sequence, 
-					SERVER_HELLO, NULL, 0);
+					SERVER_HELLO, helloBytes, helloLength);
 				*current_state = STATE_HELLO;
 				break;
 			default:
-				packetToSend = send_error_packet(
-					readPacketHeader->sequence, 
-					&current_state, (int)(STATE_INIT));
+				packetToSend = error_reply(conn,
+					readPacketHeader->sequence,
+					ERROR_REASON_COMMAND);
 				break;
 			}
 			break;
@@ -157,10 +1344,44 @@ void reply_from_server(int client_fd, int status_read, int *current_state,
 				packetToSend = NULL;
 				*current_state = STATE_DELIVERY;
 				break;
+			case CHUNK_LIST:
+				if(conn->dedup == NULL){
+					packetToSend = error_reply(conn,
+						readPacketHeader->sequence,
+						ERROR_REASON_NO_DEDUP);
+					break;
+				}
+				packetToSend = NULL;
+				*current_state = STATE_CHUNKS;
+				break;
 			default:
-				packetToSend = send_error_packet(
-					readPacketHeader->sequence, 
-					&current_state,(int)(STATE_INIT));
+				packetToSend = error_reply(conn,
+					readPacketHeader->sequence,
+					ERROR_REASON_COMMAND);
+				break;
+			}
+			break;
+		case STATE_CHUNKS:
+			//STATE after receiving CHUNK LIST, the missing chunks
+			//come next, if any
+			switch (readPacketHeader->command) {
+			case CHUNK_LIST:
+				packetToSend = NULL;
+				*current_state = STATE_CHUNKS;
+				break;
+			case DATA_DELIVERY:
+				packetToSend = NULL;
+				*current_state = STATE_DELIVERY;
+				break;
+			case DATA_STORE:
+				fprintf(stderr, "DATA DELIVERY DONE\n");
+				packetToSend = NULL;
+				*current_state = STATE_STORE;
+				break;
+			default:
+				packetToSend = error_reply(conn,
+					readPacketHeader->sequence,
+					ERROR_REASON_COMMAND);
 				break;
 			}
 			break;
@@ -177,87 +1398,489 @@ void reply_from_server(int client_fd, int status_read, int *current_state,
 				*current_state = STATE_STORE;
 				break;
 			default:
-				packetToSend = send_error_packet(
-					readPacketHeader->sequence, 
-					&current_state,(int)(STATE_INIT));
+				packetToSend = error_reply(conn,
+					readPacketHeader->sequence,
+					ERROR_REASON_COMMAND);
 				break;
 			}
 			break;
 		default:
 			//unrecognised error
-			packetToSend = send_error_packet(
-				readPacketHeader->sequence, &current_state,
-				(int)(STATE_INIT));
+			packetToSend = error_reply(conn,
+						   readPacketHeader->sequence,
+						   ERROR_REASON_COMMAND);
 			break;
 		}
 	}
 
+	metrics_transition(previousState, *current_state);
+	conn->lastSequence = readPacketHeader->sequence;
+
 	//If there is packet to send (ERROR OR SERVER HELLO), we sent them
 	if(packetToSend != NULL){
-		//8 bytes data sent
-		char *bytesToSend = (char *)(packetToBytes(packetToSend));
-		Rio_writen(client_fd, bytesToSend, 8);
+		send_to_client(conn, packetToSend);
+		free_packet(packetToSend);
+	}
+}
+
+/*
+ * Error packet sent for the given reason, the connection going back to its
+ * initial state
+ */
+Packet * error_reply(Connection *conn, unsigned int sequence, int reason)
+{
+	int *current_state = &(conn->current_state);
+
+	metrics_error_sent(reason);
+	return send_error_packet(conn->version, sequence, &current_state,
+				 (int)(STATE_INIT));
+}
+
+/*
+ * Telling the client that the bytes received don't make a valid packet,
+ * the error is sent before the connection is closed
+ */
+void invalid_received(Connection *conn)
+{
+	Packet *packetToSend = error_reply(conn, conn->lastSequence + 1,
+					   ERROR_REASON_INVALID);
+	if(packetToSend != NULL){
+		send_to_client(conn, packetToSend);
 		free_packet(packetToSend);
-		free(bytesToSend);
 	}
 }
 
+/*
+ * Agreeing with the client on the parameters it offered in its hello,
+ * the parameters of the server hello are written and their size returned
+ */
+unsigned int agree_on_hello(Connection *conn, PacketView *readPacket,
+			    unsigned char *helloBytes)
+{
+	//A legacy client doesn't offer anything and expects nothing
+	if(readPacket->data_length == 0){
+		return 0;
+	}
+
+	HelloParams offered;
+	if(read_hello(readPacket->packet_data, readPacket->data_length, 
+		      &offered) == ERR){
+		return 0;
+	}
+
+	HelloParams agreed;
+	agreed.version = VERSION;
+	if(offered.version >= VERSION_EXTENDED){
+		agreed.version = VERSION_EXTENDED;
+	}
+	conn->version = agreed.version;
+
+	//Its deliveries are acknowledged with small packets, which the
+	//client waits for: they are not held back for Nagle's algorithm
+	if(agreed.version == VERSION_EXTENDED && !socketOptions.noDelay){
+		set_nodelay(conn->fd);
+	}
+
+	//The connection joins the transfer it belongs to, if any, the
+	//transfer is agreed only if the client sees it again in our hello
+	agreed.transferId = 0;
+	agreed.numStreams = 1;
+	agreed.resume = 0;
+	agreed.resumeOffset = 0;
+	agreed.dedup = 0;
+	agreed.compression = COMPRESSION_NONE;
+	agreed.checksum = CHECKSUM_NONE;
+
+	//Data parts and the whole file are checked against their CRC32C
+	if(offered.checksum == CHECKSUM_CRC32C && 
+	   agreed.version == VERSION_EXTENDED){
+		conn->checksum = CHECKSUM_CRC32C;
+		agreed.checksum = CHECKSUM_CRC32C;
+	}
+
+	//Compressed data parts are decompressed before being handled
+	if(offered.compression == COMPRESSION_LZ4 && 
+	   agreed.version == VERSION_EXTENDED){
+		conn->compression = COMPRESSION_LZ4;
+		agreed.compression = COMPRESSION_LZ4;
+	}
+
+	//A file sent as a list of chunks is built from the chunk store
+	if(offered.dedup && offered.transferId == 0 && 
+	   agreed.version == VERSION_EXTENDED && conn->dedup == NULL){
+		conn->dedup = init_dedup_upload();
+		agreed.dedup = 1;
+	}
+
+	//A resumable transfer goes on from its last checkpoint, its file
+	//is named after its ID
+	if(offered.resume && offered.transferId != 0 && 
+	   offered.numStreams == 1 && agreed.version == VERSION_EXTENDED &&
+	   conn->upload == NULL){
+		char resumeName[MAX_NAME_SIZE];
+		char partName[MAX_NAME_SIZE];
+		snprintf(resumeName, MAX_NAME_SIZE, "%s.resume.", 
+			 DEFAULT_UPLOAD_NAME);
+		expire_resumable_uploads(storageDirectory, resumeName);
+		snprintf(resumeName, MAX_NAME_SIZE, "%s.resume.%016llx", 
+			 DEFAULT_UPLOAD_NAME,
+			 (unsigned long long)(offered.transferId));
+		storage_path(resumeName, partName);
+		conn->upload = resume_upload(partName, uploadWindowSize);
+		if(conn->upload != NULL && workerRing != NULL){
+			upload_use_ring(conn->upload, workerRing);
+		}else if(conn->upload != NULL && writeWaiter != NULL){
+			upload_use_io_threads(conn->upload, writeWaiter);
+		}
+		if(conn->upload != NULL){
+			conn->transferId = offered.transferId;
+			agreed.transferId = offered.transferId;
+			agreed.resume = 1;
+			agreed.resumeOffset = conn->upload->offset;
+			fprintf(stderr, "RESUMING UPLOAD AT %llu\n",
+				(unsigned long long)(agreed.resumeOffset));
+		}
+	}else if(offered.transferId != 0 && 
+		 agreed.version == VERSION_EXTENDED &&
+		 offered.numStreams >= 1 && offered.numStreams <= MAX_STREAMS &&
+		 conn->transfer == NULL){
+		char tempTarget[MAX_NAME_SIZE];
+		storage_path(DEFAULT_UPLOAD_NAME, tempTarget);
+		conn->transfer = attach_transfer(offered.transferId,
+						 offered.numStreams,
+						 tempTarget);
+		if(conn->transfer != NULL){
+			conn->transferId = offered.transferId;
+			agreed.transferId = offered.transferId;
+			agreed.numStreams = offered.numStreams;
+		}
+	}
+
+	return helloToBytes(&agreed, helloBytes);
+}
+
 /*
  * Handling the received data, (DELIVERY and STORE)
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
  */
-void data_handler(int *current_state, Packet *readPacket, 
-		  unsigned char **bytesToSave, int *sizeBytesToSave)
+int data_handler(Connection *conn, PacketView *readPacket)
 {
+	int *current_state = &(conn->current_state);
+	Upload **upload = &(conn->upload);
+
+	if(conn->transfer != NULL){
+		return transfer_data_handler(conn, readPacket);
+	}
+	if(conn->dedup != NULL){
+		return dedup_data_handler(conn, readPacket);
+	}
+
 	/*
 	 * Extra task related to saving DATA according to state
 	 */
-	//If current state is STATE_DELIVERY, we memorise the fragments of data
+	//If current state is STATE_DELIVERY, we append the fragments of data
+	//to the upload, only a window of them stays in memory
 	if(*current_state == STATE_DELIVERY){
-		int sizeActualPacketData = readPacket->packet_header->length-8;
-		*sizeBytesToSave += sizeActualPacketData;
-		if(*sizeBytesToSave > 0){
-			*bytesToSave = realloc(*bytesToSave, 
-						 (*sizeBytesToSave)*
-						 sizeof(unsigned char));
-			memcpy(*bytesToSave + (*sizeBytesToSave) - 
-			       sizeActualPacketData, 
-			       readPacket->packet_data,
-			       sizeActualPacketData);
-		}else{
+		//Positions of data parts only make sense in a transfer,
+		//a resumed one has to go on where its file ends
+		if((readPacket->packet_header.flags & FLAG_OFFSET) &&
+		   (*upload == NULL || !(*upload)->resumable ||
+		    readPacket->data_offset != (uint64_t)((*upload)->offset + 
+							  (*upload)->windowLength))){
+			fprintf(stderr, "DATA DELIVERY OUT OF PLACE\n");
+			*current_state = STATE_INIT;
+			return ERR;
+		}
+		if(*upload == NULL){
+			//Named at the store, its temporary file is in the
+			//storage directory already
+			char tempTarget[MAX_NAME_SIZE];
+			storage_path(DEFAULT_UPLOAD_NAME, tempTarget);
+			*upload = init_upload(tempTarget, uploadWindowSize);
+			if(*upload == NULL){
+				*current_state = STATE_INIT;
+				return ERR;
+			}
+			if(workerRing != NULL){
+				upload_use_ring(*upload, workerRing);
+			}else if(writeWaiter != NULL){
+				upload_use_io_threads(*upload, writeWaiter);
+			}
+		}
+		if(readPacket->data_length > 0){
+			//The checksum of the file is put together from the
+			//ones of the data parts, before they are appended so
+			//that a checkpoint keeps it
+			if(conn->checksum == CHECKSUM_CRC32C){
+				upload_add_checksum(*upload, 
+						    (*upload)->offset + 
+						    (*upload)->windowLength,
+						    data_checksum(readPacket),
+						    readPacket->data_length);
+			}
+			if(upload_append(*upload, readPacket->packet_data, 
+					 readPacket->data_length) == ERR){
+				upload_release(*upload);
+				*upload = NULL;
+				*current_state = STATE_INIT;
+				return ERR;
+			}
+		}else if(readPacket->packet_header.length == 
+			 header_size(readPacket->packet_header.version)){
 			fprintf(stderr, "DATA DELIVERY DONE, BUT ZERO DATA\n");
 		}
+		return OK;
 	}
+
 	//OTHER STATES
-	else{
-		//If current state is state_store, meaning
-		//we will save the delivered data into "server.out"
-		if(*current_state == STATE_STORE){
-			write_whole_file("server.out", 
-					 (char *)(*bytesToSave), 
-					 *sizeBytesToSave);
-			*current_state = STATE_INIT;
-			fprintf(stderr, "SAVING DATA DONE into server.out\n");
+	int status_store = OK;
+
+	//If current state is state_store, meaning
+	//the delivered data takes its final name
+	if(*current_state == STATE_STORE){
+		char targetName[MAX_NAME_SIZE];
+		status_store = ERR;
+		//A name refused leaves a resumable upload to be stored
+		//again later
+		if(*upload != NULL &&
+		   target_name(conn, readPacket, targetName) == ERR){
+			upload_release(*upload);
+		}else if(*upload != NULL && 
+			 file_checksum(conn, readPacket) != NULL &&
+			 upload_verify(*upload, readPacket->checksum) == ERR){
+			upload_abort(*upload);
+		}else if(*upload != NULL && 
+			 store_upload(conn, *upload, targetName) == OK){
+			if(!conn->commitPending){
+				fprintf(stderr, "SAVING DATA DONE into %s\n", 
+					targetName);
+			}
+			status_store = OK;
 		}
+		*upload = NULL;
+		*current_state = STATE_INIT;
+	}
 		
-		//In any case or state, we try to free the delivered data
-		//as we are assured to have the data stored or
-		//in case of error, client needs to restart the whole
-		//programme
-		if(*bytesToSave != NULL){
-			*sizeBytesToSave = 0;
-			free(*bytesToSave);
+	//In any other case, we give up the delivered data
+	//as the client needs to restart the whole programme,
+	//unless the upload can be resumed, a resumed upload is already
+	//there after the hello
+	if(*upload != NULL && *current_state == STATE_INIT){
+		upload_release(*upload);
+		*upload = NULL;
+	}
+
+	return status_store;
+}
+
+/*
+ * Handling the received data of a transfer shared with other connections,
+ * each data part is written at its position
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
+ */
+int transfer_data_handler(Connection *conn, PacketView *readPacket)
+{
+	Transfer *transfer = conn->transfer;
+
+	//Each data part is written at its position straight to the file
+	//shared with the other connections, the rest of a spliced data part
+	//follows it
+	if(conn->current_state == STATE_DELIVERY){
+		if(!(readPacket->packet_header.flags & FLAG_OFFSET)){
+			fprintf(stderr, "DATA DELIVERY WITHOUT POSITION\n");
+			conn->current_state = STATE_INIT;
+			return ERR;
+		}
+		if(readPacket->data_length > 0 &&
+		   upload_write_at(transfer->upload, readPacket->packet_data,
+				   readPacket->data_length, 
+				   readPacket->data_offset) == ERR){
+			conn->current_state = STATE_INIT;
+			return ERR;
+		}
+		conn->spliceOffset = readPacket->data_offset + 
+			readPacket->data_length;
+		return OK;
+	}
+
+	//All our ranges are written, the last connection of the transfer
+	//gives the file its name
+	int status_store = OK;
+	if(conn->current_state == STATE_STORE){
+		char targetName[MAX_NAME_SIZE];
+		Upload *upload = NULL;
+		status_store = target_name(conn, readPacket, targetName);
+		if(status_store == OK){
+			status_store = transfer_store(transfer, 
+						      file_checksum(conn, 
+								    readPacket),
+						      &upload);
+		}
+		if(status_store == OK && upload != NULL){
+			status_store = store_upload(conn, upload, targetName);
+		}
+		if(status_store == OK){
+			conn->transferStored = 1;
+			fprintf(stderr, "SAVING RANGES DONE into %s\n", 
+				targetName);
+		}
+		conn->current_state = STATE_INIT;
+	}
+
+	return status_store;
+}
+
+/*
+ * Giving its final name to a received file, already checked, synced with
+ * other files in the background under group commit: the store is then
+ * acknowledged once it is done, the upload is free-ed
+ *
+ * Returns ERR if the file can't be stored, OK otherwise
+ */
+int store_upload(Connection *conn, Upload *upload, const char *targetName)
+{
+	if(commitWaiter == NULL){
+		return upload_commit(upload, targetName);
+	}
+
+	if(upload_finish(upload) == ERR){
+		return ERR;
+	}
+	queue_commit(commitWaiter, upload, targetName, conn);
+	conn->commitPending = 1;
+	return OK;
+}
+
+/*
+ * Handling the received data of a file sent as a list of chunks, the
+ * chunks missing in the store are asked to the client then received
+ *
+ * Returns ERR if the data can't be stored, OK otherwise
+ */
+int dedup_data_handler(Connection *conn, PacketView *readPacket)
+{
+	DedupUpload *dedup = conn->dedup;
+
+	//Each chunk list is answered with the chunks to be sent
+	if(conn->current_state == STATE_CHUNKS){
+		unsigned int numListed = readPacket->data_length / 
+			CHUNK_ENTRY_SIZE;
+		unsigned char *needBitmap = calloc((numListed + 7)/8 + 1, 
+						   sizeof(unsigned char));
+		if(dedup_add_list(dedup, readPacket->packet_data, 
+				  readPacket->data_length, needBitmap) == ERR){
+			free(needBitmap);
+			conn->current_state = STATE_INIT;
+			return ERR;
 		}
+
+		Packet *packetToSend = init_packet(
+			conn->version, readPacket->packet_header.sequence,
+			CHUNK_NEED, needBitmap, (numListed + 7)/8);
+		if(packetToSend != NULL){
+			send_to_client(conn, packetToSend);
+			free_packet(packetToSend);
+		}
+		free(needBitmap);
+		return OK;
+	}
+
+	//Each chunk received goes to the store
+	if(conn->current_state == STATE_DELIVERY){
+		if(dedup_put_chunk(dedup, readPacket->packet_data, 
+				   readPacket->data_length) == ERR){
+			conn->current_state = STATE_INIT;
+			return ERR;
+		}
+		return OK;
+	}
+
+	//The file is built from the store
+	int status_store = OK;
+	if(conn->current_state == STATE_STORE){
+		char targetName[MAX_NAME_SIZE];
+		status_store = target_name(conn, readPacket, targetName);
+		if(status_store == OK){
+			Upload *upload = dedup_assemble(dedup, targetName, 
+							uploadWindowSize,
+							file_checksum(conn, 
+								      readPacket));
+			status_store = (upload != NULL) ? 
+				store_upload(conn, upload, targetName) : ERR;
+		}
+		if(status_store == OK){
+			fprintf(stderr, "SAVING CHUNKS DONE into %s \
+(%u of %u chunks received)\n", targetName, dedup->numMissing, 
+				dedup->numEntries);
+		}
+		conn->current_state = STATE_INIT;
+	}
+
+	return status_store;
+}
+
+/*
+ * CRC32C of the whole file carried by a store, NULL if the client doesn't
+ * check the file
+ */
+const uint32_t * file_checksum(Connection *conn, PacketView *readPacket)
+{
+	if(conn->checksum == CHECKSUM_CRC32C &&
+	   readPacket->packet_header.command == DATA_STORE &&
+	   (readPacket->packet_header.flags & FLAG_CHECKSUM)){
+		return &(readPacket->checksum);
 	}
+	return NULL;
 }
 
 /*
- * Writing the whole contents into a file
+ * Path of a file of the storage directory
  */
-void write_whole_file(const char *filename, char *file_contents, 
-		      int filesize)
+void storage_path(const char *name, char *path)
 {
-	FILE *new_file = fopen(filename, "wb");
+	snprintf(path, MAX_NAME_SIZE, "%s/%s", storageDirectory, name);
+}
+
+/*
+ * Path the stored file takes: the name carried by the store if any, else
+ * the one of its transfer, else the default one
+ *
+ * Returns ERR if the name carried is not a plain file name
+ */
+int target_name(Connection *conn, PacketView *readPacket, char *targetName)
+{
+	char name[MAX_UPLOAD_NAME_SIZE + 1];
+
+	if(readPacket->data_length > 0){
+		if(!valid_upload_name(readPacket->packet_data, 
+				      readPacket->data_length)){
+			fprintf(stderr, "DATA STORE WITH AN INVALID NAME\n");
+			return ERR;
+		}
+		memcpy(name, readPacket->packet_data, readPacket->data_length);
+		name[readPacket->data_length] = '\0';
+	}else if(conn->transferId != 0){
+		snprintf(name, sizeof(name), "%s.%016llx", DEFAULT_UPLOAD_NAME,
+			 (unsigned long long)(conn->transferId));
+	}else{
+		snprintf(name, sizeof(name), "%s", DEFAULT_UPLOAD_NAME);
+	}
+
+	storage_path(name, targetName);
+	return OK;
+}
 
-	fwrite(file_contents, sizeof(char), filesize, new_file);
-	fclose(new_file);
+/*
+ * CRC32C of a data part as it is stored, the one already checked unless
+ * the data part was decompressed
+ */
+uint32_t data_checksum(PacketView *readPacket)
+{
+	if(readPacket->packet_header.flags & FLAG_COMPRESSED){
+		return crc32c(0, readPacket->packet_data, 
+			      readPacket->data_length);
+	}
+	return readPacket->checksum;
 }
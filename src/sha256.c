@@ -0,0 +1,172 @@
+#include "sha256.h"
+
+//First 32 bits of the fractional parts of the cube roots of the first
+//64 primes (FIPS 180-4)
+static const uint32_t roundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTATE_RIGHT(value, bits) (((value) >> (bits)) | ((value) << (32-(bits))))
+
+/*
+ * Hashing one whole block into the state
+ */
+static void sha256_block(uint32_t *state, const unsigned char *block)
+{
+	uint32_t words[64];
+	int i;
+
+	for(i=0; i<16; i++){
+		words[i] = ((uint32_t)(block[4*i]) << 24) | 
+			((uint32_t)(block[4*i+1]) << 16) |
+			((uint32_t)(block[4*i+2]) << 8) | block[4*i+3];
+	}
+	for(i=16; i<64; i++){
+		uint32_t s0 = ROTATE_RIGHT(words[i-15], 7) ^ 
+			ROTATE_RIGHT(words[i-15], 18) ^ (words[i-15] >> 3);
+		uint32_t s1 = ROTATE_RIGHT(words[i-2], 17) ^ 
+			ROTATE_RIGHT(words[i-2], 19) ^ (words[i-2] >> 10);
+		words[i] = words[i-16] + s0 + words[i-7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for(i=0; i<64; i++){
+		uint32_t S1 = ROTATE_RIGHT(e, 6) ^ ROTATE_RIGHT(e, 11) ^ 
+			ROTATE_RIGHT(e, 25);
+		uint32_t choice = (e & f) ^ (~e & g);
+		uint32_t temp1 = h + S1 + choice + roundConstants[i] + words[i];
+		uint32_t S0 = ROTATE_RIGHT(a, 2) ^ ROTATE_RIGHT(a, 13) ^ 
+			ROTATE_RIGHT(a, 22);
+		uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t temp2 = S0 + majority;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+/*
+ * Initialization of a new SHA-256 computation
+ */
+void sha256_init(Sha256Context *context)
+{
+	context->state[0] = 0x6a09e667;
+	context->state[1] = 0xbb67ae85;
+	context->state[2] = 0x3c6ef372;
+	context->state[3] = 0xa54ff53a;
+	context->state[4] = 0x510e527f;
+	context->state[5] = 0x9b05688c;
+	context->state[6] = 0x1f83d9ab;
+	context->state[7] = 0x5be0cd19;
+	context->numBytes = 0;
+	context->blockLength = 0;
+}
+
+/*
+ * Adding some bytes to a SHA-256 computation
+ */
+void sha256_update(Sha256Context *context, const unsigned char *data,
+		   size_t length)
+{
+	context->numBytes += length;
+
+	//Completing the block started before
+	if(context->blockLength > 0){
+		unsigned int numCopiedBytes = SHA256_BLOCK_SIZE - 
+			context->blockLength;
+		if(numCopiedBytes > length){
+			numCopiedBytes = length;
+		}
+		memcpy(context->block + context->blockLength, data, 
+		       numCopiedBytes);
+		context->blockLength += numCopiedBytes;
+		data += numCopiedBytes;
+		length -= numCopiedBytes;
+
+		if(context->blockLength < SHA256_BLOCK_SIZE){
+			return;
+		}
+		sha256_block(context->state, context->block);
+		context->blockLength = 0;
+	}
+
+	//Whole blocks are hashed in place
+	while(length >= SHA256_BLOCK_SIZE){
+		sha256_block(context->state, data);
+		data += SHA256_BLOCK_SIZE;
+		length -= SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(context->block, data, length);
+	context->blockLength = length;
+}
+
+/*
+ * Finishing a SHA-256 computation, its digest is written to a buffer
+ * given by the caller
+ */
+void sha256_final(Sha256Context *context, unsigned char *digest)
+{
+	uint64_t numBits = context->numBytes * 8;
+
+	//Padding: one bit, zeros, then the length in bits (8bytes)
+	context->block[context->blockLength++] = 0x80;
+	if(context->blockLength > SHA256_BLOCK_SIZE - 8){
+		memset(context->block + context->blockLength, 0, 
+		       SHA256_BLOCK_SIZE - context->blockLength);
+		sha256_block(context->state, context->block);
+		context->blockLength = 0;
+	}
+	memset(context->block + context->blockLength, 0, 
+	       SHA256_BLOCK_SIZE - 8 - context->blockLength);
+	int i;
+	for(i=0; i<8; i++){
+		context->block[SHA256_BLOCK_SIZE-1-i] = 
+			(unsigned char)(numBits >> (8*i));
+	}
+	sha256_block(context->state, context->block);
+
+	for(i=0; i<8; i++){
+		digest[4*i] = (unsigned char)(context->state[i] >> 24);
+		digest[4*i+1] = (unsigned char)(context->state[i] >> 16);
+		digest[4*i+2] = (unsigned char)(context->state[i] >> 8);
+		digest[4*i+3] = (unsigned char)(context->state[i]);
+	}
+}
+
+/*
+ * Computing at once the SHA-256 digest of some bytes
+ */
+void sha256(const unsigned char *data, size_t length, unsigned char *digest)
+{
+	Sha256Context context;
+	sha256_init(&context);
+	sha256_update(&context, data, length);
+	sha256_final(&context, digest);
+}
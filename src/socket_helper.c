@@ -1,85 +1,345 @@
 #include "socket_helper.h"
 
 /*
- * Creating a socket, binding it to localhost:12345 and preparing it
+ * Filling the socket options with their values by default: localhost:12345,
+ * a long queue of connection requests and the settings of the kernel
  */
-int server_listening(void)
-{	//STEP 1 : Creating a socket descriptor for the server
-	int resultSocket = socket(AF_INET, SOCK_STREAM, 0);
-	if(resultSocket < 0){
-		fprintf(stderr, "Error of establishing a server socket \
-[socket()]\n");
+void init_socket_options(SocketOptions *options)
+{
+	options->host = DEFAULT_HOST;
+	options->port = DEFAULT_PORT;
+	options->backlog = LISTENQ;
+	options->receiveBuffer = 0;
+	options->sendBuffer = 0;
+	options->noDelay = 0;
+	options->quickAck = 0;
+}
+
+/*
+ * Applying the socket options to a socket, the sizes of its buffers
+ * and when its segments are sent and acknowledged
+ *
+ * The buffers must be sized before the connection is established
+ * (before listen() or connect()) for the window to be scaled accordingly
+ */
+int set_socket_options(int socket_fd, const SocketOptions *options)
+{
+	if(options->receiveBuffer > 0 && 
+	   setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, 
+		      (const void *)(&(options->receiveBuffer)), 
+		      sizeof(int)) < 0){
+		fprintf(stderr, "Error of sizing a socket buffer \
+[setsockopt()]\n");
 		return ERR;
 	}
-
-	//Removing the binding error for a faster debugging
-	int optValue = 1;
-	if(setsockopt(resultSocket, SOL_SOCKET, SO_REUSEADDR, 
-		      (const void *)(&optValue), sizeof(int)) < 0){
-		fprintf(stderr, "Error of establishing a server socket \
+	if(options->sendBuffer > 0 && 
+	   setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, 
+		      (const void *)(&(options->sendBuffer)), 
+		      sizeof(int)) < 0){
+		fprintf(stderr, "Error of sizing a socket buffer \
 [setsockopt()]\n");
 		return ERR;
 	}
 
-	//STEP 2 : Binding process
-	//we use calloc to initialize the structure with zeros
-	struct sockaddr_in *serverAddress = calloc(1, 
-						   sizeof(struct sockaddr_in));
-	serverAddress->sin_family = AF_INET;
-	serverAddress->sin_port = htons(12345);
-	inet_pton(AF_INET, "127.0.0.1", &(serverAddress->sin_addr));
-	if(bind(resultSocket, (struct sockaddr *)(serverAddress), 
-		sizeof(struct sockaddr_in)) < 0){
-		free(serverAddress);
+	if(options->noDelay && set_nodelay(socket_fd) == ERR){
+		return ERR;
+	}
+	if(options->quickAck && set_quickack(socket_fd) == ERR){
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Looking up the addresses of the host and port of the socket options,
+ * passive ones to bind to or active ones to connect to
+ *
+ * Returns the list to be free-ed with freeaddrinfo(), NULL on failure
+ */
+static struct addrinfo * resolve_address(const SocketOptions *options,
+					 int passive)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC; //IPv4 or IPv6
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG | (passive ? AI_PASSIVE : 0);
+
+	//"*" stands for all the local addresses of a server
+	const char *host = options->host;
+	if(passive && strcmp(host, "*") == 0){
+		host = NULL;
+	}
+
+	struct addrinfo *addresses;
+	int status = getaddrinfo(host, options->port, &hints, &addresses);
+	if(status != 0){
+		fprintf(stderr, "Error of resolving %s:%s [getaddrinfo()] %s\n",
+			options->host, options->port, gai_strerror(status));
+		return NULL;
+	}
+	return addresses;
+}
+
+/*
+ * Creating a socket, binding it to the address and port of the socket
+ * options and preparing it
+ *
+ * With reusePort, several sockets can be bound to the same port and
+ * the kernel spreads the incoming connections among them
+ */
+int server_listening(const SocketOptions *options, int reusePort)
+{
+	struct addrinfo *addresses = resolve_address(options, 1);
+	if(addresses == NULL){
+		return ERR;
+	}
+
+	//The first address the socket can be bound to is kept
+	int resultSocket = ERR;
+	struct addrinfo *address;
+	for(address = addresses; address != NULL; address = address->ai_next){
+		//STEP 1 : Creating a socket descriptor for the server
+		resultSocket = socket(address->ai_family, address->ai_socktype,
+				      address->ai_protocol);
+		if(resultSocket < 0){
+			resultSocket = ERR;
+			continue;
+		}
+
+		//Removing the binding error for a faster debugging
+		int optValue = 1;
+		if(setsockopt(resultSocket, SOL_SOCKET, SO_REUSEADDR, 
+			      (const void *)(&optValue), sizeof(int)) < 0 ||
+		   (reusePort && 
+		    setsockopt(resultSocket, SOL_SOCKET, SO_REUSEPORT, 
+			       (const void *)(&optValue), sizeof(int)) < 0)){
+			fprintf(stderr, "Error of establishing a server socket \
+[setsockopt()]\n");
+			close(resultSocket);
+			resultSocket = ERR;
+			break;
+		}
+
+		//The accepted sockets inherit the options of this one
+		if(set_socket_options(resultSocket, options) == ERR){
+			close(resultSocket);
+			resultSocket = ERR;
+			break;
+		}
+
+		//STEP 2 : Binding process
+		if(bind(resultSocket, address->ai_addr, 
+			address->ai_addrlen) == 0){
+			break;
+		}
+		close(resultSocket);
+		resultSocket = ERR;
+	}
+	freeaddrinfo(addresses);
+	if(resultSocket == ERR){
 		fprintf(stderr, "Error of establishing a server socket \
 [bind()]\n");
 		return ERR;
 	}
 
-	//STEP 3 : Making the socket ready to accept incomming connection
-	if(listen(resultSocket, 1) < 0){
-		free(serverAddress);
+	//STEP 3 : Making the socket ready to accept incomming connection,
+	//with room for many clients connecting at the same time
+	if(listen(resultSocket, options->backlog) < 0){
+		close(resultSocket);
 		fprintf(stderr, "Error of establishing a server socket \
 [listen()]\n");
 		return ERR;
 	}
 
-	free(serverAddress);
 	return resultSocket;
 }
 
 /*
- * Creating a socket, and connecting it to localhost:12345
+ * Creating a socket, and connecting it to the address and port of
+ * the socket options
  */
-int client_connecting(void)
+int client_connecting(const SocketOptions *options)
 {
-	//STEP 1 : Creating a socket descriptor for the client
-	int resultSocket = socket(AF_INET, SOCK_STREAM, 0);
-	if(resultSocket < 0){
-		fprintf(stderr, "Error of establishing a client socket \
-[socket()]\n");
+	struct addrinfo *addresses = resolve_address(options, 0);
+	if(addresses == NULL){
 		return ERR;
 	}
 
-	//STEP 2 : Connecting process to the server
-	//we use calloc to initialize the structure with zeros
-	struct sockaddr_in *serverAddress = calloc(1, 
-						   sizeof(struct sockaddr_in));
-	serverAddress->sin_family = AF_INET;
-	serverAddress->sin_port = htons(12345);
-	inet_pton(AF_INET, "127.0.0.1", &(serverAddress->sin_addr));
-	if(connect(resultSocket, (struct sockaddr *)(serverAddress), 
-		   sizeof(struct sockaddr_in)) < 0){
-		free(serverAddress);
+	//The addresses of the server are tried in turn
+	int resultSocket = ERR;
+	struct addrinfo *address;
+	for(address = addresses; address != NULL; address = address->ai_next){
+		//STEP 1 : Creating a socket descriptor for the client
+		resultSocket = socket(address->ai_family, address->ai_socktype,
+				      address->ai_protocol);
+		if(resultSocket < 0){
+			resultSocket = ERR;
+			continue;
+		}
+		if(set_socket_options(resultSocket, options) == ERR){
+			close(resultSocket);
+			resultSocket = ERR;
+			break;
+		}
+
+		//STEP 2 : Connecting process to the server
+		if(connect(resultSocket, address->ai_addr, 
+			   address->ai_addrlen) == 0){
+			break;
+		}
+		close(resultSocket);
+		resultSocket = ERR;
+	}
+	freeaddrinfo(addresses);
+	if(resultSocket == ERR){
 		fprintf(stderr, "Error of establishing a client socket \
-[bind()]\n");
+[connect()]\n");
 		return ERR;
 	}
 
-	free(serverAddress);
 	return resultSocket;
 }
 
+/*
+ * Switching a socket to non-blocking mode
+ */
+int set_nonblocking(int socket_fd)
+{
+	int flags = fcntl(socket_fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) < 0){
+		fprintf(stderr, "Error of switching a socket to \
+non-blocking mode\n");
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Sending a whole packet (blocking), the header and the checksum are
+ * converted on the stack and sent with the data part in place 
+ * (scatter-gather)
+ */
+void send_packet(int output_fd, Packet *packetToSend)
+{
+	Header *packetHeader = packetToSend->packet_header;
+	unsigned char headerBytes[MAX_PREFIX_SIZE];
+	unsigned int headerSize = prefixToBytes(packetToSend, headerBytes);
+	unsigned char trailerBytes[CHECKSUM_SIZE];
+	unsigned int trailerSize = trailerToBytes(packetToSend, trailerBytes);
+
+	struct iovec packetParts[3];
+	packetParts[0].iov_base = headerBytes;
+	packetParts[0].iov_len = headerSize;
+	packetParts[1].iov_base = packetToSend->packet_data;
+	packetParts[1].iov_len = packetHeader->length - headerSize - 
+		trailerSize;
+	packetParts[2].iov_base = trailerBytes;
+	packetParts[2].iov_len = trailerSize;
+
+	Rio_writev(output_fd, packetParts, (trailerSize > 0) ? 3 : 2);
+}
+
+/*
+ * Sending a whole packet (blocking), the header is sent first and held back
+ * by the kernel, then the data part is sent by the kernel straight from 
+ * a file (zero-copy) at the given position
+ */
+void send_packet_from_file(int output_fd, Packet *packetToSend, int input_fd,
+			   off_t dataOffset)
+{
+	Header *packetHeader = packetToSend->packet_header;
+	unsigned char headerBytes[MAX_PREFIX_SIZE];
+	unsigned int headerSize = prefixToBytes(packetToSend, headerBytes);
+
+	//More bytes are coming, the header must share a segment with them
+	size_t numSentBytes = 0;
+	ssize_t numWrittenBytes;
+	while(numSentBytes < headerSize){
+		numWrittenBytes = send(output_fd, headerBytes + numSentBytes, 
+				       headerSize - numSentBytes, MSG_MORE);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			unix_error("send error");
+		}
+		numSentBytes += numWrittenBytes;
+	}
+
+	unsigned char trailerBytes[CHECKSUM_SIZE];
+	unsigned int trailerSize = trailerToBytes(packetToSend, trailerBytes);
+
+	size_t numRemainingBytes = packetHeader->length - headerSize - 
+		trailerSize;
+	while(numRemainingBytes > 0){
+		numWrittenBytes = sendfile(output_fd, input_fd, &dataOffset,
+					   numRemainingBytes);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			unix_error("sendfile error");
+		}
+		//The file is shorter than expected
+		if(numWrittenBytes == 0){
+			app_error("sendfile error: end of file");
+		}
+		numRemainingBytes -= numWrittenBytes;
+	}
+
+	if(trailerSize > 0){
+		Rio_writen(output_fd, trailerBytes, trailerSize);
+	}
+}
+
+/*
+ * Holding back (or releasing) the bytes sent over a socket until they
+ * fill whole segments
+ */
+int set_cork(int socket_fd, int enabled)
+{
+	if(setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, 
+		      (const void *)(&enabled), sizeof(int)) < 0){
+		fprintf(stderr, "Error of corking a socket [setsockopt()]\n");
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Sending at once the small segments written to a socket, without waiting
+ * for the previous ones to be acknowledged (Nagle's algorithm disabled)
+ */
+int set_nodelay(int socket_fd)
+{
+	int optValue = 1;
+	if(setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, 
+		      (const void *)(&optValue), sizeof(int)) < 0){
+		fprintf(stderr, "Error of disabling Nagle's algorithm \
+[setsockopt()]\n");
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Acknowledging at once the segments received on a socket, the kernel
+ * may fall back to delayed acknowledgements so it is asked again
+ * after each read
+ */
+int set_quickack(int socket_fd)
+{
+	int optValue = 1;
+	if(setsockopt(socket_fd, IPPROTO_TCP, TCP_QUICKACK, 
+		      (const void *)(&optValue), sizeof(int)) < 0){
+		fprintf(stderr, "Error of enabling quick acknowledgements \
+[setsockopt()]\n");
+		return ERR;
+	}
+	return OK;
+}
+
 /*
  * Reading bytes from a file descriptor (server-side or client-side) 
  * for the whole packet
@@ -89,44 +349,54 @@ int read_check_packet(int input_fd, Packet **readPacket)
 	//Values by default
 	*readPacket = NULL;
 
-	//Buffer containing the whole packet
-	char *buffer = calloc(8, sizeof(char));
-	size_t numReadBytes;
-
-	//Read the header first
-	numReadBytes = Rio_readn(input_fd, buffer, 8);
-	if(numReadBytes != 8){
-		free(buffer);
+	//Read the header first, the first 8 bytes tell its version and so
+	//how many bytes are left in the header
+	unsigned char headerBytes[HEADER_SIZE_EXTENDED];
+	size_t numReadBytes = Rio_readn(input_fd, headerBytes, HEADER_SIZE);
+	unsigned int headerSize = header_size(headerBytes[0]);
+	if(numReadBytes == HEADER_SIZE && headerSize > HEADER_SIZE){
+		numReadBytes += Rio_readn(input_fd, headerBytes + HEADER_SIZE, 
+					  headerSize - HEADER_SIZE);
+	}
+	if(headerSize == 0 || numReadBytes != headerSize){
 		fprintf(stderr, "Error of reading packet header\n");
 		return ERR;
 	}
 
 	//Accessing the length of packet found in the header
 	//for the length of data
-	Header *readHeader = read_header((unsigned char *)(buffer));
-	unsigned int dataLength = readHeader->length - 8;
-
+	Header *readHeader = read_header(headerBytes);
+	if(readHeader == NULL || readHeader->length < headerSize){
+		if(readHeader != NULL){
+			free_header(readHeader);
+		}
+		fprintf(stderr, "Error of reading packet header\n");
+		return ERR;
+	}
+	unsigned int packetLength = readHeader->length;
 	free_header(readHeader);
 
-	if(dataLength > 0){
-		char *buffer_data = calloc(dataLength, sizeof(char));
-		numReadBytes += Rio_readn(input_fd, buffer_data, dataLength);  	
-		if(numReadBytes-8 != dataLength){
-			free(buffer_data);
+	//Buffer containing the whole packet, the data part is read
+	//straight behind the header
+	unsigned char *buffer = headerBytes;
+	if(packetLength > headerSize){
+		buffer = buffer_alloc(packetLength*sizeof(unsigned char));
+		memcpy(buffer, headerBytes, headerSize);
+		numReadBytes += Rio_readn(input_fd, buffer+headerSize, 
+					  packetLength-headerSize);
+		if(numReadBytes != packetLength){
+			buffer_free(buffer);
 			fprintf(stderr, "Error of reading packet data\n");
 			return ERR;
 		}
-
-		buffer = realloc(buffer, 
-				 numReadBytes*sizeof(char));
-		memcpy(buffer+8, buffer_data, numReadBytes-8);
-		free(buffer_data);
 	}
 	
 	//Interpretating the read bytes into a packet data structure
-	*readPacket = read_packet((unsigned char *)buffer, numReadBytes);
-	free(buffer);
-	if(readPacket == NULL){
+	*readPacket = read_packet(buffer, packetLength);
+	if(buffer != headerBytes){
+		buffer_free(buffer);
+	}
+	if(*readPacket == NULL){
 		fprintf(stderr, "Error of reading the paket\n");
 		return ERR;
 	}
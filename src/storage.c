@@ -0,0 +1,974 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <dirent.h>
+
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "storage.h"
+
+//How surely the stored files are on the disk, set once at startup
+static int durability = DURABILITY_NONE;
+
+//Time of the last look for the resumable uploads to remove
+static time_t lastSweep = 0;
+
+/*
+ * Writing all the given bytes at a position of a file
+ */
+static int write_all_at(int fd, const unsigned char *bytes, size_t numBytes,
+			off_t offset)
+{
+	ssize_t numWrittenBytes;
+
+	while(numBytes > 0){
+		numWrittenBytes = pwrite(fd, bytes, numBytes, offset);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Error of writing an upload \
+[pwrite()]\n");
+			return ERR;
+		}
+		bytes += numWrittenBytes;
+		numBytes -= numWrittenBytes;
+		offset += numWrittenBytes;
+	}
+
+	return OK;
+}
+
+/*
+ * Reserving space on the disk for the file up to the given position at
+ * least, more than needed so that it is done once in a while
+ */
+static void preallocate_up_to(Upload *upload, off_t end)
+{
+	if(!upload->preallocate || end <= upload->allocatedLength){
+		return;
+	}
+
+	//Twice as much each time, the size of the file is kept
+	off_t length = upload->allocatedLength;
+	if(length < MIN_PREALLOCATE_SIZE){
+		length = MIN_PREALLOCATE_SIZE;
+	}
+	if(length > MAX_PREALLOCATE_SIZE){
+		length = MAX_PREALLOCATE_SIZE;
+	}
+	if(upload->allocatedLength + length < end){
+		length = end - upload->allocatedLength;
+	}
+
+	int status;
+	do{
+		status = fallocate(upload->fd, FALLOC_FL_KEEP_SIZE, 
+				   upload->allocatedLength, length);
+	}while(status < 0 && errno == EINTR);
+
+	//Not possible on this file system (or full), the writes will
+	//tell if the space is really missing
+	if(status < 0){
+		upload->preallocate = 0;
+		return;
+	}
+	upload->allocatedLength += length;
+}
+
+/*
+ * Handing to the ring what is left to write of a window
+ */
+static void submit_window_write(Upload *upload)
+{
+	io_ring_write(upload->ring, upload->fd, upload->writeBytes,
+		      upload->writeLength, upload->writeOffset,
+		      (uint64_t)(uintptr_t)(&(upload->writeRequest)) | 
+		      IO_RING_INLINE);
+	upload->numPendingWrites = 1;
+}
+
+/*
+ * Completion of the writing of a window through the ring, the rest of
+ * a short write is handed again
+ */
+static void window_written(IoRingRequest *request, int result)
+{
+	Upload *upload = (Upload *)((unsigned char *)(request) - 
+				    offsetof(Upload, writeRequest));
+
+	if(result < 0){
+		fprintf(stderr, "Error of writing an upload [IORING_OP_WRITE]\n");
+		upload->writeFailed = 1;
+		upload->numPendingWrites = 0;
+		return;
+	}
+	if((unsigned int)(result) < upload->writeLength){
+		upload->writeBytes += result;
+		upload->writeLength -= result;
+		upload->writeOffset += result;
+		submit_window_write(upload);
+		return;
+	}
+	upload->numPendingWrites = 0;
+}
+
+/*
+ * Waiting for the window written through the ring, if any
+ *
+ * Returns ERR if one of the windows couldn't be written
+ */
+static int wait_window_write(Upload *upload)
+{
+	if(upload->ring != NULL && upload->numPendingWrites > 0 &&
+	   io_ring_wait_inline(upload->ring, 
+			       &(upload->numPendingWrites)) == ERR){
+		upload->writeFailed = 1;
+	}
+	if(upload->tracker != NULL && wait_writes(upload->tracker) == ERR){
+		upload->writeFailed = 1;
+	}
+	return upload->writeFailed ? ERR : OK;
+}
+
+/*
+ * Handing bytes to write at a position of the file to the I/O threads,
+ * the window is the tracker's from now on
+ */
+static int queue_upload_write(Upload *upload, unsigned char *bytes,
+			      unsigned int numBytes, off_t offset)
+{
+	if(queue_write(upload->tracker, upload->fd, bytes, numBytes, 
+		       offset) == ERR){
+		upload->writeFailed = 1;
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Writing the window to the file and emptying it, through the ring the
+ * window is only handed to the kernel and the spare one takes its place,
+ * through the I/O threads the window goes with its write
+ */
+static int flush_window(Upload *upload)
+{
+	preallocate_up_to(upload, upload->offset + upload->windowLength);
+
+	if(upload->tracker != NULL){
+		if(upload->windowLength > 0){
+			unsigned char *queuedWindow = upload->window;
+			upload->window = tracker_window(upload->tracker,
+							upload->windowSize);
+			if(queue_upload_write(upload, queuedWindow,
+					      upload->windowLength,
+					      upload->offset) == ERR){
+				return ERR;
+			}
+		}
+	}else if(upload->ring == NULL){
+		if(write_all_at(upload->fd, upload->window, 
+				upload->windowLength, upload->offset) == ERR){
+			return ERR;
+		}
+	}else if(upload->windowLength > 0){
+		//The spare window is free once its own writing is over
+		if(wait_window_write(upload) == ERR){
+			return ERR;
+		}
+		upload->writeBytes = upload->window;
+		upload->writeLength = upload->windowLength;
+		upload->writeOffset = upload->offset;
+		submit_window_write(upload);
+
+		unsigned char *writtenWindow = upload->window;
+		upload->window = upload->spareWindow;
+		upload->spareWindow = writtenWindow;
+	}
+	upload->offset += upload->windowLength;
+	upload->windowLength = 0;
+
+	return upload->writeFailed ? ERR : OK;
+}
+
+/*
+ * Writing the window to the file and waiting until it is written, before
+ * the file is read, synced or closed
+ */
+static int write_window(Upload *upload)
+{
+	if(flush_window(upload) == ERR){
+		return ERR;
+	}
+	return wait_window_write(upload);
+}
+
+/*
+ * Free-ing the windows and the upload, once nothing is written from
+ * them anymore
+ */
+static void free_upload(Upload *upload)
+{
+	free(upload->window);
+	free(upload->spareWindow);
+	if(upload->tracker != NULL){
+		free_write_tracker(upload->tracker);
+		free(upload->tracker);
+	}
+	free(upload);
+}
+
+/*
+ * Writing a checkpoint of a resumable upload once enough bytes are
+ * written since the last one
+ */
+static int checkpoint_if_due(Upload *upload)
+{
+	if(!upload->resumable || 
+	   upload->offset - upload->checkpointOffset < CHECKPOINT_INTERVAL){
+		return OK;
+	}
+	return upload_checkpoint(upload);
+}
+
+/*
+ * Size of the windows of an upload, in whole blocks of the disk so that
+ * the windows are written at the boundaries of the blocks
+ */
+static unsigned int window_size(unsigned int windowSize)
+{
+	return (windowSize + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE * 
+		STORAGE_BLOCK_SIZE;
+}
+
+/*
+ * Choosing how surely the stored files are on the disk, once at startup
+ */
+void set_durability(int mode)
+{
+	durability = mode;
+}
+
+/*
+ * Syncing the directory holding the given file, so that its name is on
+ * the disk too
+ *
+ * Returns ERR if the directory can't be synced
+ */
+int sync_directory(const char *fileName)
+{
+	char directoryName[MAX_NAME_SIZE];
+	snprintf(directoryName, MAX_NAME_SIZE, "%s", fileName);
+	char *lastSlash = strrchr(directoryName, '/');
+	if(lastSlash == NULL){
+		snprintf(directoryName, MAX_NAME_SIZE, ".");
+	}else if(lastSlash == directoryName){
+		directoryName[1] = '\0';
+	}else{
+		*lastSlash = '\0';
+	}
+
+	int directory_fd = open(directoryName, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(directory_fd < 0 || fsync(directory_fd) < 0){
+		fprintf(stderr, "Error of syncing a storage directory\n");
+		if(directory_fd >= 0){
+			close(directory_fd);
+		}
+		return ERR;
+	}
+	close(directory_fd);
+	return OK;
+}
+
+/*
+ * Whether the name given by a client to its upload is a plain file name,
+ * which stays in the storage directory
+ */
+int valid_upload_name(const unsigned char *name, unsigned int length)
+{
+	//Neither a path nor a hidden file (., .. and the temporary ones)
+	if(length < 1 || length > MAX_UPLOAD_NAME_SIZE || name[0] == '.'){
+		return 0;
+	}
+
+	unsigned int i;
+	for(i=0; i<length; i++){
+		if(name[i] == '/' || name[i] < 0x20 || name[i] == 0x7f){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Initialization of a new upload with a temporary file created next
+ * to the file it will become
+ */
+Upload * init_upload(const char *targetName, unsigned int windowSize)
+{
+	Upload *new_upload = calloc(1, sizeof(Upload));
+
+	//The temporary file is in the same directory, so the final
+	//renaming is atomic
+	snprintf(new_upload->tempName, MAX_NAME_SIZE, "%s.part.XXXXXX",
+		 targetName);
+	new_upload->fd = mkostemp(new_upload->tempName, 
+				  (durability == DURABILITY_DSYNC) ? O_DSYNC : 0);
+	if(new_upload->fd < 0){
+		fprintf(stderr, "Error of creating an upload file \
+[mkostemp()]\n");
+		free(new_upload);
+		return NULL;
+	}
+	fchmod(new_upload->fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+	new_upload->windowSize = window_size(windowSize);
+	new_upload->windowLength = 0;
+	new_upload->window = calloc(new_upload->windowSize, 
+				    sizeof(unsigned char));
+	new_upload->offset = 0;
+	new_upload->checksum = 0;
+	new_upload->checksumLength = 0;
+	new_upload->allocatedLength = 0;
+	new_upload->preallocate = 1;
+	new_upload->ring = NULL;
+	new_upload->spareWindow = NULL;
+	new_upload->numPendingWrites = 0;
+	new_upload->writeFailed = 0;
+	new_upload->tracker = NULL;
+	new_upload->resumable = 0;
+	new_upload->recordFd = -1;
+	new_upload->checkpointOffset = 0;
+
+	return new_upload;
+}
+
+/*
+ * Resuming the upload kept in the given file, or starting it if there is
+ * none, from the position of its last checkpoint
+ *
+ * Returns NULL if the file can't be opened or is used by another connection
+ */
+Upload * resume_upload(const char *partName, unsigned int windowSize)
+{
+	Upload *new_upload = calloc(1, sizeof(Upload));
+	snprintf(new_upload->tempName, MAX_NAME_SIZE, "%s", partName);
+	snprintf(new_upload->recordName, MAX_NAME_SIZE, "%s.offset", 
+		 partName);
+
+	new_upload->fd = open(new_upload->tempName, O_RDWR|O_CREAT|O_CLOEXEC|
+			      ((durability == DURABILITY_DSYNC) ? O_DSYNC : 0),
+			      S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(new_upload->fd < 0){
+		fprintf(stderr, "Error of opening an upload file [open()]\n");
+		free(new_upload);
+		return NULL;
+	}
+	//Only one connection at once goes on with the upload
+	if(flock(new_upload->fd, LOCK_EX|LOCK_NB) < 0){
+		fprintf(stderr, "Error of resuming an upload used by another \
+connection\n");
+		close(new_upload->fd);
+		free(new_upload);
+		return NULL;
+	}
+
+	//The record is only created at the first checkpoint, so that a
+	//client sending nothing leaves nothing behind
+	new_upload->resumable = 1;
+	new_upload->recordFd = open(new_upload->recordName, O_RDWR|O_CLOEXEC);
+	if(new_upload->recordFd < 0 && errno != ENOENT){
+		fprintf(stderr, "Error of opening an upload record \
+[open()]\n");
+		close(new_upload->fd);
+		free(new_upload);
+		return NULL;
+	}
+
+	//Without any checkpoint, the upload starts from the beginning,
+	//what was written after the last one is not sure and is dropped, a
+	//record without its checksum (older one) only gives the checkpoint
+	UploadRecord record;
+	memset(&record, 0, sizeof(UploadRecord));
+	ssize_t numReadBytes = 0;
+	if(new_upload->recordFd >= 0){
+		numReadBytes = pread(new_upload->recordFd, &record, 
+				     sizeof(UploadRecord), 0);
+	}
+	if(numReadBytes < (ssize_t)(sizeof(uint64_t))){
+		record.checkpoint = 0;
+	}
+	if(numReadBytes != (ssize_t)(sizeof(UploadRecord))){
+		record.checked = 0;
+	}
+	uint64_t checkpoint = record.checkpoint;
+	struct stat fileStatus;
+	if(fstat(new_upload->fd, &fileStatus) < 0 || 
+	   (off_t)(checkpoint) > fileStatus.st_size){
+		checkpoint = 0;
+		record.checked = 0;
+	}
+	if(ftruncate(new_upload->fd, checkpoint) < 0){
+		fprintf(stderr, "Error of resuming an upload \
+[ftruncate()]\n");
+		if(new_upload->recordFd >= 0){
+			close(new_upload->recordFd);
+		}
+		close(new_upload->fd);
+		free(new_upload);
+		return NULL;
+	}
+
+	new_upload->windowSize = window_size(windowSize);
+	new_upload->windowLength = 0;
+	new_upload->window = calloc(new_upload->windowSize, 
+				    sizeof(unsigned char));
+	new_upload->offset = checkpoint;
+	new_upload->checksum = record.checked ? record.checksum : 0;
+	new_upload->checksumLength = record.checked ? (off_t)(checkpoint) : 0;
+	new_upload->allocatedLength = checkpoint;
+	new_upload->preallocate = 1;
+	new_upload->ring = NULL;
+	new_upload->spareWindow = NULL;
+	new_upload->numPendingWrites = 0;
+	new_upload->writeFailed = 0;
+	new_upload->tracker = NULL;
+	new_upload->checkpointOffset = checkpoint;
+
+	return new_upload;
+}
+
+/*
+ * Removing the resumable uploads of the given directory (files whose name
+ * starts with the given prefix) left untouched for RESUME_MAX_AGE, at most
+ * once every RESUME_SWEEP_INTERVAL
+ */
+void expire_resumable_uploads(const char *directory, const char *prefix)
+{
+	//Only one thread looks at once
+	time_t now = time(NULL);
+	time_t previous = __atomic_load_n(&lastSweep, __ATOMIC_RELAXED);
+	if(now - previous < RESUME_SWEEP_INTERVAL ||
+	   !__atomic_compare_exchange_n(&lastSweep, &previous, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+		return;
+	}
+
+	DIR *dir = opendir(directory);
+	if(dir == NULL){
+		return;
+	}
+
+	char partName[MAX_NAME_SIZE];
+	char recordName[MAX_NAME_SIZE + 8];
+	size_t prefixLength = strlen(prefix);
+	struct dirent *entry;
+	struct stat fileStatus;
+	while((entry = readdir(dir)) != NULL){
+		if(strncmp(entry->d_name, prefix, prefixLength) != 0){
+			continue;
+		}
+		//A record goes with its file, or alone once its file is gone
+		size_t nameLength = strlen(entry->d_name);
+		int isRecord = (nameLength > 7 && 
+				strcmp(entry->d_name + nameLength - 7, 
+				       ".offset") == 0);
+		snprintf(partName, MAX_NAME_SIZE, "%s/%.*s", directory,
+			 (int)(isRecord ? nameLength - 7 : nameLength),
+			 entry->d_name);
+		snprintf(recordName, MAX_NAME_SIZE + 8, "%s.offset", partName);
+		if(isRecord){
+			if(access(partName, F_OK) == 0 ||
+			   stat(recordName, &fileStatus) < 0 ||
+			   now - fileStatus.st_mtime < RESUME_MAX_AGE){
+				continue;
+			}
+			unlink(recordName);
+			continue;
+		}
+
+		//A file still written by a connection is locked by it
+		int fd = open(partName, O_RDONLY|O_CLOEXEC);
+		if(fd < 0){
+			continue;
+		}
+		if(fstat(fd, &fileStatus) == 0 &&
+		   now - fileStatus.st_mtime >= RESUME_MAX_AGE &&
+		   flock(fd, LOCK_EX|LOCK_NB) == 0){
+			unlink(partName);
+			unlink(recordName);
+		}
+		close(fd);
+	}
+	closedir(dir);
+}
+
+/*
+ * Writing the windows of the upload through a ring from now on, without
+ * waiting for them
+ */
+void upload_use_ring(Upload *upload, IoRing *ring)
+{
+	upload->ring = ring;
+	upload->writeRequest.complete = window_written;
+	upload->spareWindow = calloc(upload->windowSize, 
+				     sizeof(unsigned char));
+}
+
+/*
+ * Handing the windows of the upload to the I/O threads from now on,
+ * without waiting for them, the waiter is told when the upload can take
+ * more data again
+ */
+void upload_use_io_threads(Upload *upload, WriteWaiter *waiter)
+{
+	upload->tracker = malloc(sizeof(WriteTracker));
+	init_write_tracker(upload->tracker, waiter);
+}
+
+/*
+ * Whether the upload should be given no more data for now, its windows
+ * not being written as fast as they come
+ */
+int upload_writes_stalled(Upload *upload)
+{
+	return upload->tracker != NULL && writes_stalled(upload->tracker);
+}
+
+/*
+ * Appending received data to the upload, the window is written to the file
+ * each time it is full so the memory used stays bounded
+ */
+int upload_append(Upload *upload, const unsigned char *data,
+		  unsigned int dataLength)
+{
+	unsigned int numCopiedBytes;
+
+	while(dataLength > 0){
+		//Whole windows of data go straight to the file, the rest
+		//starts the next window (through the I/O threads the data
+		//is only copied once, into the windows they write)
+		if(upload->windowLength == 0 && upload->tracker == NULL &&
+		   dataLength >= upload->windowSize){
+			unsigned int numDirectBytes = dataLength - 
+				dataLength % upload->windowSize;
+			preallocate_up_to(upload, 
+					  upload->offset + numDirectBytes);
+			if(write_all_at(upload->fd, data, numDirectBytes,
+					upload->offset) == ERR){
+				return ERR;
+			}
+			upload->offset += numDirectBytes;
+			data += numDirectBytes;
+			dataLength -= numDirectBytes;
+			continue;
+		}
+
+		numCopiedBytes = upload->windowSize - upload->windowLength;
+		if(numCopiedBytes > dataLength){
+			numCopiedBytes = dataLength;
+		}
+		memcpy(upload->window + upload->windowLength, data,
+		       numCopiedBytes);
+		upload->windowLength += numCopiedBytes;
+		data += numCopiedBytes;
+		dataLength -= numCopiedBytes;
+
+		if(upload->windowLength == upload->windowSize &&
+		   flush_window(upload) == ERR){
+			return ERR;
+		}
+	}
+
+	return checkpoint_if_due(upload);
+}
+
+/*
+ * Appending the first bytes of another file to the upload, copied by
+ * the kernel from file to file when possible
+ */
+int upload_append_file(Upload *upload, int input_fd, unsigned int length)
+{
+	//The data already in the window comes first in the file
+	if(flush_window(upload) == ERR){
+		return ERR;
+	}
+
+	loff_t inputOffset = 0;
+	loff_t outputOffset = upload->offset;
+	ssize_t numCopiedBytes;
+	while(length > 0){
+		numCopiedBytes = copy_file_range(input_fd, &inputOffset, 
+						 upload->fd, &outputOffset, 
+						 length, 0);
+		if(numCopiedBytes < 0 && errno == EINTR){
+			continue;
+		}
+		//Not possible between these files, the rest goes through
+		//the window
+		if(numCopiedBytes <= 0){
+			break;
+		}
+		length -= numCopiedBytes;
+	}
+	upload->offset = outputOffset;
+
+	while(length > 0){
+		unsigned int numReadBytes = upload->windowSize - 
+			upload->windowLength;
+		if(numReadBytes > length){
+			numReadBytes = length;
+		}
+		numCopiedBytes = pread(input_fd, 
+				       upload->window + upload->windowLength,
+				       numReadBytes, inputOffset);
+		if(numCopiedBytes < 0 && errno == EINTR){
+			continue;
+		}
+		if(numCopiedBytes <= 0){
+			fprintf(stderr, "Error of reading a file to append \
+[pread()]\n");
+			return ERR;
+		}
+		upload->windowLength += numCopiedBytes;
+		inputOffset += numCopiedBytes;
+		length -= numCopiedBytes;
+
+		if(upload->windowLength == upload->windowSize &&
+		   flush_window(upload) == ERR){
+			return ERR;
+		}
+	}
+
+	return checkpoint_if_due(upload);
+}
+
+/*
+ * Writing received data at a given position of the upload, straight to
+ * the file without the window (ranges received in any order)
+ */
+int upload_write_at(Upload *upload, const unsigned char *data,
+		    unsigned int dataLength, off_t offset)
+{
+	return write_all_at(upload->fd, data, dataLength, offset);
+}
+
+/*
+ * Moving received data straight from a socket to the upload through a pipe,
+ * without copying them in memory (splice), at most maxBytes at once
+ *
+ * Returns the number of bytes moved, 0 if the socket has nothing more for
+ * now or ERR if the client is gone or the file can't be written
+ */
+int upload_splice(Upload *upload, int socket_fd, int *pipe_fds,
+		  unsigned int maxBytes)
+{
+	//The data already in the window comes first in the file
+	if(flush_window(upload) == ERR){
+		return ERR;
+	}
+
+	int numMovedBytes = upload_splice_at(upload, socket_fd, pipe_fds, 
+					     maxBytes, &(upload->offset));
+	if(numMovedBytes > 0 && checkpoint_if_due(upload) == ERR){
+		return ERR;
+	}
+	return numMovedBytes;
+}
+
+/*
+ * Same as upload_splice, but at a given position of the file, moved
+ * forward by the number of bytes written (the window is not used)
+ */
+int upload_splice_at(Upload *upload, int socket_fd, int *pipe_fds,
+		     unsigned int maxBytes, off_t *offset)
+{
+	//From the socket to the pipe, the pipe is always empty here so
+	//nothing available means nothing more on the socket
+	ssize_t numMovedBytes;
+	do{
+		numMovedBytes = splice(socket_fd, NULL, pipe_fds[1], NULL,
+				       maxBytes,
+				       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	}while(numMovedBytes < 0 && errno == EINTR);
+
+	if(numMovedBytes < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return 0;
+		}
+		fprintf(stderr, "Error of receiving an upload [splice()]\n");
+		return ERR;
+	}
+
+	//Client closed the connection
+	if(numMovedBytes == 0){
+		return ERR;
+	}
+
+	//From the pipe to the file, until the pipe is empty again
+	loff_t fileOffset = *offset;
+	ssize_t numRemainingBytes = numMovedBytes;
+	ssize_t numWrittenBytes;
+	while(numRemainingBytes > 0){
+		numWrittenBytes = splice(pipe_fds[0], NULL, upload->fd,
+					 &fileOffset, numRemainingBytes,
+					 SPLICE_F_MOVE);
+		if(numWrittenBytes <= 0){
+			if(numWrittenBytes < 0 && errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Error of writing an upload \
+[splice()]\n");
+			return ERR;
+		}
+		numRemainingBytes -= numWrittenBytes;
+	}
+	*offset = fileOffset;
+
+	return numMovedBytes;
+}
+
+/*
+ * Adding to the checksum of the file the CRC32C of data appended at the
+ * given position, only if it follows the bytes already checked
+ */
+void upload_add_checksum(Upload *upload, off_t offset, uint32_t checksum,
+			 unsigned int dataLength)
+{
+	if(upload->checksumLength == offset){
+		upload->checksum = crc32c_combine(upload->checksum, checksum,
+						  dataLength);
+		upload->checksumLength += dataLength;
+	}
+}
+
+/*
+ * Checking the whole file of the upload against its CRC32C, put together
+ * as its bytes were appended (before a suspension included), it is read
+ * back only if some of them came without a checksum
+ *
+ * Returns ERR if the file is not the one expected
+ */
+int upload_verify(Upload *upload, uint32_t expectedChecksum)
+{
+	if(write_window(upload) == ERR){
+		return ERR;
+	}
+
+	struct stat fileStatus;
+	if(fstat(upload->fd, &fileStatus) < 0){
+		fprintf(stderr, "Error of checking an upload [fstat()]\n");
+		return ERR;
+	}
+
+	//Ranges written at their position, chunks copied from file to file
+	//or spliced data parts, the file is read back
+	uint32_t checksum = upload->checksum;
+	if(upload->checksumLength != fileStatus.st_size){
+		unsigned char *block = malloc(VERIFY_BLOCK_SIZE);
+		off_t offset = 0;
+		checksum = 0;
+		while(offset < fileStatus.st_size){
+			ssize_t numReadBytes = pread(upload->fd, block, 
+						     VERIFY_BLOCK_SIZE, offset);
+			if(numReadBytes < 0 && errno == EINTR){
+				continue;
+			}
+			if(numReadBytes <= 0){
+				fprintf(stderr, "Error of checking an upload \
+[pread()]\n");
+				free(block);
+				return ERR;
+			}
+			checksum = crc32c(checksum, block, numReadBytes);
+			offset += numReadBytes;
+		}
+		free(block);
+	}
+
+	if(checksum != expectedChecksum){
+		fprintf(stderr, "Error of checking an upload: CRC32C %08x \
+instead of %08x\n", checksum, expectedChecksum);
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Writing what is left in the window and giving atomically the final name
+ * to the file, the upload is free-ed
+ */
+int upload_commit(Upload *upload, const char *targetName)
+{
+	if(upload_finish(upload) == ERR){
+		return ERR;
+	}
+
+	//The data is on the disk before the file takes its name, then
+	//its name too (O_DSYNC only covers the data)
+	if((durability == DURABILITY_FDATASYNC || 
+	    durability == DURABILITY_GROUP) && fdatasync(upload->fd) < 0){
+		fprintf(stderr, "Error of storing an upload [fdatasync()]\n");
+		upload_abort(upload);
+		return ERR;
+	}
+	if(upload_rename(upload, targetName) == ERR){
+		return ERR;
+	}
+	if(durability != DURABILITY_NONE){
+		return sync_directory(targetName);
+	}
+	return OK;
+}
+
+/*
+ * Writing what is left in the window and waiting for all the writes of the
+ * file, which can then be synced from any thread, the upload is given up
+ * if it can't be written
+ */
+int upload_finish(Upload *upload)
+{
+	if(write_window(upload) == ERR){
+		upload_abort(upload);
+		return ERR;
+	}
+
+	//The space reserved past the end of the file is given back
+	if(upload->allocatedLength > upload->offset &&
+	   ftruncate(upload->fd, upload->offset) < 0){
+		fprintf(stderr, "Error of storing an upload [ftruncate()]\n");
+		upload_abort(upload);
+		return ERR;
+	}
+	upload->allocatedLength = upload->offset;
+
+	return OK;
+}
+
+/*
+ * Giving atomically the final name to a finished file, the upload is free-ed
+ * (given up if the name can't be given)
+ */
+int upload_rename(Upload *upload, const char *targetName)
+{
+	close(upload->fd);
+	upload->fd = -1;
+	if(rename(upload->tempName, targetName) < 0){
+		fprintf(stderr, "Error of storing an upload [rename()]\n");
+		upload_abort(upload);
+		return ERR;
+	}
+
+	//A resumable upload is over, its record is no longer needed
+	if(upload->recordFd >= 0){
+		close(upload->recordFd);
+	}
+	if(upload->resumable){
+		unlink(upload->recordName);
+	}
+
+	free_upload(upload);
+	return OK;
+}
+
+/*
+ * Writing the received data surely to the disk, then the position up to
+ * which they are written, for a resumable upload
+ */
+int upload_checkpoint(Upload *upload)
+{
+	if(!upload->resumable){
+		return OK;
+	}
+
+	if(write_window(upload) == ERR){
+		return ERR;
+	}
+	if(upload->recordFd < 0){
+		upload->recordFd = open(upload->recordName, 
+					O_RDWR|O_CREAT|O_CLOEXEC, 
+					S_IRUSR|S_IWUSR);
+		if(upload->recordFd < 0){
+			fprintf(stderr, "Error of opening an upload record \
+[open()]\n");
+			return ERR;
+		}
+	}
+
+	//The position is written only once the data before it is on disk,
+	//with the checksum of that data if all of it came with one
+	UploadRecord record;
+	record.checkpoint = upload->offset;
+	record.checked = (upload->checksumLength == upload->offset);
+	record.checksum = record.checked ? upload->checksum : 0;
+	if(fdatasync(upload->fd) < 0 ||
+	   pwrite(upload->recordFd, &record, sizeof(UploadRecord), 0) != 
+	   sizeof(UploadRecord) || fdatasync(upload->recordFd) < 0){
+		fprintf(stderr, "Error of writing an upload checkpoint\n");
+		return ERR;
+	}
+	upload->checkpointOffset = upload->offset;
+
+	return OK;
+}
+
+/*
+ * Giving up an upload, the temporary file is removed and the upload is free-ed
+ */
+void upload_abort(Upload *upload)
+{
+	//The file descriptor must not be taken by another file while
+	//a window is written to it
+	wait_window_write(upload);
+	if(upload->fd >= 0){
+		close(upload->fd);
+	}
+	unlink(upload->tempName);
+	if(upload->recordFd >= 0){
+		close(upload->recordFd);
+	}
+	if(upload->resumable){
+		unlink(upload->recordName);
+	}
+	free_upload(upload);
+}
+
+/*
+ * Leaving a resumable upload for a next connection, its file is kept
+ * up to its last checkpoint and the upload is free-ed
+ */
+void upload_suspend(Upload *upload)
+{
+	//Nothing received yet, there is nothing to resume
+	if(upload->offset == 0 && upload->windowLength == 0){
+		upload_abort(upload);
+		return;
+	}
+
+	if(upload_checkpoint(upload) == ERR){
+		fprintf(stderr, "Upload kept up to its previous checkpoint\n");
+	}
+
+	wait_window_write(upload);
+	close(upload->fd);
+	if(upload->recordFd >= 0){
+		close(upload->recordFd);
+	}
+	free_upload(upload);
+}
+
+/*
+ * Leaving an upload when its connection fails, a resumable upload is
+ * suspended and any other one is given up
+ */
+void upload_release(Upload *upload)
+{
+	if(upload->resumable){
+		upload_suspend(upload);
+	}else{
+		upload_abort(upload);
+	}
+}
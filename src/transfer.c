@@ -0,0 +1,168 @@
+#include <pthread.h>
+
+#include "transfer.h"
+
+//Transfers in progress, shared by the event loops of all the threads
+static Transfer *transfers = NULL;
+static pthread_mutex_t transfersLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Removing a transfer from the registry with its temporary file, under
+ * the lock of the registry
+ */
+static void remove_transfer(Transfer *transfer)
+{
+	Transfer **link = &transfers;
+	while(*link != transfer){
+		link = &((*link)->next);
+	}
+	*link = transfer->next;
+
+	if(transfer->upload != NULL){
+		upload_abort(transfer->upload);
+	}
+	free(transfer);
+}
+
+/*
+ * Giving up the transfers left by all their connections for too long
+ * before they were complete, under the lock of the registry
+ */
+static void expire_transfers(time_t now)
+{
+	Transfer *transfer = transfers;
+	while(transfer != NULL){
+		Transfer *next = transfer->next;
+		if(transfer->numAttached == 0 && !transfer->committed &&
+		   now - transfer->leftTime >= TRANSFER_MAX_WAIT){
+			fprintf(stderr, "Transfer given up, its connections "
+				"never came\n");
+			remove_transfer(transfer);
+		}
+		transfer = next;
+	}
+}
+
+/*
+ * Joining the transfer of the given ID, which is created by its first
+ * connection, next to the file it will become
+ *
+ * Returns NULL if the transfer already failed, is already complete or
+ * doesn't expect the same number of connections
+ */
+Transfer * attach_transfer(uint64_t transferId, unsigned int numStreams,
+			   const char *targetName)
+{
+	pthread_mutex_lock(&transfersLock);
+
+	expire_transfers(time(NULL));
+
+	Transfer *transfer = transfers;
+	while(transfer != NULL && transfer->transferId != transferId){
+		transfer = transfer->next;
+	}
+
+	//The first connection creates the transfer
+	if(transfer == NULL){
+		Upload *upload = init_upload(targetName, 0);
+		if(upload == NULL){
+			pthread_mutex_unlock(&transfersLock);
+			return NULL;
+		}
+
+		transfer = calloc(1, sizeof(Transfer));
+		transfer->transferId = transferId;
+		transfer->upload = upload;
+		transfer->numStreams = numStreams;
+		transfer->numAttached = 0;
+		transfer->numStored = 0;
+		transfer->failed = 0;
+		transfer->committed = 0;
+		transfer->leftTime = 0;
+		transfer->next = transfers;
+		transfers = transfer;
+	}else if(transfer->failed || transfer->committed ||
+		 transfer->numStreams != numStreams ||
+		 transfer->numAttached == numStreams){
+		fprintf(stderr, "Error of joining a transfer\n");
+		pthread_mutex_unlock(&transfersLock);
+		return NULL;
+	}
+
+	transfer->numAttached++;
+
+	pthread_mutex_unlock(&transfersLock);
+	return transfer;
+}
+
+/*
+ * Telling that a connection has written all its ranges, the last one of
+ * the transfer is given the file to store, after checking it against its
+ * CRC32C if given (NULL for the other ones)
+ *
+ * Returns ERR if the transfer failed or the file is not the one sent
+ */
+int transfer_store(Transfer *transfer, const uint32_t *fileChecksum,
+		   Upload **upload)
+{
+	int status_store = OK;
+
+	*upload = NULL;
+
+	//Only the last connection is decided under the lock, it takes the
+	//upload out of the transfer so that no other one can join it
+	pthread_mutex_lock(&transfersLock);
+	if(transfer->failed){
+		status_store = ERR;
+	}else{
+		transfer->numStored++;
+		if(transfer->numStored == transfer->numStreams){
+			*upload = transfer->upload;
+			transfer->upload = NULL;
+			transfer->committed = 1;
+		}
+	}
+	pthread_mutex_unlock(&transfersLock);
+
+	if(*upload == NULL){
+		return status_store;
+	}
+
+	//The file is read back without holding the other transfers, the
+	//upload is free-ed if it fails
+	if(fileChecksum != NULL && 
+	   upload_verify(*upload, *fileChecksum) == ERR){
+		upload_abort(*upload);
+		*upload = NULL;
+		return ERR;
+	}
+	return OK;
+}
+
+/*
+ * Leaving the transfer when the connection is closed, a transfer given
+ * up by one of its connections is removed with its temporary file, as
+ * well as the ones whose other connections never came
+ */
+void detach_transfer(Transfer *transfer, int stored)
+{
+	pthread_mutex_lock(&transfersLock);
+
+	transfer->numAttached--;
+	if(!stored){
+		transfer->failed = 1;
+	}
+
+	//The connections stored so far wait for the other ones, unless
+	//the transfer is over, the ones which never come are given up later
+	if(transfer->numAttached == 0 && 
+	   (transfer->failed || transfer->committed)){
+		remove_transfer(transfer);
+	}else if(transfer->numAttached == 0){
+		transfer->leftTime = time(NULL);
+	}
+
+	expire_transfers(time(NULL));
+
+	pthread_mutex_unlock(&transfersLock);
+}
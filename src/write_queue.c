@@ -0,0 +1,522 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <sys/eventfd.h>
+
+#include "write_queue.h"
+
+//Queues of the I/O threads, the writes of a file always go to the same
+//one (chosen by its file descriptor) so that they are done in order
+static WriteQueue *queues = NULL;
+static unsigned int numQueues = 0;
+
+//Waiters of all the event loops, all told when a full queue has room
+static WriteWaiter *waiters[MAX_WRITE_WAITERS];
+static unsigned int numWaiters = 0;
+static pthread_mutex_t waitersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Writing all the given bytes at a position of a file
+ */
+static int write_all_at(int fd, const unsigned char *bytes, size_t numBytes,
+			off_t offset)
+{
+	ssize_t numWrittenBytes;
+
+	while(numBytes > 0){
+		numWrittenBytes = pwrite(fd, bytes, numBytes, offset);
+		if(numWrittenBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Error of writing an upload \
+[pwrite()]\n");
+			return ERR;
+		}
+		bytes += numWrittenBytes;
+		numBytes -= numWrittenBytes;
+		offset += numWrittenBytes;
+	}
+
+	return OK;
+}
+
+/*
+ * Telling a waiter that writes are done, its event loop looks for the
+ * connections which can go on
+ */
+static void notify_waiter(WriteWaiter *waiter)
+{
+	uint64_t one = 1;
+	while(write(waiter->eventFd, &one, sizeof(uint64_t)) < 0 &&
+	      errno == EINTR){
+	}
+}
+
+/*
+ * Queue of the I/O thread writing the given file
+ */
+static WriteQueue *file_queue(int fd)
+{
+	return &(queues[(unsigned int)(fd) % numQueues]);
+}
+
+/*
+ * Publishing a write in the queue, without waiting
+ *
+ * Returns ERR if the queue is full
+ */
+static int push_write(WriteQueue *queue, const WriteRequest *request)
+{
+	uint64_t position = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+	WriteSlot *slot;
+
+	while(1){
+		slot = &(queue->slots[position & (WRITE_QUEUE_SIZE - 1)]);
+		int64_t difference =
+			(int64_t)(__atomic_load_n(&(slot->sequence),
+						  __ATOMIC_ACQUIRE) - position);
+
+		//The slot is free for this position, taken if no other
+		//producer took it meanwhile (the position is updated if so)
+		if(difference == 0){
+			if(__atomic_compare_exchange_n(&(queue->tail),
+						       &position, position + 1,
+						       1, __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED)){
+				break;
+			}
+		}else if(difference < 0){
+			//Still holding the write of the previous round: the
+			//disk is behind, the write is kept by its producer
+			__atomic_add_fetch(&(queue->numFull), 1,
+					   __ATOMIC_RELAXED);
+			return ERR;
+		}else{
+			position = __atomic_load_n(&(queue->tail),
+						   __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->request = *request;
+	__atomic_store_n(&(slot->sequence), position + 1, __ATOMIC_RELEASE);
+	V(&(queue->numWrites));
+
+	//Highest depth, as seen by this producer
+	uint64_t depth = position + 1 -
+		__atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+	uint64_t maxDepth = __atomic_load_n(&(queue->maxDepth),
+					    __ATOMIC_RELAXED);
+	while(depth > maxDepth &&
+	      !__atomic_compare_exchange_n(&(queue->maxDepth), &maxDepth,
+					   depth, 1, __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED)){
+	}
+
+	return OK;
+}
+
+/*
+ * Taking the next write out of the queue, waiting for one if it is empty
+ */
+static void pop_write(WriteQueue *queue, WriteRequest *request)
+{
+	P(&(queue->numWrites));
+
+	//Only this thread moves the head, and the write is published
+	//before being counted
+	uint64_t position = queue->head;
+	WriteSlot *slot = &(queue->slots[position & (WRITE_QUEUE_SIZE - 1)]);
+	while(__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) !=
+	      position + 1){
+		sched_yield();
+	}
+	*request = slot->request;
+
+	//Free for the producer of the same place in the next round
+	__atomic_store_n(&(slot->sequence), position + WRITE_QUEUE_SIZE,
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&(queue->head), position + 1, __ATOMIC_RELAXED);
+
+	//A producer which found the queue full either sees this place
+	//free or is told so
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_exchange_n(&(queue->stalled), 0, __ATOMIC_RELAXED)){
+		unsigned int numTold = __atomic_load_n(&numWaiters,
+						       __ATOMIC_ACQUIRE);
+		unsigned int i;
+		for(i=0; i<numTold; i++){
+			notify_waiter(waiters[i]);
+		}
+	}
+}
+
+/*
+ * Number of writes of a file handed to the I/O threads and not done yet
+ */
+static unsigned int num_pending_writes(WriteTracker *tracker)
+{
+	return tracker->numHanded -
+		__atomic_load_n(&(tracker->numDone), __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Handing the held writes of a file to the I/O threads, in order, for as
+ * long as the file and its queue have room, they are dropped (their
+ * windows kept) once a write of the file failed
+ */
+static void hand_held_writes(WriteTracker *tracker)
+{
+	WriteRequest *request;
+
+	while(tracker->firstHeld != NULL){
+		request = tracker->firstHeld;
+		if(__atomic_load_n(&(tracker->failed), __ATOMIC_RELAXED)){
+			*(unsigned char **)(request->bytes) = 
+				tracker->freeWindows;
+			tracker->freeWindows = request->bytes;
+		}else if(num_pending_writes(tracker) >= MAX_PENDING_WRITES ||
+			 push_write(file_queue(request->fd), request) == ERR){
+			return;
+		}else{
+			tracker->numHanded++;
+		}
+
+		tracker->firstHeld = request->next;
+		if(tracker->firstHeld == NULL){
+			tracker->lastHeld = NULL;
+		}
+		free(request);
+	}
+}
+
+/*
+ * Entry point of an I/O thread, writing the files for as long as the
+ * process runs
+ */
+static void *io_thread(void *args)
+{
+	WriteQueue *queue = args;
+	WriteRequest request;
+
+	while(1){
+		pop_write(queue, &request);
+		if(write_all_at(request.fd, request.bytes, request.length,
+				request.offset) == ERR){
+			__atomic_store_n(&(request.tracker->failed), 1,
+					 __ATOMIC_RELAXED);
+		}else{
+			__atomic_add_fetch(&(queue->numWrittenBytes),
+					   request.length, __ATOMIC_RELAXED);
+		}
+		WriteTracker *tracker = request.tracker;
+
+		//The window goes back to the network thread for the next
+		//bytes of the file
+		unsigned char *top = __atomic_load_n(&(tracker->doneWindows),
+						     __ATOMIC_RELAXED);
+		do{
+			*(unsigned char **)(request.bytes) = top;
+		}while(!__atomic_compare_exchange_n(&(tracker->doneWindows),
+						    &top, request.bytes, 1,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED));
+
+		//A network thread which found the file full either sees
+		//this write done or is told so, the post is the last use
+		//of the tracker
+		__atomic_add_fetch(&(tracker->numDone), 1, __ATOMIC_SEQ_CST);
+		if(__atomic_exchange_n(&(tracker->stalled), 0,
+				       __ATOMIC_SEQ_CST)){
+			notify_waiter(tracker->waiter);
+		}
+		V(&(tracker->done));
+	}
+
+	return NULL;
+}
+
+/*
+ * Starting the I/O threads, each one with its own queue, they run until
+ * the process ends
+ *
+ * Returns ERR if the number of threads is not valid
+ */
+int start_io_threads(unsigned int numThreads)
+{
+	if(numThreads < 1 || numThreads > MAX_IO_THREADS){
+		fprintf(stderr, "#Error: number of I/O threads must be \
+between 1 and %d\n", MAX_IO_THREADS);
+		return ERR;
+	}
+
+	if(posix_memalign((void **)(&queues), CACHE_LINE_SIZE,
+			  numThreads*sizeof(WriteQueue)) != 0){
+		fprintf(stderr, "Error of allocating the write queues\n");
+		return ERR;
+	}
+	memset(queues, 0, numThreads*sizeof(WriteQueue));
+
+	unsigned int i;
+	unsigned int j;
+	for(i=0; i<numThreads; i++){
+		for(j=0; j<WRITE_QUEUE_SIZE; j++){
+			queues[i].slots[j].sequence = j;
+		}
+		Sem_init(&(queues[i].numWrites), 0, 0);
+	}
+
+	//Counted once all the queues are ready, before the first write
+	numQueues = numThreads;
+	for(i=0; i<numThreads; i++){
+		Pthread_create(&(queues[i].thread), NULL, io_thread,
+			       &(queues[i]));
+		Pthread_detach(queues[i].thread);
+	}
+
+	return OK;
+}
+
+/*
+ * Number of I/O threads started, 0 if the files are written by the network
+ * threads themselves
+ */
+unsigned int num_io_threads(void)
+{
+	return numQueues;
+}
+
+/*
+ * Initialization of the waiter of an event loop, with its event file
+ *
+ * Returns NULL if the event file can't be created or too many event loops
+ * have one
+ */
+WriteWaiter * init_write_waiter(void)
+{
+	WriteWaiter *new_waiter = calloc(1, sizeof(WriteWaiter));
+	new_waiter->eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(new_waiter->eventFd < 0){
+		fprintf(stderr, "Error of creating the event file of the \
+writes\n");
+		free(new_waiter);
+		return NULL;
+	}
+
+	//Published once its place is set, the waiters are never removed
+	pthread_mutex_lock(&waitersMutex);
+	if(numWaiters >= MAX_WRITE_WAITERS){
+		pthread_mutex_unlock(&waitersMutex);
+		fprintf(stderr, "Error of creating the event file of the \
+writes: more than %d event loops\n", MAX_WRITE_WAITERS);
+		close(new_waiter->eventFd);
+		free(new_waiter);
+		return NULL;
+	}
+	waiters[numWaiters] = new_waiter;
+	__atomic_store_n(&numWaiters, numWaiters + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&waitersMutex);
+
+	return new_waiter;
+}
+
+/*
+ * Emptying the event file of a waiter, before looking for the connections
+ * which can go on
+ */
+void take_write_notice(WriteWaiter *waiter)
+{
+	uint64_t numNotices;
+	while(read(waiter->eventFd, &numNotices, sizeof(uint64_t)) < 0 &&
+	      errno == EINTR){
+	}
+}
+
+/*
+ * Initialization of the tracker of the writes of a new file, written by
+ * the network thread of the given waiter
+ */
+void init_write_tracker(WriteTracker *tracker, WriteWaiter *waiter)
+{
+	tracker->waiter = waiter;
+	tracker->failed = 0;
+	tracker->stalled = 0;
+	tracker->numHanded = 0;
+	tracker->numDone = 0;
+	tracker->numWaited = 0;
+	Sem_init(&(tracker->done), 0, 0);
+	tracker->firstHeld = NULL;
+	tracker->lastHeld = NULL;
+	tracker->doneWindows = NULL;
+	tracker->freeWindows = NULL;
+}
+
+/*
+ * Free-ing the windows kept by a tracker, once all its writes are done
+ */
+void free_write_tracker(WriteTracker *tracker)
+{
+	unsigned char *window;
+	WriteRequest *request;
+
+	while(tracker->firstHeld != NULL){
+		request = tracker->firstHeld;
+		tracker->firstHeld = request->next;
+		free(request->bytes);
+		free(request);
+	}
+	while(tracker->doneWindows != NULL){
+		window = tracker->doneWindows;
+		tracker->doneWindows = *(unsigned char **)window;
+		free(window);
+	}
+	while(tracker->freeWindows != NULL){
+		window = tracker->freeWindows;
+		tracker->freeWindows = *(unsigned char **)window;
+		free(window);
+	}
+	sem_destroy(&(tracker->done));
+}
+
+/*
+ * Giving a window for the next bytes of the file, one written before if
+ * the I/O thread gave it back already
+ */
+unsigned char * tracker_window(WriteTracker *tracker, unsigned int size)
+{
+	if(tracker->freeWindows == NULL){
+		tracker->freeWindows = 
+			__atomic_exchange_n(&(tracker->doneWindows), NULL,
+					    __ATOMIC_ACQUIRE);
+	}
+	if(tracker->freeWindows == NULL){
+		return malloc(size);
+	}
+
+	unsigned char *window = tracker->freeWindows;
+	tracker->freeWindows = *(unsigned char **)window;
+	return window;
+}
+
+/*
+ * Handing a window to write to the I/O threads, it is the tracker's from
+ * now on, without waiting: it is held if the file or the queue has no room
+ *
+ * Returns ERR if a previous write of the file couldn't be done
+ */
+int queue_write(WriteTracker *tracker, int fd, unsigned char *bytes,
+		unsigned int length, off_t offset)
+{
+	if(__atomic_load_n(&(tracker->failed), __ATOMIC_RELAXED)){
+		*(unsigned char **)bytes = tracker->freeWindows;
+		tracker->freeWindows = bytes;
+		return ERR;
+	}
+
+	WriteRequest request;
+	request.fd = fd;
+	request.offset = offset;
+	request.bytes = bytes;
+	request.length = length;
+	request.tracker = tracker;
+	request.next = NULL;
+
+	//Behind the held ones, so that the writes are done in order
+	hand_held_writes(tracker);
+	if(tracker->firstHeld == NULL &&
+	   num_pending_writes(tracker) < MAX_PENDING_WRITES &&
+	   push_write(file_queue(fd), &request) == OK){
+		tracker->numHanded++;
+		return OK;
+	}
+
+	WriteRequest *heldRequest = malloc(sizeof(WriteRequest));
+	*heldRequest = request;
+	if(tracker->lastHeld == NULL){
+		tracker->firstHeld = heldRequest;
+	}else{
+		tracker->lastHeld->next = heldRequest;
+	}
+	tracker->lastHeld = heldRequest;
+
+	return OK;
+}
+
+/*
+ * Whether the network thread should stop reading for the file, its held
+ * writes are handed first if there is room, the waiter is told once
+ * there may be room again
+ */
+int writes_stalled(WriteTracker *tracker)
+{
+	hand_held_writes(tracker);
+	while(tracker->firstHeld != NULL){
+		//Told by the next write of the file done if it has no room,
+		//by the next write taken out of the queue otherwise, the
+		//writes are looked at again once asked to be told
+		int fileFull = (num_pending_writes(tracker) >= 
+				MAX_PENDING_WRITES);
+		if(fileFull){
+			__atomic_store_n(&(tracker->stalled), 1,
+					 __ATOMIC_SEQ_CST);
+		}else{
+			__atomic_store_n(&(file_queue(tracker->firstHeld->fd)->
+					   stalled), 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		}
+
+		hand_held_writes(tracker);
+		if(tracker->firstHeld != NULL && 
+		   (num_pending_writes(tracker) >= MAX_PENDING_WRITES) == 
+		   fileFull){
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Waiting until all the writes of a file, held ones included, are done,
+ * before the file is read, synced or closed
+ *
+ * Returns ERR if one of them couldn't be done
+ */
+int wait_writes(WriteTracker *tracker)
+{
+	//Each write done is posted once, the held ones are handed as the
+	//previous ones are done
+	hand_held_writes(tracker);
+	while(tracker->firstHeld != NULL ||
+	      tracker->numWaited != tracker->numHanded){
+		if(tracker->numWaited != tracker->numHanded){
+			P(&(tracker->done));
+			tracker->numWaited++;
+		}else{
+			sched_yield();
+		}
+		hand_held_writes(tracker);
+	}
+
+	return __atomic_load_n(&(tracker->failed), __ATOMIC_RELAXED) ?
+		ERR : OK;
+}
+
+/*
+ * Depth metrics of the queue of the given I/O thread
+ */
+void write_queue_stats(unsigned int index, WriteQueueStats *stats)
+{
+	WriteQueue *queue = &(queues[index]);
+	uint64_t head = __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+	uint64_t tail = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+
+	stats->depth = (tail > head) ? tail - head : 0;
+	stats->maxDepth = __atomic_load_n(&(queue->maxDepth),
+					  __ATOMIC_RELAXED);
+	stats->numQueued = tail;
+	stats->numFull = __atomic_load_n(&(queue->numFull), __ATOMIC_RELAXED);
+	stats->numWrittenBytes = __atomic_load_n(&(queue->numWrittenBytes),
+						 __ATOMIC_RELAXED);
+}